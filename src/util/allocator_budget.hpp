@@ -0,0 +1,154 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <limits>
+
+namespace deepfabric
+{
+/*
+	CLASS ALLOCATOR_BUDGET
+	----------------------
+*/
+/*!
+	@brief A thread-safe byte budget that allocator_pool objects charge their large allocations against.
+	@details A budget has a limit and keeps count of the bytes currently charged to it.  reserve() succeeds only if the bytes
+	fit within the limit of this budget and of every budget above it (budgets form a tree through their parent pointer), so
+	a pool attached to a per-query budget that is in turn attached to a per-server budget can exceed neither.  The count is
+	maintained with compare-and-swap, so no matter how many threads reserve at once the limit is never exceeded.
+
+	A budget must outlive every pool (and every child budget) attached to it.
+*/
+class allocator_budget
+{
+public:
+    static constexpr size_t unlimited = std::numeric_limits<size_t>::max();	///< A limit that can never be reached.
+
+protected:
+    allocator_budget *parent;			///< The budget above this one (or nullptr if this is the root).
+    std::atomic<size_t> limit;			///< The maximum number of bytes that can be charged to this budget.
+    std::atomic<size_t> used;			///< The number of bytes currently charged to this budget.
+
+private:
+    /*
+    	ALLOCATOR_BUDGET::ALLOCATOR_BUDGET()
+    	------------------------------------
+    */
+    /*!
+    	@brief Private copy constructor prevents object copying
+    */
+    allocator_budget(const allocator_budget &) = delete;
+
+    /*
+    	ALLOCATOR_BUDGET::OPERATOR=()
+    	-----------------------------
+    */
+    /*!
+    	@brief Private assignment operator prevents assigning to this object
+    */
+    allocator_budget &operator=(const allocator_budget &) = delete;
+
+public:
+    /*
+    	ALLOCATOR_BUDGET::ALLOCATOR_BUDGET()
+    	------------------------------------
+    */
+    /*!
+    	@brief Constructor
+    	@param limit [in] The maximum number of bytes that can be charged to this budget.
+    	@param parent [in] Bytes charged to this budget are also charged to this budget (nullptr for none).
+    */
+    explicit allocator_budget(size_t limit = unlimited, allocator_budget *parent = nullptr) :
+        parent(parent),
+        limit(limit),
+        used(0)
+    {
+        /*
+        	Nothing
+        */
+    }
+
+    /*
+    	ALLOCATOR_BUDGET::RESERVE()
+    	---------------------------
+    */
+    /*!
+    	@brief Charge bytes to this budget (and all of its ancestors) if there is room.
+    	@param bytes [in] The number of bytes to charge.
+    	@return true on success, false (and nothing is charged anywhere) if any budget in the chain would exceed its limit.
+    */
+    bool reserve(size_t bytes)
+    {
+        size_t current = used;
+
+        do
+            if (bytes > limit || current > limit - bytes)
+                return false;
+        while (!used.compare_exchange_weak(current, current + bytes));
+
+        /*
+        	Now charge the parent, and if that fails then hand back what we took.
+        */
+        if (parent != nullptr && !parent->reserve(bytes))
+        {
+            used -= bytes;
+            return false;
+        }
+
+        return true;
+    }
+
+    /*
+    	ALLOCATOR_BUDGET::RELEASE()
+    	---------------------------
+    */
+    /*!
+    	@brief Hand back bytes previously charged with reserve().
+    	@param bytes [in] The number of bytes to hand back.
+    */
+    void release(size_t bytes)
+    {
+        used -= bytes;
+        if (parent != nullptr)
+            parent->release(bytes);
+    }
+
+    /*
+    	ALLOCATOR_BUDGET::SET_CAPACITY()
+    	--------------------------------
+    */
+    /*!
+    	@brief Change the limit.  Lowering the limit below size() does not take anything back, it only causes reserve() to fail until enough is released.
+    	@param bytes [in] The new limit.
+    */
+    void set_capacity(size_t bytes)
+    {
+        limit = bytes;
+    }
+
+    size_t capacity(void) const
+    {
+        return limit;
+    }
+
+    size_t size(void) const
+    {
+        return used;
+    }
+};
+}
@@ -11,15 +11,53 @@
 
 namespace deepfabric
 {
+constexpr double allocator_pool::default_growth_factor;
+
+/*
+	ALLOCATOR_POOL::ALLOCATOR_POOL()
+	--------------------------------
+*/
+allocator_pool::allocator_pool() :
+    allocator_pool(default_initial_allocation_size, default_allocation_size, default_growth_factor)
+{
+    /*
+    	Nothing
+    */
+}
+
 /*
 	ALLOCATOR_POOL::ALLOCATOR_POOL()
 	--------------------------------
 */
 allocator_pool::allocator_pool(size_t block_size_for_allocation) :
+    allocator_pool(block_size_for_allocation, block_size_for_allocation, 1.0)
+{
+    /*
+    	Nothing
+    */
+}
+
+/*
+	ALLOCATOR_POOL::ALLOCATOR_POOL()
+	--------------------------------
+*/
+allocator_pool::allocator_pool(size_t initial_block_size, size_t maximum_block_size, double growth_factor) :
     used(0),
     allocated(0),
-    block_size(block_size_for_allocation),
-    current_chunk(nullptr)
+    initial_block_size(initial_block_size < maximum_block_size ? initial_block_size : maximum_block_size),
+    block_size(maximum_block_size),
+    growth_factor(growth_factor),
+    next_block_size(0),
+    budget(nullptr),
+    on_exhaustion(exhaustion_policy::terminate),
+    current_chunk(nullptr),
+    dedicated_chunk(nullptr),
+    chunks_in_flight(0),
+    prefault_threshold(0),
+    spare_chunk(nullptr),
+    prefault_requested(false),
+    prefault_stop(false),
+    fixed(false)
 {
     rewind();		// set up ready for the initial allocation
 }
@@ -30,15 +68,87 @@ allocator_pool::allocator_pool(size_t block_size_for_allocation) :
 */
 allocator_pool::~allocator_pool()
 {
+    /*
+    	Stop the prefaulter (if there is one) before freeing the memory it might be working on
+    */
+    if (prefaulter.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> critical_section(prefault_mutex);
+            prefault_stop = true;
+        }
+        prefault_wakeup.notify_one();
+        prefaulter.join();
+    }
+
     rewind();		// free the all in-use memory (if any)
 }
 
 /*
-	ALLOCATOR_POOL::ADD_CHUNK()
-	---------------------------
-	The bytes parameter is passed to this routine simply so that we can be sure to
-	allocate at least that number of bytes.
+	ALLOCATOR_POOL::ENABLE_PREFAULT()
+	---------------------------------
+*/
+void allocator_pool::enable_prefault(double threshold)
+{
+    assert(!prefaulter.joinable());
+
+    prefault_threshold = threshold;
+    prefaulter = std::thread(&allocator_pool::prefault_main, this);
+}
+
+/*
+	ALLOCATOR_POOL::REQUEST_PREFAULT()
+	----------------------------------
+*/
+void allocator_pool::request_prefault(void)
+{
+    {
+        std::lock_guard<std::mutex> critical_section(prefault_mutex);
+        prefault_requested = true;
+    }
+    prefault_wakeup.notify_one();
+}
+
+/*
+	ALLOCATOR_POOL::PREFAULT_MAIN()
+	-------------------------------
 */
+void allocator_pool::prefault_main(void)
+{
+    static const size_t page_size = 4096;
+
+    do
+    {
+        {
+            std::unique_lock<std::mutex> critical_section(prefault_mutex);
+            prefault_wakeup.wait(critical_section, [this]() { return prefault_requested || prefault_stop; });
+            if (prefault_stop)
+                return;
+            prefault_requested = false;
+        }
+
+        if (spare_chunk.load() != nullptr)
+            continue;			// there's already one waiting
+
+        /*
+        	Allocate the next chunk and write to each page so that the Operating System maps it in now rather than in malloc()
+        */
+        size_t request = next_block_size + sizeof(allocator_pool::chunk);
+        chunk *chain;
+        if ((chain = reserve(request, request)) == nullptr)
+            continue;			// add_chunk() will find out for itself
+
+        for (volatile uint8_t *page = (uint8_t *)chain; page < (uint8_t *)chain + request; page += page_size)
+            *page = 0;
+
+        chain->chunk_size = request;
+
+        chunk *expected = nullptr;
+        if (!spare_chunk.compare_exchange_strong(expected, chain))
+            unreserve(chain, request);
+    }
+    while (true);
+}
 
 template <typename TYPE>
 static const TYPE &maximum(const TYPE &first, const TYPE &second)
@@ -46,22 +156,84 @@ static const TYPE &maximum(const TYPE &first, const TYPE &second)
     return first >= second ? first : second;
 }
 
+/*
+	ALLOCATOR_POOL::RESERVE()
+	-------------------------
+*/
+allocator_pool::chunk *allocator_pool::reserve(size_t &request, size_t minimum)
+{
+    /*
+    	Charge the budget.  If the preferred size does not fit then settle for the minimum.
+    */
+    if (budget != nullptr && !budget->reserve(request))
+    {
+        request = minimum;
+        if (!budget->reserve(request))
+            return nullptr;
+    }
+
+    /*
+    	Get a new block of memory for the C++ free store or the Operating System
+    */
+    chunk *chain;
+    if ((chain = (allocator_pool::chunk *)alloc(request)) == nullptr)
+    {
+        if (budget != nullptr)
+            budget->release(request);
+        return nullptr; //	LCOV_EXCL_LINE		// This can rarely happen because of delayed allocation strategies of Linux and other Operating Systems.
+    }
+
+    return chain;
+}
+
+/*
+	ALLOCATOR_POOL::UNRESERVE()
+	---------------------------
+*/
+void allocator_pool::unreserve(chunk *chain, size_t request)
+{
+    dealloc(chain);
+    if (budget != nullptr)
+        budget->release(request);
+}
+
+/*
+	ALLOCATOR_POOL::ADD_CHUNK()
+	---------------------------
+	The bytes parameter is passed to this routine simply so that we can be sure to
+	allocate at least that number of bytes.
+*/
 allocator_pool::chunk *allocator_pool::add_chunk(size_t bytes)
 {
     bool success;			// was the compate_exchange successful?
     size_t request;			// the amount of memory that is going to be allocated
+    size_t block = next_block_size;
+
+    if (fixed)
+        return nullptr;		// the one chunk is all there is
 
     /*
     	work out the size of the request to the C++ free store or Operating System.
     */
-    request = maximum(block_size, bytes) + sizeof(allocator_pool::chunk);
+    request = maximum(block, bytes) + sizeof(allocator_pool::chunk);
 
     /*
-    	Get a new block of memory for the C++ free store or the Operating System
+    	Use the pre-faulted chunk if there is one and it is large enough, else get one from the C++ free store or Operating System
     */
-    chunk *chain;
-    if ((chain = (allocator_pool::chunk *)alloc(request)) == nullptr)
-        return nullptr; //	LCOV_EXCL_LINE		// This can rarely happen because of delayed allocation strategies of Linux and other Operating Systems.
+    chunks_in_flight++;
+    chunk *chain = spare_chunk.exchange(nullptr);
+    if (chain != nullptr && chain->chunk_size >= bytes + sizeof(allocator_pool::chunk))
+        request = chain->chunk_size;
+    else
+    {
+        if (chain != nullptr)
+            unreserve(chain, chain->chunk_size);
+        if ((chain = reserve(request, bytes + sizeof(allocator_pool::chunk))) == nullptr)
+        {
+            chunks_in_flight--;
+            return nullptr;
+        }
+    }
 
     /*
     	Initialise the chunk
@@ -70,19 +242,84 @@ allocator_pool::chunk *allocator_pool::add_chunk(size_t bytes)
     chain->chunk_size = request;
     chain->chunk_at.store(chain->data);						// this is the start of the data part of the chunk.
     chain->chunk_end = ((uint8_t *)chain) + request;		// this is the end of the allocation unit so we can ignore padding the chunk objects.
+    chain->prefault_at = prefault_point(chain);
 
     /*
     	Place this chunk at the top of the list (if it hasn't been updated by a different thread in the mean time)
     */
     success = current_chunk.compare_exchange_strong(chain->next_chunk, chain);
     if (success)
+    {
         allocated += request;		// update the global statistics
+
+        /*
+        	Grow the next block (unless another thread already has)
+        */
+        size_t grown = (size_t)(block * growth_factor);
+        next_block_size.compare_exchange_strong(block, grown < block_size ? grown : block_size);
+    }
     else
-        dealloc(chain);				// failed to add to the list because someone else already did!
+        unreserve(chain, request);	// failed to add to the list because someone else already did!
+    chunks_in_flight--;
 
     return current_chunk;			// some non-nullptr value
 }
 
+/*
+	ALLOCATOR_POOL::ADD_DEDICATED_CHUNK()
+	-------------------------------------
+*/
+void *allocator_pool::add_dedicated_chunk(size_t bytes, size_t alignment)
+{
+    size_t request = sizeof(allocator_pool::chunk) + bytes + alignment - 1;
+
+    if (fixed)
+        return nullptr;		// the one chunk is all there is
+
+    chunk *chain;
+    if ((chain = reserve(request, request)) == nullptr)
+        return nullptr;
+
+    /*
+    	The chunk is full from the start, its only purpose is to be freed on rewind().
+    */
+    chain->chunk_size = request;
+    chain->chunk_end = ((uint8_t *)chain) + request;
+    chain->chunk_at.store(chain->chunk_end);
+    chain->prefault_at = nullptr;
+
+    /*
+    	Push it on the list of dedicated chunks
+    */
+    chain->next_chunk = dedicated_chunk.load();
+    while (!dedicated_chunk.compare_exchange_weak(chain->next_chunk, chain))
+        ;		// nothing
+
+    allocated += request;
+    used += bytes;
+
+    return chain->data + (alignment == 1 ? 0 : realign(chain->data, alignment));
+}
+
+/*
+	ALLOCATOR_POOL::OUT_OF_MEMORY()
+	-------------------------------
+*/
+void *allocator_pool::out_of_memory(size_t bytes)
+{
+    switch (on_exhaustion)
+    {
+    case exhaustion_policy::throw_bad_alloc:
+        throw std::bad_alloc();
+    case exhaustion_policy::return_nullptr:
+        return nullptr;
+    case exhaustion_policy::terminate:
+    default:
+        exit(printf("file:%s line:%d: Out of memory:%lld bytes requested %lld bytes used %lld bytes allocated.\n",  __FILE__, __LINE__, (long long)bytes, (long long)used, (long long)allocated));	// LCOV_EXCL_LINE
+        return nullptr;
+    }
+}
+
 /*
 	ALLOCATOR_POOL::MALLOC()
 	------------------------
@@ -94,6 +331,10 @@ void *allocator_pool::malloc(size_t bytes, size_t alignment)
     	If USE_CRT_MALLOC is defined then we use the C Runtime Library's malloc.  This is helpful
     	when using memory checkers such as Valgrind.
     */
+    if (budget != nullptr && !budget->reserve(bytes))
+        if (!on_pressure || !on_pressure(bytes) || !budget->reserve(bytes))
+            return out_of_memory(bytes);
+
     void *allocation = ::malloc(bytes);
     used = allocated += bytes;
 
@@ -132,15 +373,35 @@ void *allocator_pool::malloc(size_t bytes, size_t alignment)
         */
         if (chunk == nullptr || top_of_stack + bytes + padding > chunk->chunk_end)
         {
-            if (add_chunk(bytes) != nullptr)
+            if (bytes + alignment > next_block_size)
+            {
+                /*
+                	Too large for a block so give it a chunk of its own
+                */
+                void *dedicated;
+                if ((dedicated = add_dedicated_chunk(bytes, alignment)) != nullptr)
+                    return dedicated;
+            }
+            else if (add_chunk(bytes) != nullptr)
                 continue;
-            else
+
+            /*
+            	Another thread might be adding a chunk (and holding the last of the budget to do so), or might have added one since
+            	we looked.  Either way this is not out of memory, so wait for it and then try that chunk.  Look at chunks_in_flight
+            	first so that a chunk added just as the count falls to zero is still seen.
+            */
+            if (chunks_in_flight.load() != 0)
             {
-                //				#ifdef NEVER
-                exit(printf("file:%s line:%d: Out of memory:%lld bytes requested %lld bytes used %lld bytes allocated.\n",  __FILE__, __LINE__, (long long)bytes, (long long)used, (long long)allocated));	// LCOV_EXCL_LINE
-                //				#endif
-                return nullptr;		// out of memory
+                std::this_thread::yield();
+                continue;
             }
+            if (current_chunk.load() != chunk)
+                continue;
+
+            if (on_pressure && on_pressure(bytes))
+                continue;			// the callback freed some memory so try again
+            else
+                return out_of_memory(bytes);
         }
 
         /*
@@ -151,6 +412,12 @@ void *allocator_pool::malloc(size_t bytes, size_t alignment)
     }
     while (!success);
 
+    /*
+    	If this allocation crossed the pre-fault point of the chunk then get the next chunk ready in the background
+    */
+    if (top_of_stack < chunk->prefault_at && new_top_of_stack >= chunk->prefault_at)
+        request_prefault();
+
     used += bytes;
 
     /*
@@ -169,10 +436,24 @@ void allocator_pool::rewind(void)
 #ifdef USE_CRT_MALLOC
     for (auto &block : crt_malloc_list)
         free(block);
+    if (budget != nullptr)
+        budget->release(allocated);
     used = 0;
     allocated = 0;
     crt_malloc_list.clear();
 #else
+    /*
+    	A fixed chunk is not ours to free, so just empty it
+    */
+    if (fixed)
+    {
+        chunk *only = current_chunk;
+        if (only != nullptr)
+            only->chunk_at = only->data;
+        used = 0;
+        return;
+    }
+
     /*
     	Free all memory blocks
     */
@@ -182,11 +463,23 @@ void allocator_pool::rewind(void)
         killer = chain->next_chunk;
         dealloc(chain);
     }
+    for (chunk *chain = dedicated_chunk; chain != nullptr; chain = killer)
+    {
+        killer = chain->next_chunk;
+        dealloc(chain);
+    }
+    chunk *spare = spare_chunk.exchange(nullptr);
+    if (spare != nullptr)
+        unreserve(spare, spare->chunk_size);
 
     /*
-    	zero the counters and pointers
+    	zero the counters and pointers (and hand the bytes back to the budget)
     */
+    if (budget != nullptr)
+        budget->release(allocated);
     current_chunk = nullptr;
+    dedicated_chunk = nullptr;
+    next_block_size = initial_block_size;
     used = 0;
     allocated = 0;
 #endif
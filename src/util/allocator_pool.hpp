@@ -18,9 +18,15 @@
 #include <stdlib.h>
 #include <assert.h>
 
+#include <new>
 #include <vector>
 #include <mutex>
 #include <atomic>
+#include <functional>
+#include <thread>
+#include <condition_variable>
+
+#include "allocator_budget.hpp"
 
 namespace deepfabric
 {
@@ -36,9 +42,11 @@ namespace deepfabric
 	type, but that is left for other classes to manage (for example, class allocator_cpp).
 
 	If the large memory block "runs out" then a second (and subsequent) block are allocated from the C++ free-store and they
-	are chained together.  If the caller askes for a single piece of memory larger then that default_allocation_size then this
-	class will allocate a chunk of the required size and return that to the caller.  Note that there is wastage at the end of
-	each chunk as they cannot be guaranteed to lay squentially in memory.
+	are chained together.  By default the first block is small (default_initial_allocation_size) and each subsequent block is
+	growth_factor times larger than the previous up to default_allocation_size, so that a pool that is only ever used for a few
+	allocations does not cost a whole large block.  If the caller askes for a single piece of memory larger then the next block
+	then this class will allocate a dedicated chunk of the required size and return that to the caller, leaving the current block
+	in use.  Note that there is wastage at the end of each chunk as they cannot be guaranteed to lay squentially in memory.
 
 	By default allocations by this class are not aligned to any particular boundary.  That is, if 1 byte is allocated then the next memory
 	allocation is likely to be exactly one byte further on.  So allocation of a uint8_t followed by the allocation of a uint32_t is likely to
@@ -51,11 +59,37 @@ namespace deepfabric
 	This allocator is thread safe.  A single allocator can be called from multiple threads concurrently and they will each
 	return a valid pointer to a piece of memory that is not overlapping with any pointer returned from any other call and is of
 	the requested size.
+
+	The large allocations can be charged against an allocator_budget (see set_budget()) in which case the pool will never
+	hold more than the budget allows.  What happens when memory cannot be had (from the budget or from the Operating System)
+	is decided by the exhaustion_policy and the pressure callback (see set_exhaustion_policy()).
 */
 class allocator_pool
 {
+public:
+    /*
+    	ENUM ALLOCATOR_POOL::EXHAUSTION_POLICY
+    	--------------------------------------
+    */
+    /*!
+    	@brief What malloc() does when it cannot get memory (and the pressure callback, if any, could not free any).
+    */
+    enum class exhaustion_policy
+    {
+        terminate,				///< Print a message and exit() the process (the historic behaviour, and the default).
+        return_nullptr,			///< Return nullptr to the caller.
+        throw_bad_alloc			///< Throw std::bad_alloc.
+    };
+
+    /*!
+    	@brief Called with the size of the failed request when memory cannot be had.  Return true if memory was freed and the allocation should be re-tried.
+    */
+    typedef std::function<bool(size_t bytes)> pressure_callback;
+
 protected:
-    static const size_t default_allocation_size = 1024 * 1024 * 1024;	///< Allocations from the C++ free-store are this size
+    static const size_t default_allocation_size = 1024 * 1024 * 1024;	///< Allocations from the C++ free-store grow to this size
+    static const size_t default_initial_allocation_size = 64 * 1024;	///< The first allocation from the C++ free-store is this size
+    static constexpr double default_growth_factor = 2.0;				///< Each allocation from the C++ free-store is this much larger than the previous
 #ifdef __aarch64__
     static constexpr size_t alignment_boundary = sizeof(void *);		///< On ARM its necessary to align all memory allocations on word boundaries
 #else
@@ -65,7 +99,13 @@ protected:
 protected:
     std::atomic<size_t> used;			///< The number of bytes this object has passed back to the caller.
     std::atomic<size_t> allocated;		///< The number of bytes this object has allocated.
-    size_t block_size;					///< The size (in bytes) of the large-allocations this object will make.
+    size_t initial_block_size;			///< The size (in bytes) of the first large-allocation this object will make.
+    size_t block_size;					///< The maximum size (in bytes) of the large-allocations this object will make.
+    double growth_factor;				///< Each large-allocation is this much larger than the previous (up to block_size).
+    std::atomic<size_t> next_block_size;	///< The size (in bytes) of the next large-allocation this object will make.
+    allocator_budget *budget;			///< The large-allocations are charged to this budget (or nullptr if unlimited).
+    exhaustion_policy on_exhaustion;	///< What to do when memory cannot be had.
+    pressure_callback on_pressure;		///< Called (before on_exhaustion is applied) when memory cannot be had.
 
 #ifdef USE_CRT_MALLOC
     std::vector<void *> crt_malloc_list;	///< When USE_CRT_MALLOC is defined the C RTL malloc() is called and this keeps track of those calls (so that rewind() works).
@@ -91,6 +131,7 @@ protected:
         uint8_t *chunk_end;					///< Pointer to the end of the current chunk's large allocation (used to check for overflow).
         chunk *next_chunk;					///< Pointer to the previous large allocation (i.e. chunk).
         size_t chunk_size;					///< The size of this chunk.
+        uint8_t *prefault_at;				///< When chunk_at passes this point the next chunk is pre-faulted in the background (nullptr for never).
 #ifdef WIN32
 #pragma warning(push)			// Xcode thinks thinks a 0-sized entity in a class is OK, but Visual Studio kicks up a fuss (but does it anyway).
 #pragma warning(disable : 4200)
@@ -103,6 +144,18 @@ protected:
 
 protected:
     std::atomic<chunk *> current_chunk;			///< Pointer to the top of the chunk list (of large allocations).
+    std::atomic<chunk *> dedicated_chunk;		///< Pointer to the top of the list of chunks each holding a single request too large for a block.
+    std::atomic<size_t> chunks_in_flight;		///< The number of threads in add_chunk() that might be holding budget for a chunk not yet on the list.
+
+    double prefault_threshold;					///< Pre-fault the next chunk once this fraction of the current chunk is used (0 for never).
+    std::atomic<chunk *> spare_chunk;			///< A pre-faulted chunk ready to be installed by add_chunk() (or nullptr).
+    std::thread prefaulter;						///< The background thread that allocates and pre-faults spare_chunk.
+    std::mutex prefault_mutex;					///< Protects prefault_requested and prefault_stop.
+    std::condition_variable prefault_wakeup;	///< Signalled to wake up the prefaulter.
+    bool prefault_requested;					///< Has the prefaulter been asked to make a spare chunk?
+    bool prefault_stop;							///< Should the prefaulter exit?
+
+    bool fixed;									///< current_chunk is a single chunk owned by a derived class (see arena_pool) that can neither grow nor be freed.
 
 private:
     /*
@@ -158,6 +211,17 @@ protected:
         ::free(buffer);
     }
 
+    /*
+    	ALLOCATOR_POOL::OUT_OF_MEMORY()
+    	-------------------------------
+    */
+    /*!
+    	@brief Apply the exhaustion policy to a failed request.
+    	@param bytes [in] The size (in bytes) of the request that failed.
+    	@return nullptr (if the policy allows this method to return at all).
+    */
+    void *out_of_memory(size_t bytes);
+
     /*
     	ALLOCATOR_POOL::ADD_CHUNK()
     	---------------------------
@@ -169,20 +233,110 @@ protected:
     	The bytes parameter to this method is an indicator of the minimum amount of memory the caller requires, this object will allocate
     	at leat that amount of space plus any space necessary for housekeeping.
     	@param bytes [in] Allocate space so that it is possible to return an allocation is this parameter is size.
-    	@return A pointer to a chunk containig at least this amount of free space.
+    	@return A pointer to a chunk containig at least this amount of free space, or nullptr if the budget or the Operating System refuse.
     */
     chunk *add_chunk(size_t bytes);
 
+    /*
+    	ALLOCATOR_POOL::ADD_DEDICATED_CHUNK()
+    	-------------------------------------
+    */
+    /*!
+    	@brief Get memory from the C++ free store (or the Operating System) for a single request that is larger than the next block.
+    	@details The chunk is added to the list of dedicated chunks (so that it is freed on rewind()) but it does not replace the
+    	current chunk, so the free space at the end of the current chunk is not wasted.
+    	@param bytes [in] The size (in bytes) of the request.
+    	@param alignment [in] The alignment of the request.
+    	@return A pointer to the requested memory, or nullptr if the budget or the Operating System refuse.
+    */
+    void *add_dedicated_chunk(size_t bytes, size_t alignment);
+
+    /*
+    	ALLOCATOR_POOL::RESERVE()
+    	-------------------------
+    */
+    /*!
+    	@brief Allocate a large-allocation from the C++ free store (or the Operating System), charging it to the budget.
+    	@param request [in, out] The preferred size (in bytes), on return the size actually allocated.
+    	@param minimum [in] If the budget cannot afford request bytes then settle for this many.
+    	@return The allocation, or nullptr if the budget or the Operating System refuse.
+    */
+    chunk *reserve(size_t &request, size_t minimum);
+
+    /*
+    	ALLOCATOR_POOL::UNRESERVE()
+    	---------------------------
+    */
+    /*!
+    	@brief Hand back to the C++ free store (or Operating System), and to the budget, an allocation made with reserve().
+    	@param chain [in] The allocation.
+    	@param request [in] Its size (in bytes).
+    */
+    void unreserve(chunk *chain, size_t request);
+
+    /*
+    	ALLOCATOR_POOL::PREFAULT_POINT()
+    	--------------------------------
+    */
+    /*!
+    	@brief Compute the point in a chunk at which the next chunk should be pre-faulted.
+    	@param chain [in] The chunk.
+    	@return The address (or nullptr if pre-faulting is disabled).
+    */
+    uint8_t *prefault_point(const chunk *chain) const
+    {
+        return prefault_threshold <= 0 ? nullptr : (uint8_t *)chain->data + (size_t)((chain->chunk_end - chain->data) * prefault_threshold);
+    }
+
+    /*
+    	ALLOCATOR_POOL::REQUEST_PREFAULT()
+    	----------------------------------
+    */
+    /*!
+    	@brief Ask the background thread to allocate and pre-fault the next chunk.
+    */
+    void request_prefault(void);
+
+    /*
+    	ALLOCATOR_POOL::PREFAULT_MAIN()
+    	-------------------------------
+    */
+    /*!
+    	@brief The body of the background thread that allocates and pre-faults the next chunk.
+    */
+    void prefault_main(void);
+
 public:
+    /*
+    	ALLOCATOR_POOL::ALLOCATOR_POOL()
+    	--------------------------------
+    */
+    /*!
+    	@brief Constructor.  The first large-chunk allocation is default_initial_allocation_size and they grow by default_growth_factor to default_allocation_size.
+    */
+    allocator_pool();
+
     /*
     	ALLOCATOR_POOL::ALLOCATOR_POOL()
     	--------------------------------
     */
     /*!
     	@brief Constructor
-    	@param block_size_for_allocation [in] This size of the large-chunk allocation from the C++ free store or the Operating System.
+    	@param block_size_for_allocation [in] This size of the large-chunk allocation from the C++ free store or the Operating System (all chunks are this size).
     */
-    allocator_pool(size_t block_size_for_allocation = default_allocation_size);
+    allocator_pool(size_t block_size_for_allocation);
+
+    /*
+    	ALLOCATOR_POOL::ALLOCATOR_POOL()
+    	--------------------------------
+    */
+    /*!
+    	@brief Constructor
+    	@param initial_block_size [in] This size of the first large-chunk allocation from the C++ free store or the Operating System.
+    	@param maximum_block_size [in] The large-chunk allocations grow to (at most) this size.
+    	@param growth_factor [in] Each large-chunk allocation is this many times larger than the previous.
+    */
+    allocator_pool(size_t initial_block_size, size_t maximum_block_size, double growth_factor = default_growth_factor);
 
     /*
     	ALLOCATOR_POOL::~ALLOCATOR_POOL()
@@ -255,6 +409,54 @@ public:
         return used;
     }
 
+    /*
+    	ALLOCATOR_POOL::SET_BUDGET()
+    	----------------------------
+    */
+    /*!
+    	@brief Charge all large-allocations made by this object against the given budget.
+    	@details This must be called before the first allocation from the pool (or straight after rewind()).  The budget must
+    	outlive this object.
+    	@param budget [in] The budget to charge (or nullptr for no limit).
+    */
+    void set_budget(allocator_budget *budget)
+    {
+        assert(allocated == 0);
+        this->budget = budget;
+    }
+
+    /*
+    	ALLOCATOR_POOL::SET_EXHAUSTION_POLICY()
+    	---------------------------------------
+    */
+    /*!
+    	@brief Decide what malloc() does when memory cannot be had.
+    	@details When a large-allocation fails (because the budget is exhausted or the Operating System refuses) then the
+    	pressure callback is called first.  If it returns true (it has freed memory, for example by shrinking a cache) the
+    	allocation is tried again, otherwise the policy is applied.
+    	@param policy [in] What to do when memory cannot be had.
+    	@param callback [in] Called before the policy is applied (or nullptr for none).
+    */
+    void set_exhaustion_policy(exhaustion_policy policy, pressure_callback callback = nullptr)
+    {
+        on_exhaustion = policy;
+        on_pressure = std::move(callback);
+    }
+
+    /*
+    	ALLOCATOR_POOL::ENABLE_PREFAULT()
+    	---------------------------------
+    */
+    /*!
+    	@brief Allocate and pre-fault the next chunk on a background thread so that rolling over to it does not take page faults in malloc().
+    	@details Once a chunk is more than threshold full a background thread (one per pool) allocates the next chunk and writes to
+    	each of its pages so that the Operating System maps them in.  add_chunk() then just installs the ready chunk.  The spare
+    	chunk is charged to the budget as soon as it is allocated.  This must be called before the pool is used concurrently, and
+    	at most once.
+    	@param threshold [in] The fraction (0 < threshold <= 1) of the current chunk that must be used before the next is pre-faulted.
+    */
+    void enable_prefault(double threshold = 0.75);
+
     /*
     	ALLOCATOR::REALIGN()
     	--------------------
@@ -296,7 +498,7 @@ public:
     	@brief Allocate a small chunk of memory from the internal block and return a pointer to the caller
     	@param bytes [in] The size of the chunk of memory.
     	@param alignment [in] If a word-aligned piece of memory is needed then this is the word-size (e.g. sizeof(void*))
-    	@return A pointer to a block of memory of size bytes, or NULL on failure.
+    	@return A pointer to a block of memory of size bytes, or NULL on failure (only if the exhaustion policy is exhaustion_policy::return_nullptr).
     */
     void *malloc(size_t bytes, size_t alignment = alignment_boundary);
 
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "arena_pool.hpp"
+#include "common.hpp"
+
+namespace deepfabric
+{
+/*
+	ARENA_POOL::ARENA_POOL()
+	------------------------
+*/
+arena_pool::arena_pool(size_t reserve_bytes) :
+    allocator_pool(reserve_bytes),
+    base(nullptr),
+    mapping_size(header_size + reserve_bytes)
+{
+    void *mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    fixed = true;		// there is only ever the one chunk
+    if (mapping == MAP_FAILED)
+        return;			// LCOV_EXCL_LINE		// every malloc() will now fail and the exhaustion policy applies
+
+    base = (uint8_t *)mapping;
+    install_chunk(0);
+}
+
+/*
+	ARENA_POOL::ARENA_POOL()
+	------------------------
+*/
+arena_pool::arena_pool(uint8_t *base, size_t mapping_size, size_t in_use, bool writable) :
+    allocator_pool(mapping_size),
+    base(base),
+    mapping_size(mapping_size)
+{
+    fixed = true;
+    if (writable)
+        install_chunk(in_use);
+    else
+        used = in_use;			// no chunk, so no allocation
+}
+
+/*
+	ARENA_POOL::~ARENA_POOL()
+	-------------------------
+*/
+arena_pool::~arena_pool()
+{
+    current_chunk = nullptr;		// so that allocator_pool::rewind() doesn't touch the unmapped chunk
+    if (base != nullptr)
+        munmap(base, mapping_size);
+}
+
+/*
+	ARENA_POOL::INSTALL_CHUNK()
+	---------------------------
+*/
+void arena_pool::install_chunk(size_t in_use)
+{
+    chunk *only = (chunk *)(base + header_size - sizeof(chunk));
+
+    only->next_chunk = nullptr;
+    only->chunk_size = mapping_size - header_size + sizeof(chunk);
+    only->chunk_at.store(only->data + in_use);
+    only->chunk_end = base + mapping_size;
+    only->prefault_at = nullptr;
+
+    current_chunk = only;
+    allocated = mapping_size - header_size;
+    used = in_use;
+}
+
+/*
+	ARENA_POOL::SAVE()
+	------------------
+*/
+bool arena_pool::save(const char *filename) const
+{
+    if (base == nullptr)
+        return false;
+
+    chunk *only = current_chunk;
+    uint8_t page[header_size];
+    header *head = (header *)page;
+
+    memset(page, 0, sizeof(page));
+    head->magic = file_magic;
+    head->used = only == nullptr ? (size_t)used : only->chunk_at.load() - only->data;
+
+    handle_t file(fopen(filename, "wb"));
+    if (!file)
+        return false;
+
+    if (fwrite(page, sizeof(page), 1, file.get()) != 1)
+        return false;
+    if (head->used != 0 && fwrite(root(), head->used, 1, file.get()) != 1)
+        return false;
+
+    return fflush(file.get()) == 0;
+}
+
+/*
+	ARENA_POOL::MAP()
+	-----------------
+*/
+std::unique_ptr<arena_pool> arena_pool::map(const char *filename, map_mode mode, size_t reserve_bytes)
+{
+    int file = open(filename, O_RDONLY);
+    if (file < 0)
+        return nullptr;
+
+    /*
+    	Check that the file was written by save()
+    */
+    struct stat details;
+    header head;
+    if (fstat(file, &details) != 0 || (size_t)details.st_size < header_size || pread(file, &head, sizeof(head), 0) != sizeof(head) || head.magic != file_magic || head.used > (size_t)details.st_size - header_size)
+    {
+        close(file);
+        return nullptr;
+    }
+
+    std::unique_ptr<arena_pool> answer;
+    if (mode == map_mode::read_only)
+    {
+        /*
+        	Map just the file
+        */
+        void *mapping = mmap(nullptr, details.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapping != MAP_FAILED)
+            answer.reset(new arena_pool((uint8_t *)mapping, details.st_size, head.used, false));
+    }
+    else
+    {
+        /*
+        	Reserve address space for the whole arena then map the file over the start of it (copy-on-write)
+        */
+        size_t size = header_size + (reserve_bytes > head.used ? reserve_bytes : head.used);
+        if (size < header_size)
+        {
+            close(file);
+            return nullptr;			// reserve_bytes is so large that the size wrapped
+        }
+        if (size < (size_t)details.st_size)
+            size = details.st_size;		// the file is mapped MAP_FIXED over the start so it must all fit (even any bytes past used)
+        void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mapping != MAP_FAILED)
+        {
+            if (mmap(mapping, details.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, file, 0) != MAP_FAILED)
+                answer.reset(new arena_pool((uint8_t *)mapping, size, head.used, true));
+            else
+                munmap(mapping, size);
+        }
+    }
+
+    close(file);
+    return answer;
+}
+
+}
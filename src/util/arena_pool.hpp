@@ -0,0 +1,161 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+
+#include "allocator_pool.hpp"
+#include "offset_ptr.hpp"
+
+namespace deepfabric
+{
+/*
+	CLASS ARENA_POOL
+	----------------
+*/
+/*!
+	@brief An allocator_pool whose memory is a single contiguous reserved range of virtual memory that can be written to disk and mapped back in.
+	@details The arena reserves (but does not commit) reserve_bytes of address space up front and allocates from it exactly as
+	allocator_pool allocates from a chunk, so a pointer into the arena stays valid for the life of the arena and all allocations
+	are laid out one after the other.  When the reservation is used up the arena does not grow, the exhaustion policy applies.
+
+	save() writes the used part of the arena to a file byte for byte.  map() maps such a file back in, read-only or copy-on-write,
+	without touching its contents.  As the file will, in general, be mapped at a different address, structures that are to survive
+	the round trip must link their parts with offset_ptr rather than native pointers.  By convention the first object allocated
+	from the arena is the root of the structure, and root() returns its address.
+
+	The arena must not be used when allocator_pool is built with USE_CRT_MALLOC as then allocations do not come from the chunk.
+*/
+class arena_pool : public allocator_pool
+{
+public:
+    /*
+    	ENUM ARENA_POOL::MAP_MODE
+    	-------------------------
+    */
+    /*!
+    	@brief How map() maps the file.
+    */
+    enum class map_mode
+    {
+        read_only,				///< The arena cannot be written to or allocated from.
+        copy_on_write			///< The arena can be written to and allocated from (changes are private to the process and not written to the file).
+    };
+
+protected:
+    static const size_t header_size = 4096;			///< The file header (and chunk header) occupy this many bytes before the data (a page, so the data is page-aligned when mapped).
+    static const uint64_t file_magic = 0x414E455241464544ULL;	///< "DEFARENA" (little endian), the first 8 bytes of a saved arena.
+
+    /*
+    	CLASS ARENA_POOL::HEADER
+    	------------------------
+    */
+    /*!
+    	@brief The start of a saved arena.
+    */
+    class header
+    {
+    public:
+        uint64_t magic;					///< Always file_magic.
+        uint64_t used;					///< The number of bytes of data that follow the header page.
+    };
+
+protected:
+    uint8_t *base;						///< The start of the mapping (the header page, followed by the data).
+    size_t mapping_size;				///< The size of the mapping (in bytes).
+
+protected:
+    /*
+    	ARENA_POOL::ARENA_POOL()
+    	------------------------
+    */
+    /*!
+    	@brief Constructor used by map() for an arena that already has a mapping.
+    	@param base [in] The start of the mapping.
+    	@param mapping_size [in] The size of the mapping (in bytes).
+    	@param used [in] The number of bytes of data in the arena.
+    	@param writable [in] Can the arena be written to and allocated from?
+    */
+    arena_pool(uint8_t *base, size_t mapping_size, size_t used, bool writable);
+
+    /*
+    	ARENA_POOL::INSTALL_CHUNK()
+    	---------------------------
+    */
+    /*!
+    	@brief Place the single chunk header just before the data so that allocator_pool::malloc() allocates from the arena.
+    	@param used [in] The number of bytes of data already in use.
+    */
+    void install_chunk(size_t used);
+
+public:
+    /*
+    	ARENA_POOL::ARENA_POOL()
+    	------------------------
+    */
+    /*!
+    	@brief Constructor.
+    	@param reserve_bytes [in] The size (in bytes) of the address space to reserve.  Pages are only committed when written to.
+    */
+    explicit arena_pool(size_t reserve_bytes);
+
+    /*
+    	ARENA_POOL::~ARENA_POOL()
+    	-------------------------
+    */
+    /*!
+    	@brief Destructor.
+    */
+    ~arena_pool();
+
+    /*
+    	ARENA_POOL::ROOT()
+    	------------------
+    */
+    /*!
+    	@brief Return the address of the first byte of the arena (the first object allocated from it).
+    	@return The root.
+    */
+    void *root(void) const
+    {
+        return base + header_size;
+    }
+
+    /*
+    	ARENA_POOL::SAVE()
+    	------------------
+    */
+    /*!
+    	@brief Write the arena to a file.  Nothing must be allocated from (or written to) the arena while it is being saved.
+    	@param filename [in] The name of the file to write.
+    	@return true on success, false on failure.
+    */
+    bool save(const char *filename) const;
+
+    /*
+    	ARENA_POOL::MAP()
+    	-----------------
+    */
+    /*!
+    	@brief Map a file written by save() into memory.
+    	@param filename [in] The name of the file to map.
+    	@param mode [in] Map read-only or copy-on-write.
+    	@param reserve_bytes [in] When mode is copy_on_write, reserve this much address space for the data (at least the size of the file is reserved).
+    	@return The arena, or nullptr if the file cannot be mapped or was not written by save().
+    */
+    static std::unique_ptr<arena_pool> map(const char *filename, map_mode mode = map_mode::read_only, size_t reserve_bytes = 0);
+};
+}
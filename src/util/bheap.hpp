@@ -15,6 +15,7 @@
 
 #include <vector>
 #include <cassert>
+#include <cstddef>
 #include <tuple>
 
 
@@ -0,0 +1,468 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "allocator_pool.hpp"
+#include "dynamic_array.hpp"
+
+namespace deepfabric
+{
+/*
+	CLASS BLOCK_COMPRESSED_ARRAY
+	----------------------------
+*/
+/*!
+	@brief Grow-only array of integers compressed in blocks of 128, each with whichever codec makes it smallest.
+	@details compressed_dynamic_array uses variable byte encoding throughout, which is poor for both very dense regions (long runs
+	or consecutive values) and regions of similar large values.  Here each block of block_size values is encoded with the smallest of
+	variable byte, bit packing (frame of reference), run-length, and (for strictly increasing blocks) a bitmap.  The cost of each
+	codec is computed exactly in a single pass over the block, so choosing is cheap.  Each encoded block starts with a one byte codec
+	tag and a one byte count, and is decoded through a table of decoders indexed by the tag.
+
+	Values are buffered until a block is full, so the last (partial) block is not compressed.  Unlike compressed_dynamic_array this
+	class is NOT thread-safe, it is intended for a single writer (such as an indexer building a postings list).
+*/
+class block_compressed_array
+{
+public:
+    static const size_t block_size = 128;			///< The number of values in a (full) block.
+
+    /*
+    	ENUM BLOCK_COMPRESSED_ARRAY::CODEC
+    	----------------------------------
+    */
+    /*!
+    	@brief The codecs, used as the tag byte at the start of each block.
+    */
+    enum codec : uint8_t
+    {
+        variable_byte = 0,		///< Each value as a variable byte integer (7 bits per byte, high bit set on all but the last).
+        bit_packed = 1,			///< The minimum as variable byte, then a width byte, then (value - minimum) in width bits each.
+        run_length = 2,			///< Pairs of variable byte (value, run length).
+        bitmap = 3,				///< Strictly increasing blocks only: the first value and span as variable byte, then a bit per value in the span.
+        codecs = 4				///< The number of codecs.
+    };
+
+protected:
+    typedef const uint8_t *(*decoder)(const uint8_t *from, uint32_t *into, size_t count);	///< A decoder, decodes count values and returns a pointer past the end of the block.
+
+protected:
+    /*
+    	BLOCK_COMPRESSED_ARRAY::BITS()
+    	------------------------------
+    */
+    /*!
+    	@brief Return the number of bits needed to store the value (0 for 0).
+    */
+    static size_t bits(uint32_t value)
+    {
+        return value == 0 ? 0 : 32 - __builtin_clz(value);
+    }
+
+    /*
+    	BLOCK_COMPRESSED_ARRAY::VBYTE_LENGTH()
+    	--------------------------------------
+    */
+    /*!
+    	@brief Return the number of bytes the variable byte encoding of value takes.
+    */
+    static size_t vbyte_length(uint32_t value)
+    {
+        return value < 0x80 ? 1 : (bits(value) + 6) / 7;
+    }
+
+    /*
+    	BLOCK_COMPRESSED_ARRAY::WRITE_VBYTE()
+    	-------------------------------------
+    */
+    /*!
+    	@brief Variable byte encode value (in the same format as compressed_dynamic_array).
+    	@return A pointer past the encoding.
+    */
+    static uint8_t *write_vbyte(uint8_t *into, uint32_t value)
+    {
+        while ((value & ~0x7F) != 0)
+        {
+            *into++ = (uint8_t)((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        *into++ = (uint8_t)value;
+        return into;
+    }
+
+    /*
+    	BLOCK_COMPRESSED_ARRAY::READ_VBYTE()
+    	------------------------------------
+    */
+    /*!
+    	@brief Decode a variable byte encoded integer.
+    	@return A pointer past the encoding.
+    */
+    static const uint8_t *read_vbyte(const uint8_t *from, uint32_t &value)
+    {
+        uint8_t byte = *from++;
+        value = byte & 0x7F;
+        for (uint32_t shift = 7; (byte & 0x80) != 0; shift += 7)
+        {
+            byte = *from++;
+            value |= (uint32_t)(byte & 0x7F) << shift;
+        }
+        return from;
+    }
+
+    static const uint8_t *decode_variable_byte(const uint8_t *from, uint32_t *into, size_t count)
+    {
+        for (size_t which = 0; which < count; which++)
+            from = read_vbyte(from, into[which]);
+        return from;
+    }
+
+    static const uint8_t *decode_bit_packed(const uint8_t *from, uint32_t *into, size_t count)
+    {
+        uint32_t minimum;
+        from = read_vbyte(from, minimum);
+        size_t width = *from++;
+
+        uint64_t buffer = 0;
+        size_t buffered = 0;
+        uint64_t mask = ((uint64_t)1 << width) - 1;
+        for (size_t which = 0; which < count; which++)
+        {
+            while (buffered < width)
+            {
+                buffer |= (uint64_t)*from++ << buffered;
+                buffered += 8;
+            }
+            into[which] = minimum + (uint32_t)(buffer & mask);
+            buffer >>= width;
+            buffered -= width;
+        }
+        return from;
+    }
+
+    static const uint8_t *decode_run_length(const uint8_t *from, uint32_t *into, size_t count)
+    {
+        uint32_t *end = into + count;
+        while (into < end)
+        {
+            uint32_t value, run;
+            from = read_vbyte(from, value);
+            from = read_vbyte(from, run);
+            while (run-- > 0)
+                *into++ = value;
+        }
+        return from;
+    }
+
+    static const uint8_t *decode_bitmap(const uint8_t *from, uint32_t *into, size_t count)
+    {
+        uint32_t first, span;
+        from = read_vbyte(from, first);
+        from = read_vbyte(from, span);
+
+        size_t bytes = ((size_t)span + 7) / 8;
+        for (size_t byte = 0; byte < bytes; byte++)
+            for (uint32_t set = from[byte]; set != 0; set &= set - 1)
+                *into++ = first + byte * 8 + __builtin_ctz(set);
+        return from + bytes;
+    }
+
+    /*
+    	BLOCK_COMPRESSED_ARRAY::DECODE()
+    	--------------------------------
+    */
+    /*!
+    	@brief Decode an encoded block.
+    	@param block [in] The block (starting with its tag and count).
+    	@param into [out] The decoded values (at least block_size of them).
+    	@return The number of values decoded.
+    */
+    static size_t decode(const uint8_t *block, uint32_t *into)
+    {
+        static const decoder table[codecs] = {decode_variable_byte, decode_bit_packed, decode_run_length, decode_bitmap};
+        size_t count = (size_t)block[1] + 1;
+
+        table[block[0]](block + 2, into, count);
+        return count;
+    }
+
+    /*
+    	BLOCK_COMPRESSED_ARRAY::ENCODE()
+    	--------------------------------
+    */
+    /*!
+    	@brief Choose the smallest codec for the pending block, encode it into memory from the pool and add it to the list of blocks.
+    */
+    void encode(void)
+    {
+        /*
+        	Compute the exact size of each encoding in one pass
+        */
+        uint32_t minimum = pending[0];
+        uint32_t maximum = pending[0];
+        bool increasing = true;
+        size_t cost[codecs] = {0, 0, 0, 0};
+        size_t run = 1;
+
+        cost[variable_byte] = vbyte_length(pending[0]);
+        for (size_t which = 1; which < pending_count; which++)
+        {
+            uint32_t value = pending[which];
+            minimum = value < minimum ? value : minimum;
+            maximum = value > maximum ? value : maximum;
+            increasing = increasing && value > pending[which - 1];
+            cost[variable_byte] += vbyte_length(value);
+            if (value == pending[which - 1])
+                run++;
+            else
+            {
+                cost[run_length] += vbyte_length(pending[which - 1]) + vbyte_length(run);
+                run = 1;
+            }
+        }
+        cost[run_length] += vbyte_length(pending[pending_count - 1]) + vbyte_length(run);
+
+        size_t width = bits(maximum - minimum);
+        cost[bit_packed] = vbyte_length(minimum) + 1 + (pending_count * width + 7) / 8;
+
+        /*
+        	The bitmap is only considered when it is no larger than the values as 32-bit integers (any other codec is smaller
+        	than that), which also keeps span within 32 bits
+        */
+        uint64_t span = (uint64_t)maximum - minimum + 1;
+        size_t span_bytes = (size_t)((span + 7) / 8);
+        cost[bitmap] = increasing && span_bytes <= block_size * sizeof(uint32_t) ? vbyte_length(minimum) + vbyte_length((uint32_t)span) + span_bytes : SIZE_MAX;
+
+        uint8_t chosen = variable_byte;
+        for (uint8_t which = 1; which < codecs; which++)
+            if (cost[which] < cost[chosen])
+                chosen = which;
+
+        /*
+        	Encode
+        */
+        uint8_t *block = (uint8_t *)pool.malloc(2 + cost[chosen], 1);
+        uint8_t *into = block + 2;
+        block[0] = chosen;
+        block[1] = (uint8_t)(pending_count - 1);
+
+        switch (chosen)
+        {
+            case variable_byte:
+                for (size_t which = 0; which < pending_count; which++)
+                    into = write_vbyte(into, pending[which]);
+                break;
+            case bit_packed:
+            {
+                into = write_vbyte(into, minimum);
+                *into++ = (uint8_t)width;
+                uint64_t buffer = 0;
+                size_t buffered = 0;
+                for (size_t which = 0; which < pending_count; which++)
+                {
+                    buffer |= (uint64_t)(pending[which] - minimum) << buffered;
+                    for (buffered += width; buffered >= 8; buffered -= 8, buffer >>= 8)
+                        *into++ = (uint8_t)buffer;
+                }
+                if (buffered != 0)
+                    *into++ = (uint8_t)buffer;
+                break;
+            }
+            case run_length:
+            {
+                size_t start = 0;
+                for (size_t which = 1; which <= pending_count; which++)
+                    if (which == pending_count || pending[which] != pending[start])
+                    {
+                        into = write_vbyte(into, pending[start]);
+                        into = write_vbyte(into, which - start);
+                        start = which;
+                    }
+                break;
+            }
+            case bitmap:
+                into = write_vbyte(into, minimum);
+                into = write_vbyte(into, (uint32_t)span);
+                memset(into, 0, span_bytes);
+                for (size_t which = 0; which < pending_count; which++)
+                    into[(pending[which] - minimum) / 8] |= 1 << ((pending[which] - minimum) % 8);
+                break;
+        }
+
+        blocks.push_back(block);
+        encoded_values += pending_count;
+        encoded_bytes += 2 + cost[chosen];
+        pending_count = 0;
+    }
+
+public:
+    /*
+    	CLASS BLOCK_COMPRESSED_ARRAY::ITERATOR
+    	--------------------------------------
+    */
+    /*!
+    	@brief C++ iterator for iterating over a block_compressed_array object, it decodes a block at a time.
+    */
+    class iterator
+    {
+    private:
+        const block_compressed_array *array;				///< The array being iterated over.
+        dynamic_array<const uint8_t *>::iterator next_block;	///< The next block to decode.
+        size_t position;									///< The number of values before this one in the array.
+        size_t at;											///< The index of this value in buffer.
+        size_t available;									///< The number of values in buffer.
+        uint32_t buffer[block_size];						///< The decoded block.
+
+    private:
+        /*
+        	BLOCK_COMPRESSED_ARRAY::ITERATOR::LOAD()
+        	----------------------------------------
+        */
+        /*!
+        	@brief Decode the next block (or copy the pending values once there are no more blocks) into buffer.
+        */
+        void load(void)
+        {
+            at = 0;
+            if (next_block != array->blocks.end())
+            {
+                available = decode(*next_block, buffer);
+                ++next_block;
+            }
+            else
+            {
+                available = array->pending_count;
+                memcpy(buffer, array->pending, available * sizeof(*buffer));
+            }
+        }
+
+    public:
+        /*
+        	BLOCK_COMPRESSED_ARRAY::ITERATOR::ITERATOR()
+        	--------------------------------------------
+        */
+        /*!
+        	@brief constructor
+        	@param array [in] The array to iterate over.
+        	@param position [in] 0 for begin(), size() for end().
+        */
+        iterator(const block_compressed_array *array, size_t position) :
+            array(array),
+            next_block(array->blocks.begin()),
+            position(position),
+            at(0),
+            available(0)
+        {
+            if (position == 0)
+                load();
+        }
+
+        bool operator!=(const iterator &other) const
+        {
+            return position != other.position;
+        }
+
+        const uint32_t &operator*() const
+        {
+            return buffer[at];
+        }
+
+        const iterator &operator++()
+        {
+            position++;
+            if (++at >= available)
+                load();
+            return *this;
+        }
+    };
+
+protected:
+    allocator_pool &pool;					///< The pool allocator used for all allocation by this object.
+    dynamic_array<const uint8_t *> blocks;	///< The encoded blocks.
+    size_t encoded_values;					///< The number of values in the encoded blocks.
+    size_t encoded_bytes;					///< The size (in bytes) of the encoded blocks.
+    size_t pending_count;					///< The number of values waiting to be encoded.
+    uint32_t pending[block_size];			///< The values waiting to be encoded.
+
+public:
+    /*
+    	BLOCK_COMPRESSED_ARRAY::BLOCK_COMPRESSED_ARRAY()
+    	------------------------------------------------
+    */
+    /*!
+    	@brief Constructor.
+    	@param pool [in] The pool allocator used for all allocation done by this object.
+    */
+    explicit block_compressed_array(allocator_pool &pool) :
+        pool(pool),
+        blocks(pool, 16),
+        encoded_values(0),
+        encoded_bytes(0),
+        pending_count(0)
+    {
+    }
+
+    iterator begin(void) const
+    {
+        return iterator(this, 0);
+    }
+
+    iterator end(void) const
+    {
+        return iterator(this, size());
+    }
+
+    /*
+    	BLOCK_COMPRESSED_ARRAY::PUSH_BACK()
+    	-----------------------------------
+    */
+    /*!
+    	@brief Add a value to the end of the array.
+    	@param value [in] The value to add.
+    */
+    void push_back(uint32_t value)
+    {
+        pending[pending_count++] = value;
+        if (pending_count == block_size)
+            encode();
+    }
+
+    /*
+    	BLOCK_COMPRESSED_ARRAY::SIZE()
+    	------------------------------
+    */
+    /*!
+    	@brief Return the number of values in the array.
+    */
+    size_t size(void) const
+    {
+        return encoded_values + pending_count;
+    }
+
+    /*
+    	BLOCK_COMPRESSED_ARRAY::BYTES()
+    	-------------------------------
+    */
+    /*!
+    	@brief Return the size (in bytes) of the encoded blocks (not counting the partial block still waiting to be encoded).
+    */
+    size_t bytes(void) const
+    {
+        return encoded_bytes;
+    }
+};
+}
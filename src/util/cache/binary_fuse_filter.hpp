@@ -0,0 +1,423 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <boost/utility/string_ref.hpp>
+
+/**
+ * Binary fuse filter (3-wise) as per: https://arxiv.org/abs/2201.01174
+ *
+ * An approximate membership filter for a static set of keys: contains() is true for
+ * every key the filter was built from, and for other keys it is false except with
+ * probability 2^-bits, where bits is 8 or 16 (the size of $Fingerprint). It takes about
+ * 1.125 * bits bits per key for large sets (up to about 1.5x that for small ones), whereas
+ * a Bloom filter of the same false positive rate needs 1.44 * bits, and a lookup reads
+ * exactly three fingerprints rather than k bits.
+ *
+ * This is the successor of the xor filter (https://arxiv.org/abs/1912.08258) by the same
+ * authors, which it beats in both space (1.125x rather than 1.23x) and build time: the
+ * three fingerprints of a key are in three consecutive segments of the array, so the
+ * build stays within the cache.
+ *
+ * The filter is built in one pass over the keys, which are hashed (with $Hash and then
+ * a seeded mix) into 64 bits, so the build needs about 24 bytes per key of scratch space.
+ * It can be serialized into a byte string and read back, e.g. to store it alongside
+ * an immutable segment.
+ *
+ * Keys that hash equally are treated as one key (so duplicate keys are fine).
+ */
+
+namespace deepfabric
+{
+
+template<
+    typename T,
+    typename Fingerprint = uint8_t,
+    typename Hash = std::hash<T>
+> class binary_fuse_filter
+{
+    static_assert(std::is_same<Fingerprint, uint8_t>::value
+        || std::is_same<Fingerprint, uint16_t>::value,
+        "Fingerprint must be uint8_t or uint16_t");
+
+    // The first 8 bytes of a serialized filter: "BFUSE" then the fingerprint size.
+    static constexpr uint64_t magic = 0x455355464200ULL | (uint64_t(sizeof(Fingerprint)) << 56);
+
+    static constexpr int max_build_attempts = 100;
+
+    struct header
+    {
+        uint64_t magic;
+        uint64_t seed;
+        uint32_t segment_length;
+        uint32_t segment_count;
+        uint32_t array_length;
+        uint32_t size;
+    };
+
+    uint64_t seed_ = 0;
+    uint32_t segment_length_ = 0;
+    uint32_t segment_length_mask_ = 0;
+    uint32_t segment_count_ = 0;
+    uint32_t segment_count_length_ = 0;
+    uint32_t size_ = 0;
+    std::vector<Fingerprint> fingerprints_;
+
+public:
+
+    /** An empty filter, which contains nothing. */
+    binary_fuse_filter() { layout(0); }
+
+    template<typename Iterator>
+    binary_fuse_filter(Iterator first, Iterator last)
+    {
+        build(first, last);
+    }
+
+    explicit binary_fuse_filter(const std::vector<T>& keys)
+        : binary_fuse_filter(keys.begin(), keys.end())
+    {}
+
+    /** The number of keys the filter was built from. */
+    size_t size() const noexcept { return size_; }
+
+    /** The size of the filter in bytes (not counting the few fields of this object). */
+    size_t size_in_bytes() const noexcept
+    {
+        return fingerprints_.size() * sizeof(Fingerprint);
+    }
+
+    /**
+     * A truthy return value indicates that $t may have been one of the keys.
+     * A falsy return value guarantees that $t was not one of the keys.
+     */
+    bool contains(const T& t) const noexcept
+    {
+        const uint64_t hash = key_hash(t);
+        uint32_t h0, h1, h2;
+        positions(hash, h0, h1, h2);
+        return Fingerprint(fingerprint(hash) ^ fingerprints_[h0] ^ fingerprints_[h1]
+            ^ fingerprints_[h2]) == 0;
+    }
+
+    /**
+     * Builds the filter from the keys in [$first, $last), replacing what it held.
+     * Throws std::runtime_error in the (vanishingly unlikely) case that no seed works.
+     */
+    template<typename Iterator>
+    void build(Iterator first, Iterator last)
+    {
+        const size_t n = std::distance(first, last);
+        if(n > UINT32_MAX / 2)
+        {
+            throw std::invalid_argument("too many keys for binary_fuse_filter");
+        }
+        layout(n);
+
+        const uint32_t capacity = fingerprints_.size();
+        std::unique_ptr<uint64_t[]> reverse_order(new uint64_t[n + 1]);
+        std::unique_ptr<uint8_t[]> reverse_h(new uint8_t[n]);
+        std::unique_ptr<uint32_t[]> alone(new uint32_t[capacity]);
+        std::unique_ptr<uint8_t[]> t2count(new uint8_t[capacity]);
+        std::unique_ptr<uint64_t[]> t2hash(new uint64_t[capacity]);
+
+        // The keys are bucketed by the top bits of their hash, which pick their segment,
+        // so that the counts below are updated in (nearly) sequential order.
+        int block_bits = 1;
+        while((uint32_t(1) << block_bits) < segment_count_) { ++block_bits; }
+        const uint32_t block = uint32_t(1) << block_bits;
+        std::unique_ptr<size_t[]> start_pos(new size_t[block]);
+
+        uint64_t rng = 0x726b2b9d438b9d4dULL;
+        seed_ = splitmix(rng);
+        size_t count = n;
+        bool deduplicate = false;
+        for(int attempt = 0; ; ++attempt)
+        {
+            if(attempt == max_build_attempts)
+            {
+                throw std::runtime_error("failed to build binary_fuse_filter");
+            }
+
+            std::fill(reverse_order.get(), reverse_order.get() + n, 0);
+            reverse_order[n] = 1; // a sentinel for the bucketing below
+            std::fill(t2count.get(), t2count.get() + capacity, 0);
+            std::fill(t2hash.get(), t2hash.get() + capacity, 0);
+            for(uint32_t i = 0; i < block; ++i)
+            {
+                start_pos[i] = (uint64_t(i) * n) >> block_bits;
+            }
+
+            for(Iterator it = first; it != last; ++it)
+            {
+                const uint64_t hash = key_hash(*it);
+                uint64_t bucket = hash >> (64 - block_bits);
+                while(reverse_order[start_pos[bucket]] != 0)
+                {
+                    bucket = (bucket + 1) & (block - 1);
+                }
+                reverse_order[start_pos[bucket]++] = hash;
+            }
+
+            // Equal hashes are mostly caught below as they are added, but not if all their
+            // slots are shared with other keys, so after a failure they are removed first.
+            size_t m = n;
+            if(deduplicate)
+            {
+                std::sort(reverse_order.get(), reverse_order.get() + n);
+                m = std::unique(reverse_order.get(), reverse_order.get() + n)
+                    - reverse_order.get();
+            }
+
+            // For each slot: 4 * the number of keys that map to it plus which of their
+            // three slots it is (the xor of those, which is that of the last key when
+            // there is one left), and the xor of their hashes.
+            size_t duplicates = 0;
+            bool error = false;
+            for(size_t i = 0; i < m; ++i)
+            {
+                const uint64_t hash = reverse_order[i];
+                uint32_t h0, h1, h2;
+                positions(hash, h0, h1, h2);
+                add(t2count.get(), t2hash.get(), h0, h1, h2, hash);
+                if((t2hash[h0] & t2hash[h1] & t2hash[h2]) == 0
+                    && ((t2hash[h0] == 0 && t2count[h0] == 8)
+                        || (t2hash[h1] == 0 && t2count[h1] == 8)
+                        || (t2hash[h2] == 0 && t2count[h2] == 8)))
+                {
+                    // The same hash twice: drop the second.
+                    ++duplicates;
+                    remove(t2count.get(), t2hash.get(), h0, h1, h2, hash);
+                }
+                error |= t2count[h0] < 4 || t2count[h1] < 4 || t2count[h2] < 4;
+            }
+            if(error)
+            {
+                seed_ = splitmix(rng);
+                deduplicate = true;
+                continue;
+            }
+
+            // Peel: repeatedly take a slot that only one key maps to, which that key will
+            // be assigned to, and remove the key from its other two slots.
+            uint32_t queue_size = 0;
+            for(uint32_t i = 0; i < capacity; ++i)
+            {
+                alone[queue_size] = i;
+                queue_size += (t2count[i] >> 2) == 1;
+            }
+            size_t stack_size = 0;
+            while(queue_size > 0)
+            {
+                const uint32_t index = alone[--queue_size];
+                if((t2count[index] >> 2) != 1)
+                {
+                    continue;
+                }
+                const uint64_t hash = t2hash[index];
+                uint32_t h[5];
+                positions(hash, h[0], h[1], h[2]);
+                h[3] = h[0];
+                h[4] = h[1];
+                const uint8_t found = t2count[index] & 3;
+                reverse_h[stack_size] = found;
+                reverse_order[stack_size] = hash;
+                ++stack_size;
+
+                for(uint8_t other = found + 1; other <= found + 2; ++other)
+                {
+                    const uint32_t i = h[other];
+                    alone[queue_size] = i;
+                    queue_size += (t2count[i] >> 2) == 2;
+                    t2count[i] -= 4;
+                    t2count[i] ^= other > 2 ? other - 3 : other;
+                    t2hash[i] ^= hash;
+                }
+            }
+
+            if(stack_size + duplicates == m)
+            {
+                count = stack_size;
+                break;
+            }
+            seed_ = splitmix(rng);
+            deduplicate = true;
+        }
+
+        // Assign in the reverse order of peeling, so that each key's slot is set after
+        // the other two, which no later key changes.
+        std::fill(fingerprints_.begin(), fingerprints_.end(), 0);
+        for(size_t i = count; i-- > 0;)
+        {
+            const uint64_t hash = reverse_order[i];
+            uint32_t h[5];
+            positions(hash, h[0], h[1], h[2]);
+            h[3] = h[0];
+            h[4] = h[1];
+            const uint8_t found = reverse_h[i];
+            fingerprints_[h[found]] = Fingerprint(fingerprint(hash)
+                ^ fingerprints_[h[found + 1]] ^ fingerprints_[h[found + 2]]);
+        }
+    }
+
+    /** The filter as a byte string, for deserialize(). */
+    std::string serialize() const
+    {
+        header h = { magic, seed_, segment_length_, segment_count_,
+            uint32_t(fingerprints_.size()), size_ };
+        std::string bytes(sizeof h + size_in_bytes(), '\0');
+        std::memcpy(&bytes[0], &h, sizeof h);
+        std::memcpy(&bytes[sizeof h], fingerprints_.data(), size_in_bytes());
+        return bytes;
+    }
+
+    /**
+     * Reads back a filter written by serialize() (on a machine of the same byte order),
+     * returning false and leaving the filter as it was if $bytes is not one.
+     */
+    bool deserialize(const boost::string_ref bytes)
+    {
+        header h;
+        if(bytes.size() < sizeof h)
+        {
+            return false;
+        }
+        std::memcpy(&h, bytes.data(), sizeof h);
+        if(h.magic != magic
+            || h.segment_length == 0 || (h.segment_length & (h.segment_length - 1)) != 0
+            || h.segment_count == 0
+            || uint64_t(h.segment_count) * h.segment_length > UINT32_MAX
+            || (uint64_t(h.segment_count) + 2) * h.segment_length != h.array_length
+            || bytes.size() != sizeof h + uint64_t(h.array_length) * sizeof(Fingerprint))
+        {
+            return false;
+        }
+        seed_ = h.seed;
+        segment_length_ = h.segment_length;
+        segment_length_mask_ = h.segment_length - 1;
+        segment_count_ = h.segment_count;
+        segment_count_length_ = h.segment_count * h.segment_length;
+        size_ = h.size;
+        fingerprints_.resize(h.array_length);
+        std::memcpy(fingerprints_.data(), bytes.data() + sizeof h, size_in_bytes());
+        return true;
+    }
+
+private:
+
+    /** Sizes the array for $n keys (the constants are the paper's, for 3-wise). */
+    void layout(const size_t n)
+    {
+        size_ = n;
+        segment_length_ = n == 0 ? 4
+            : uint32_t(1) << int(std::floor(std::log(double(n)) / std::log(3.33) + 2.25));
+        segment_length_ = std::min<uint32_t>(segment_length_, 262144);
+        segment_length_mask_ = segment_length_ - 1;
+
+        const double size_factor = n <= 1 ? 0
+            : std::max(1.125, 0.875 + 0.25 * std::log(1000000.0) / std::log(double(n)));
+        const uint32_t capacity = std::round(n * size_factor);
+        // The keys map to segment_count_ windows of three consecutive segments each.
+        const int64_t segments = (int64_t(capacity) + segment_length_ - 1) / segment_length_;
+        segment_count_ = std::max<int64_t>(1, segments - 2);
+        segment_count_length_ = segment_count_ * segment_length_;
+        fingerprints_.assign(size_t(segment_count_ + 2) * segment_length_, 0);
+    }
+
+    /** The three slots of the key with $hash, one in each of three consecutive segments. */
+    void positions(const uint64_t hash, uint32_t& h0, uint32_t& h1, uint32_t& h2) const noexcept
+    {
+        h0 = (unsigned __int128)hash * segment_count_length_ >> 64;
+        h1 = h0 + segment_length_;
+        h2 = h1 + segment_length_;
+        h1 ^= (hash >> 18) & segment_length_mask_;
+        h2 ^= hash & segment_length_mask_;
+    }
+
+    uint64_t key_hash(const T& t) const noexcept
+    {
+        const uint64_t hash = mix(Hash()(t) + seed_);
+        // Zero marks a free slot while building, so it is taken as one.
+        return hash + (hash == 0);
+    }
+
+    static uint64_t fingerprint(const uint64_t hash) noexcept
+    {
+        return hash ^ (hash >> 32);
+    }
+
+    // The MurmurHash3 finalizer, so that a weak $Hash (e.g. std::hash of an integer is
+    // the integer) still spreads the keys.
+    static uint64_t mix(uint64_t h) noexcept
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static uint64_t splitmix(uint64_t& state) noexcept
+    {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    static void add(uint8_t* count, uint64_t* hashes, const uint32_t h0, const uint32_t h1,
+        const uint32_t h2, const uint64_t hash) noexcept
+    {
+        count[h0] += 4;
+        hashes[h0] ^= hash;
+        count[h1] += 4;
+        count[h1] ^= 1;
+        hashes[h1] ^= hash;
+        count[h2] += 4;
+        count[h2] ^= 2;
+        hashes[h2] ^= hash;
+    }
+
+    static void remove(uint8_t* count, uint64_t* hashes, const uint32_t h0,
+        const uint32_t h1, const uint32_t h2, const uint64_t hash) noexcept
+    {
+        count[h0] -= 4;
+        hashes[h0] ^= hash;
+        count[h1] -= 4;
+        count[h1] ^= 1;
+        hashes[h1] ^= hash;
+        count[h2] -= 4;
+        count[h2] ^= 2;
+        hashes[h2] ^= hash;
+    }
+};
+
+template<typename T, typename F, typename H>
+constexpr uint64_t binary_fuse_filter<T, F, H>::magic;
+template<typename T, typename F, typename H>
+constexpr int binary_fuse_filter<T, F, H>::max_build_attempts;
+
+}
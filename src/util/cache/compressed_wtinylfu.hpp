@@ -0,0 +1,207 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "wtinylfu.hpp"
+#include "detail.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/utility/string_ref.hpp>
+
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+
+/**
+ * A wtinylfu_cache of byte string values (e.g. serialized results) which keeps values of
+ * at least $threshold bytes LZ4 compressed (in its fast mode), so that more of them fit
+ * in the same memory.
+ *
+ * The capacity is in bytes: each entry weighs the size of its value as stored (plus that
+ * of an encoded_value), so a value that compresses 4x takes about a quarter of the room.
+ * Values are decompressed by get() into a buffer supplied by the caller, which can be
+ * reused across calls so that a hit does not allocate once the buffer is big enough.
+ *
+ * A value is only kept compressed if that makes it smaller, and values below the
+ * threshold are stored as they are, since compressing those gains little and costs a
+ * decompression on every hit. Without USE_LZ4 every value is stored as it is, so this is
+ * then a byte-weighted wtinylfu_cache.
+ *
+ * NOTE: it is NOT thread-safe!
+ */
+
+namespace deepfabric
+{
+
+/** A value as stored by compressed_wtinylfu_cache. */
+struct encoded_value
+{
+    std::string bytes;
+    // The size of the original value if $bytes is compressed, or 0 if it is the value.
+    uint32_t raw_size;
+
+    bool is_compressed() const noexcept { return raw_size != 0; }
+
+    /** The size of the original value. */
+    size_t size() const noexcept { return is_compressed() ? raw_size : bytes.size(); }
+};
+
+/** Weighs an encoded_value by the memory it takes. */
+struct encoded_value_weigher
+{
+    int operator()(const encoded_value& value) const noexcept
+    {
+        return sizeof(encoded_value) + value.bytes.size();
+    }
+};
+
+template<
+    typename K,
+    typename Hash = detail::default_hash,
+    typename Compare = std::less<>
+> class compressed_wtinylfu_cache
+{
+    using cache_type = wtinylfu_cache<K, encoded_value, Hash, Compare,
+        encoded_value_weigher>;
+
+    cache_type cache_;
+    size_t threshold_;
+    int acceleration_;
+
+    // Scratch space for compressing, big enough for the largest value inserted so far.
+    std::vector<char> scratch_;
+
+    // Statistics, of the values inserted.
+    uint64_t raw_bytes_ = 0;
+    uint64_t stored_bytes_ = 0;
+
+public:
+
+    /**
+     * $capacity is in bytes, and $expected_size is the typical size of a value as
+     * stored (which sizes the frequency sketch). $acceleration is LZ4's: higher is
+     * faster but compresses less.
+     */
+    explicit compressed_wtinylfu_cache(int capacity, int expected_size = 1024,
+        size_t threshold = 256, int acceleration = 1)
+        : cache_(capacity, expected_size)
+        , threshold_(threshold)
+        , acceleration_(acceleration)
+    {}
+
+    int size() const noexcept { return cache_.size(); }
+    /** The bytes taken by the entries. */
+    int weight() const noexcept { return cache_.weight(); }
+    int capacity() const noexcept { return cache_.capacity(); }
+
+    int num_cache_hits() const noexcept { return cache_.num_cache_hits(); }
+    int num_cache_misses() const noexcept { return cache_.num_cache_misses(); }
+
+    /** The total size of the values inserted divided by the total size stored. */
+    double compression_ratio() const noexcept
+    {
+        return stored_bytes_ == 0 ? 1 : double(raw_bytes_) / stored_bytes_;
+    }
+
+    void change_capacity(const int n) { cache_.change_capacity(n); }
+
+    template<typename Key>
+    bool contains(const Key& key) const noexcept { return cache_.contains(key); }
+
+    /**
+     * Copies (decompressing if need be) the value of $key into $buffer and returns true,
+     * or returns false if $key is not in the cache.
+     */
+    template<typename Key>
+    bool get(const Key& key, std::string& buffer)
+    {
+        std::shared_ptr<encoded_value> value = cache_.get(key);
+        if(value == nullptr)
+        {
+            return false;
+        }
+        decode(*value, buffer);
+        return true;
+    }
+
+    /**
+     * The value of $key as stored, or nullptr if it is not in the cache. This is for
+     * callers that want to decompress it themselves, or later.
+     */
+    template<typename Key>
+    std::shared_ptr<encoded_value> get_encoded(const Key& key)
+    {
+        return cache_.get(key);
+    }
+
+    /** Decodes a value returned by get_encoded() into $buffer. */
+    static void decode(const encoded_value& value, std::string& buffer)
+    {
+#ifdef USE_LZ4
+        if(value.is_compressed())
+        {
+            buffer.resize(value.raw_size);
+            const int size = LZ4_decompress_safe(value.bytes.data(), &buffer[0],
+                value.bytes.size(), value.raw_size);
+            if(size != int(value.raw_size))
+            {
+                throw std::runtime_error("corrupt compressed cache value");
+            }
+            return;
+        }
+#endif
+        buffer.assign(value.bytes.data(), value.bytes.size());
+    }
+
+    void insert(K key, const boost::string_ref value)
+    {
+        encoded_value encoded = encode(value);
+        raw_bytes_ += value.size();
+        stored_bytes_ += encoded.bytes.size();
+        cache_.insert(std::move(key), std::move(encoded));
+    }
+
+    template<typename Key>
+    void erase(const Key& key) { cache_.erase(key); }
+
+private:
+
+    encoded_value encode(const boost::string_ref value)
+    {
+#ifdef USE_LZ4
+        if(value.size() >= threshold_ && value.size() <= LZ4_MAX_INPUT_SIZE)
+        {
+            const int bound = LZ4_compressBound(value.size());
+            if(scratch_.size() < size_t(bound))
+            {
+                scratch_.resize(bound);
+            }
+            const int size = LZ4_compress_fast(value.data(), scratch_.data(), value.size(),
+                bound, acceleration_);
+            if(size > 0 && size_t(size) < value.size())
+            {
+                return { std::string(scratch_.data(), size), uint32_t(value.size()) };
+            }
+        }
+#endif
+        return { std::string(value.data(), value.size()), 0 };
+    }
+};
+
+}
@@ -21,6 +21,10 @@
 #pragma once
 
 #include <bitset>
+#include <cstring>
+#include <string>
+
+#include <boost/utility/string_ref.hpp>
 
 namespace deepfabric
 {
@@ -28,13 +32,11 @@ namespace detail
 {
     // This is Bob Jenkins' One-at-a-Time hash, see:
     // http://www.burtleburtle.net/bob/hash/doobs.html
-    template<typename T>
-    constexpr uint32_t hash(const T& t) noexcept
+    constexpr uint32_t hash_bytes(const char* data, const size_t length) noexcept
     {
-        const char* data = reinterpret_cast<const char*>(&t);
         uint32_t hash = 0;
 
-        for(auto i = 0; i < int(sizeof t); ++i)
+        for(size_t i = 0; i < length; ++i)
         {
             hash += data[i];
             hash += hash << 10;
@@ -48,6 +50,58 @@ namespace detail
         return hash;
     }
 
+    /**
+     * Hashes the bytes of $t, which is only meaningful for trivially copyable types.
+     * Strings have their own overloads below that hash their contents (so the same
+     * characters hash the same whichever of them holds them).
+     */
+    template<typename T>
+    constexpr uint32_t hash(const T& t) noexcept
+    {
+        return hash_bytes(reinterpret_cast<const char*>(&t), sizeof t);
+    }
+
+    inline uint32_t hash(const std::string& s) noexcept
+    {
+        return hash_bytes(s.data(), s.size());
+    }
+
+    inline uint32_t hash(const boost::string_ref s) noexcept
+    {
+        return hash_bytes(s.data(), s.size());
+    }
+
+    inline uint32_t hash(const char* s) noexcept
+    {
+        return hash_bytes(s, std::strlen(s));
+    }
+
+    /**
+     * The default Hash of the caches: detail::hash as a transparent function object, so
+     * that it can be called with any type that can be looked up (e.g. a boost::string_ref
+     * for a std::string key) and gives the same hash for equal keys.
+     */
+    struct default_hash
+    {
+        using is_transparent = void;
+
+        template<typename T>
+        uint32_t operator()(const T& t) const noexcept
+        {
+            return detail::hash(t);
+        }
+    };
+
+    /** The default Weigher of the caches: every value weighs 1. */
+    struct unit_weigher
+    {
+        template<typename T>
+        int operator()(const T&) const noexcept
+        {
+            return 1;
+        }
+    };
+
     /** Returns the number of set bits in x. Also known as Hamming Weight. */
     template<
         typename T,
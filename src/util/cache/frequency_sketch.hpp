@@ -40,16 +40,28 @@
  *
  * The white paper:
  * http://dimacs.rutgers.edu/~graham/pubs/papers/cm-full.pdf
+ *
+ * The counters are kept in a $Table, which is a std::vector by default. Any type with
+ * the same size(), resize(), operator[] and begin()/end() can be used instead, for
+ * example to keep the counters in a shared memory segment (see shm_wtinylfu.hpp).
+ *
+ * Elements are hashed with $Hash, and anything it can hash can be passed to contains(),
+ * frequency() and record_access(), e.g. a boost::string_ref for a std::string T (with
+ * the default, detail::default_hash).
  */
 namespace deepfabric
 {
 
-template<typename T> class frequency_sketch
+template<
+    typename T,
+    typename Table = std::vector<uint64_t>,
+    typename Hash = detail::default_hash
+> class frequency_sketch
 {
     // Holds 64 bit blocks, each of which holds sixteen 4 bit counters. For simplicity's
     // sake, the 64 bit blocks are partitioned into four 16 bit sub-blocks, and the four
     // counters corresponding to some T is within a single such sub-block.
-    std::vector<uint64_t> table_;
+    Table table_;
 
     // Incremented with each call to record_access, if the frequency of the item could
     // be incremented, and halved when sampling size is reached.
@@ -62,24 +74,48 @@ public:
         change_capacity(capacity);
     }
 
+    /** Uses $table (which must be able to hold $capacity rounded up to a power of two). */
+    frequency_sketch(int capacity, Table table) : table_(std::move(table))
+    {
+        change_capacity(capacity);
+    }
+
+    /**
+     * Resizes the table without losing what it knows: the table size is a power of two
+     * and a counter's index is its hash masked by size - 1, so halving the table moves
+     * each counter to index & (size / 2 - 1), where it is added (saturating) to the one
+     * already there, and doubling it duplicates each counter into both indices it could
+     * now be at. Either way every estimate is at least what it was, as a count-min
+     * sketch should be.
+     */
     void change_capacity(const int n)
     {
         if(n <= 0)
         {
             throw std::invalid_argument("frequency_sketch capacity must be larger than 0");
         }
-        table_.resize(detail::nearest_power_of_two(n));
-        size_ = 0;
+
+        const size_t new_size = detail::nearest_power_of_two(n);
+        if(table_.size() == 0)
+        {
+            table_.resize(new_size);
+            size_ = 0;
+            return;
+        }
+        while(table_.size() > new_size) { fold(); }
+        while(table_.size() < new_size) { unfold(); }
     }
 
-    bool contains(const T& t) const noexcept
+    template<typename U>
+    bool contains(const U& t) const noexcept
     {
         return frequency(t) > 0;
     }
 
-    int frequency(const T& t) const noexcept
+    template<typename U>
+    int frequency(const U& t) const noexcept
     {
-        const uint32_t hash = detail::hash(t);
+        const uint32_t hash = Hash()(t);
         int frequency = std::numeric_limits<int>::max();
 
         for(auto i = 0; i < 4; ++i)
@@ -90,9 +126,10 @@ public:
         return frequency;
     }
 
-    void record_access(const T& t) noexcept
+    template<typename U>
+    void record_access(const U& t) noexcept
     {
-        const uint32_t hash = detail::hash(t);
+        const uint32_t hash = Hash()(t);
         bool was_added = false;
 
         for(auto i = 0; i < 4; ++i)
@@ -185,6 +222,42 @@ private:
         return (table_[table_index] & mask) != mask;
     }
 
+    /** Halves the table by adding its top half into its bottom half. */
+    void fold()
+    {
+        const size_t half = table_.size() / 2;
+        for(size_t i = 0; i < half; ++i)
+        {
+            table_[i] = saturating_add(table_[i], table_[i + half]);
+        }
+        table_.resize(half);
+        size_ /= 2;
+    }
+
+    /** Doubles the table by copying its counters into the new top half. */
+    void unfold()
+    {
+        const size_t size = table_.size();
+        table_.resize(2 * size);
+        for(size_t i = 0; i < size; ++i)
+        {
+            table_[i + size] = table_[i];
+        }
+        size_ *= 2;
+    }
+
+    /** Adds each of the sixteen 4 bit counters in $a to the one in $b, stopping at 15. */
+    static uint64_t saturating_add(const uint64_t a, const uint64_t b) noexcept
+    {
+        const uint64_t high = 0x8888888888888888L;
+        // Add the low three bits of each pair (which cannot carry out of the counter),
+        // then the top bits, and saturate the counters that carried out.
+        const uint64_t low_sum = (a & ~high) + (b & ~high);
+        const uint64_t sum = low_sum ^ ((a ^ b) & high);
+        const uint64_t carry = ((a & b) | ((a ^ b) & low_sum)) & high;
+        return sum | ((carry >> 3) * 0xf);
+    }
+
     /** Halves every counter and adjusts $size_. */
     void reset() noexcept
     {
@@ -0,0 +1,219 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "sharded_wtinylfu.hpp"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+
+/**
+ * A small per-thread (L1) cache in front of a shared $Cache (a sharded_wtinylfu_cache),
+ * so that a thread's hottest keys are found without taking the shared cache's locks or
+ * writing to its cache lines.
+ *
+ * Each thread that uses the shared cache makes its own front_cache (it is NOT
+ * thread-safe) and goes through it. It is $Sets sets of $Ways entries (a set is picked
+ * by the key's hash, $Ways = 1 makes it direct-mapped) which keep the shared_ptr to a
+ * value fetched from the shared cache, replacing the least recently used entry of the
+ * set on a miss.
+ *
+ * Values are treated as immutable: insert() and erase() go to the shared cache, which
+ * advances the generation of the key's stripe, and an entry is only served while the
+ * generation it was fetched at is still current (see sharded_wtinylfu_cache), so no
+ * thread is served a value older than the last insert() or erase() of its key that had
+ * returned before the lookup began. A write to any key of the stripe invalidates the
+ * entry, which costs a refetch.
+ *
+ * get(key, value) copies the value out, so a hit touches only this thread's memory and
+ * the (read-mostly) generation of the key's stripe. get(key) returns the shared_ptr,
+ * whose reference count is shared by all threads.
+ *
+ * Hits in the front cache are counted here, those in the shared cache by it. The shared
+ * cache only sees the accesses that miss the front cache, so its frequency sketch
+ * underestimates the hottest keys, which is harmless as long as they stay in front.
+ */
+
+namespace deepfabric
+{
+
+template<
+    typename Cache,
+    int Sets = 64,
+    int Ways = 4
+> class front_cache
+{
+    static_assert(Sets > 0 && (Sets & (Sets - 1)) == 0, "Sets must be a power of two");
+    static_assert(Ways > 0, "Ways must be greater than zero");
+
+    using K = typename Cache::key_type;
+    using V = typename Cache::mapped_type;
+
+    struct entry
+    {
+        K key;
+        std::shared_ptr<V> value; // nullptr if the entry is empty
+        uint32_t hash = 0;
+        uint32_t generation = 0;
+        uint32_t last_used = 0;
+    };
+
+    Cache& cache_;
+    std::array<std::array<entry, Ways>, Sets> sets_;
+    uint32_t clock_ = 0;
+
+    // Statistics.
+    int num_hits_ = 0;
+    int num_misses_ = 0;
+
+public:
+
+    explicit front_cache(Cache& cache) : cache_(cache) {}
+
+    front_cache(const front_cache&) = delete;
+    front_cache& operator=(const front_cache&) = delete;
+
+    /** The number of lookups this front cache answered. */
+    int num_cache_hits() const noexcept { return num_hits_; }
+    /** The number of lookups this front cache passed on to the shared cache. */
+    int num_cache_misses() const noexcept { return num_misses_; }
+
+    Cache& shared() noexcept { return cache_; }
+
+    /** Copies the value of $key into $value and returns true, or returns false. */
+    template<typename Key>
+    bool get(const Key& key, V& value)
+    {
+        entry* e = lookup(key, Cache::hash(key));
+        if(e == nullptr)
+        {
+            return false;
+        }
+        value = *e->value;
+        return true;
+    }
+
+    template<typename Key>
+    std::shared_ptr<V> get(const Key& key)
+    {
+        entry* e = lookup(key, Cache::hash(key));
+        return e != nullptr ? e->value : nullptr;
+    }
+
+    template<typename Key>
+    std::shared_ptr<V> operator[](const Key& key)
+    {
+        return get(key);
+    }
+
+    template<typename Key, typename ValueLoader>
+    std::shared_ptr<V> get_and_insert_if_missing(const Key& key, ValueLoader value_loader)
+    {
+        std::shared_ptr<V> value = get(key);
+        if(value == nullptr)
+        {
+            value = std::make_shared<V>(value_loader(key));
+            cache_.insert(K(key), *value);
+        }
+        return value;
+    }
+
+    void insert(K key, V value)
+    {
+        cache_.insert(std::move(key), std::move(value));
+    }
+
+    template<typename Key>
+    void erase(const Key& key)
+    {
+        cache_.erase(key);
+    }
+
+    /** Drops every entry (e.g. before the thread goes idle, to release the values). */
+    void clear() noexcept
+    {
+        for(auto& set : sets_)
+        {
+            for(auto& e : set)
+            {
+                e.value = nullptr;
+            }
+        }
+    }
+
+private:
+
+    /** The up to date entry of $key, fetching it from the shared cache if need be. */
+    template<typename Key>
+    entry* lookup(const Key& key, const uint32_t hash)
+    {
+        auto& set = sets_[hash & (Sets - 1)];
+        const uint32_t generation = cache_.generation(hash);
+        ++clock_;
+
+        entry* victim = &set[0];
+        for(auto& e : set)
+        {
+            if(e.value != nullptr && e.hash == hash && equal(e.key, key))
+            {
+                if(e.generation == generation)
+                {
+                    e.last_used = clock_;
+                    ++num_hits_;
+                    return &e;
+                }
+                // Stale: refetch into the same entry so that there's only one of $key.
+                victim = &e;
+                break;
+            }
+            if(e.value == nullptr)
+            {
+                victim = &e;
+            }
+            else if(victim->value != nullptr && e.last_used < victim->last_used)
+            {
+                victim = &e;
+            }
+        }
+
+        ++num_misses_;
+        // The generation was read before the shared cache is, so if the value changes
+        // in between, the entry is already stale.
+        std::shared_ptr<V> value = cache_.get(key, hash);
+        if(value == nullptr)
+        {
+            if(victim->value != nullptr && victim->hash == hash && equal(victim->key, key))
+            {
+                victim->value = nullptr; // erased
+            }
+            return nullptr;
+        }
+        victim->key = K(key);
+        victim->value = std::move(value);
+        victim->hash = hash;
+        victim->generation = generation;
+        victim->last_used = clock_;
+        return victim;
+    }
+
+    template<typename Key>
+    static bool equal(const K& a, const Key& b)
+    {
+        typename Cache::key_compare compare;
+        return !compare(a, b) && !compare(b, a);
+    }
+};
+
+}
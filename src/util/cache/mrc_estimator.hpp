@@ -0,0 +1,312 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "detail.hpp"
+
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+
+/**
+ * Online miss ratio curve estimator: estimates the miss ratio an LRU cache would have
+ * at every capacity up to $max_capacity, from the stream of keys passed to
+ * record_access(), so that a cache can be sized from its actual workload.
+ *
+ * This is SHARDS (Waldspurger et al., "Efficient MRC Construction with SHARDS", FAST
+ * '15) in its fixed-size form. A key is sampled if and only if its hash (by $Hash) is
+ * below a threshold, so either every access to a key is seen or none is, and the reuse
+ * distance among the sampled keys, divided by the sampling rate, estimates the reuse
+ * distance among all keys. The reuse (LRU stack) distance of an access is the number of
+ * distinct keys accessed since the previous access to the same key; an LRU cache of
+ * capacity c hits exactly the accesses whose distance is less than c.
+ *
+ * At most $max_samples keys are tracked. The sampling rate starts at $initial_rate
+ * (SHARDS finds 1% plenty for real workloads, and it keeps the cost of the many
+ * unsampled accesses to a hash and a compare) and, whenever
+ * there are too many keys, the threshold is lowered to the largest tracked hash and the
+ * keys at or above it are dropped, so memory is bounded whatever the key space. The
+ * distances are counted with a Fenwick tree over the time of each tracked key's latest
+ * access, which is compacted when it fills up.
+ *
+ * When the rate is lowered the histogram is scaled down to match, as if it had been
+ * sampled at the new rate all along, and as in SHARDS_adj the difference between the
+ * expected and actual number of sampled accesses is credited to the smallest distances
+ * (it comes from the hottest keys happening to fall either side of the threshold).
+ *
+ * Unsampled accesses cost one hash and one compare. The histogram is halved every
+ * $decay_interval sampled accesses (like the frequency sketch's reset) so the curve
+ * follows a changing workload.
+ *
+ * NOTE: W-TinyLFU admits and evicts differently to LRU (and usually beats it), so for a
+ * wtinylfu_cache the curve is a conservative estimate.
+ *
+ * NOTE: it is NOT thread-safe!
+ */
+
+namespace deepfabric
+{
+
+template<
+    typename T,
+    typename Hash = detail::default_hash,
+    typename Compare = std::less<>
+> class mrc_estimator
+{
+    struct sample
+    {
+        uint32_t hash;
+        uint32_t last_access; // the time (in sampled accesses) of the latest access
+    };
+
+    // The tracked keys ($Compare should be transparent, like std::less<>, so that they
+    // can be found by anything comparable with a T).
+    std::map<T, sample, Compare> samples_;
+
+    // The tracked keys by hash, largest first, to find which to drop when lowering the
+    // threshold.
+    std::priority_queue<std::pair<uint32_t, T>> by_hash_;
+
+    // Fenwick (binary indexed) tree over time: 1 at the latest access time of each
+    // tracked key, 0 elsewhere. Index 0 is unused.
+    std::vector<int> fenwick_;
+
+    // The time of the next sampled access.
+    uint32_t now_ = 1;
+
+    // A key is sampled if its hash is below this, so the sampling rate is
+    // $threshold_ / 2^32.
+    uint64_t threshold_;
+
+    size_t max_samples_;
+    int bucket_width_;
+    int decay_interval_;
+
+    // histogram_[b] counts the sampled accesses with estimated distance in
+    // [b * $bucket_width_, (b + 1) * $bucket_width_), and the last bucket counts those
+    // further away, as well as the first access to each key (compulsory misses).
+    std::vector<double> histogram_;
+    double total_ = 0;
+    int since_decay_ = 0;
+
+    // All accesses, sampled or not (halved with the histogram).
+    double accesses_ = 0;
+
+public:
+
+    /**
+     * Estimates the miss ratio at $points capacities evenly spaced up to $max_capacity,
+     * sampling $initial_rate of the keys but tracking at most $max_samples keys.
+     */
+    explicit mrc_estimator(const int max_capacity, const int points = 64,
+        const int max_samples = 8192, const double initial_rate = 0.01)
+        : fenwick_(2 * max_samples + 2)
+        , threshold_(std::min(1.0, std::max(0.0, initial_rate)) * double(uint64_t(1) << 32))
+        , max_samples_(max_samples)
+        , bucket_width_(std::max(1, max_capacity / points))
+        , decay_interval_(16 * max_samples)
+        , histogram_(points + 1)
+    {
+        if(max_capacity <= 0 || points <= 0 || max_samples <= 0 || initial_rate <= 0)
+        {
+            throw std::invalid_argument("mrc_estimator parameters must be greater than 0");
+        }
+    }
+
+    /** $t may be a T or anything $Hash and $Compare accept alongside a T. */
+    template<typename U>
+    void record_access(const U& t)
+    {
+        const uint32_t hash = Hash()(t);
+        accesses_ += 1;
+        if(hash >= threshold_)
+        {
+            return;
+        }
+
+        auto it = samples_.find(t);
+        if(it == samples_.end())
+        {
+            histogram_.back() += 1;
+            auto inserted = samples_.emplace(T(t), sample{ hash, now_ }).first;
+            by_hash_.emplace(hash, inserted->first);
+            add(now_, 1);
+            if(samples_.size() > max_samples_)
+            {
+                lower_threshold();
+            }
+        }
+        else
+        {
+            auto& s = it->second;
+            const double distance = prefix_sum(now_ - 1) - prefix_sum(s.last_access);
+            const size_t bucket = distance * (double(uint64_t(1) << 32) / threshold_)
+                / bucket_width_;
+            histogram_[std::min(bucket, histogram_.size() - 1)] += 1;
+            add(s.last_access, -1);
+            add(now_, 1);
+            s.last_access = now_;
+        }
+
+        total_ += 1;
+        if(++now_ == fenwick_.size())
+        {
+            compact();
+        }
+        if(++since_decay_ == decay_interval_)
+        {
+            decay();
+        }
+    }
+
+    /** The fraction of keys being sampled. */
+    double sampling_rate() const noexcept
+    {
+        return double(threshold_) / double(uint64_t(1) << 32);
+    }
+
+    /** The estimated miss ratio of an LRU cache of $capacity (1 with no data). */
+    double miss_ratio(const int capacity) const noexcept
+    {
+        const size_t buckets = std::min(size_t(capacity / bucket_width_),
+            histogram_.size() - 1);
+        double hits = 0;
+        for(size_t bucket = 0; bucket < buckets; ++bucket)
+        {
+            hits += histogram_[bucket];
+        }
+        return buckets == 0 ? 1 : adjusted_miss_ratio(hits);
+    }
+
+    /** (capacity, estimated miss ratio) at each of the $points capacities. */
+    std::vector<std::pair<int, double>> curve() const
+    {
+        std::vector<std::pair<int, double>> points;
+        double hits = 0;
+        for(size_t bucket = 0; bucket + 1 < histogram_.size(); ++bucket)
+        {
+            hits += histogram_[bucket];
+            points.emplace_back((bucket + 1) * bucket_width_, adjusted_miss_ratio(hits));
+        }
+        return points;
+    }
+
+    /**
+     * The smallest capacity estimated to have a miss ratio of at most $target (for
+     * change_capacity()), or 0 if none up to $max_capacity does.
+     */
+    int capacity_for(const double target) const
+    {
+        for(const auto& point : curve())
+        {
+            if(point.second <= target)
+            {
+                return point.first;
+            }
+        }
+        return 0;
+    }
+
+private:
+
+    /** The miss ratio given the sampled hits, with the SHARDS_adj correction. */
+    double adjusted_miss_ratio(const double hits) const noexcept
+    {
+        const double expected = accesses_ * sampling_rate();
+        if(expected == 0)
+        {
+            return 1;
+        }
+        const double ratio = 1 - (hits + expected - total_) / expected;
+        return std::min(1.0, std::max(0.0, ratio));
+    }
+
+    void add(size_t i, const int delta) noexcept
+    {
+        for(; i < fenwick_.size(); i += i & -i)
+        {
+            fenwick_[i] += delta;
+        }
+    }
+
+    int prefix_sum(size_t i) const noexcept
+    {
+        int sum = 0;
+        for(; i > 0; i -= i & -i)
+        {
+            sum += fenwick_[i];
+        }
+        return sum;
+    }
+
+    /**
+     * Drops the keys with the largest hashes until there are few enough, and rescales
+     * the histogram to the new sampling rate.
+     */
+    void lower_threshold()
+    {
+        const double scale = double(by_hash_.top().first) / threshold_;
+        for(auto& count : histogram_)
+        {
+            count *= scale;
+        }
+        total_ *= scale;
+
+        threshold_ = by_hash_.top().first;
+        while(!by_hash_.empty() && by_hash_.top().first >= threshold_)
+        {
+            auto it = samples_.find(by_hash_.top().second);
+            add(it->second.last_access, -1);
+            samples_.erase(it);
+            by_hash_.pop();
+        }
+    }
+
+    /** Renumbers the latest access times 1, 2, 3, ... keeping their order. */
+    void compact()
+    {
+        std::vector<sample*> order;
+        order.reserve(samples_.size());
+        for(auto& entry : samples_)
+        {
+            order.push_back(&entry.second);
+        }
+        std::sort(order.begin(), order.end(), [](const sample* a, const sample* b)
+            { return a->last_access < b->last_access; });
+
+        std::fill(fenwick_.begin(), fenwick_.end(), 0);
+        now_ = 1;
+        for(auto* s : order)
+        {
+            s->last_access = now_;
+            add(now_++, 1);
+        }
+    }
+
+    void decay() noexcept
+    {
+        for(auto& count : histogram_)
+        {
+            count /= 2;
+        }
+        total_ /= 2;
+        accesses_ /= 2;
+        since_decay_ = 0;
+    }
+};
+
+}
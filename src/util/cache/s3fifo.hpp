@@ -0,0 +1,457 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "frequency_sketch.hpp"
+#include "detail.hpp"
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+/**
+ * S3-FIFO cache as per: https://dl.acm.org/doi/10.1145/3600006.3613147
+ *
+ * Three FIFO queues and no LRU: new entries go into the small queue (10% of the
+ * capacity), entries that are hit while there move on to the main queue (90%) when
+ * they reach the end of it, and the rest are evicted with just their key hash kept in
+ * the ghost queue, so that if they come back soon they go straight to the main queue.
+ * The main queue is a CLOCK: an entry at the end that has been hit is given another
+ * lap instead of being evicted.
+ *
+ * The point is that a hit only sets a 2-bit frequency counter in the entry (and only
+ * writes it at all until it saturates), whereas wtinylfu_cache splices list nodes on
+ * every hit. So lookups take a shared lock on one of $shard_count index shards, and
+ * only misses (insert() and eviction) take the exclusive queue lock.
+ *
+ * Optionally (see the constructor) a frequency_sketch is used for TinyLFU admission at
+ * the door of the small queue: when the cache is full a new key is only admitted if
+ * it has been missed at least as often as the small queue's next victim. The sketch is
+ * only ever touched under the queue lock: it records misses, and an entry's hits are
+ * added to it as eviction consumes them (moving it to the main queue or giving it
+ * another lap of the main queue).
+ *
+ * Values are stored in shared_ptr<V> instances in order to ensure memory safety when
+ * a cache entry is evicted while it is still being used by user.
+ *
+ * Unlike wtinylfu_cache this is thread-safe, and K needs std::hash and == rather than <.
+ */
+
+namespace deepfabric
+{
+
+template<
+    typename K,
+    typename V
+> class s3fifo_cache
+{
+    static constexpr int shard_count = 64;
+    static constexpr uint8_t max_frequency = 3;
+
+    struct page
+    {
+        K key;
+        std::shared_ptr<V> data;
+        std::atomic<uint8_t> frequency;
+        bool in_main;
+        bool erased; // erase() leaves the page in its queue, eviction frees it
+
+        page(const K& key_, std::shared_ptr<V> data_, bool in_main_)
+            : key(key_)
+            , data(std::move(data_))
+            , frequency(0)
+            , in_main(in_main_)
+            , erased(false)
+        {}
+    };
+
+    /**
+     * A part of the index with its own lock. Padded so that the locks (and counters) of
+     * neighbouring shards are not on the same cache line.
+     */
+    struct shard
+    {
+        std::shared_timed_mutex mutex;
+        std::unordered_map<K, page*> index;
+        std::atomic<int> num_cache_hits;
+        std::atomic<int> num_cache_misses;
+        char padding[64];
+
+        shard() : num_cache_hits(0), num_cache_misses(0) {}
+    };
+
+    /**
+     * The keys recently evicted from the small queue, as a FIFO of hashes and a map from
+     * hash to its latest position in the FIFO.
+     */
+    class ghost
+    {
+        std::deque<size_t> fifo_;
+        std::unordered_map<size_t, uint64_t> position_;
+        uint64_t popped_ = 0;
+        size_t capacity_;
+
+    public:
+
+        explicit ghost(size_t capacity) : capacity_(capacity) {}
+
+        void set_capacity(size_t n) { capacity_ = n; trim(); }
+
+        bool contains(size_t hash) const
+        {
+            return position_.find(hash) != position_.end();
+        }
+
+        void insert(size_t hash)
+        {
+            position_[hash] = popped_ + fifo_.size();
+            fifo_.push_back(hash);
+            trim();
+        }
+
+        void erase(size_t hash) { position_.erase(hash); }
+
+    private:
+
+        void trim()
+        {
+            while(fifo_.size() > capacity_)
+            {
+                auto it = position_.find(fifo_.front());
+                if(it != position_.end() && it->second == popped_)
+                {
+                    position_.erase(it);
+                }
+                fifo_.pop_front();
+                ++popped_;
+            }
+        }
+    };
+
+    std::array<shard, shard_count> shards_;
+
+    // Held (exclusively) to change the queues, the sketch, or the set of pages.
+    std::mutex queue_mutex_;
+    std::deque<page*> small_;
+    std::deque<page*> main_;
+    ghost ghost_;
+    std::atomic<int> small_size_;
+    std::atomic<int> main_size_;
+    std::atomic<int> capacity_;
+
+    std::unique_ptr<frequency_sketch<K>> filter_;
+
+public:
+
+    /** If $admission is true a frequency_sketch is used to admit new keys. */
+    explicit s3fifo_cache(int capacity, bool admission = false)
+        : ghost_(0)
+        , small_size_(0)
+        , main_size_(0)
+        , capacity_(0)
+    {
+        if(admission)
+        {
+            filter_.reset(new frequency_sketch<K>(capacity));
+        }
+        change_capacity(capacity);
+    }
+
+    ~s3fifo_cache()
+    {
+        for(auto* queue : { &small_, &main_ })
+        {
+            for(auto* p : *queue)
+            {
+                delete p;
+            }
+        }
+    }
+
+    s3fifo_cache(const s3fifo_cache&) = delete;
+    s3fifo_cache& operator=(const s3fifo_cache&) = delete;
+
+    int size() const noexcept { return small_size_ + main_size_; }
+    int capacity() const noexcept { return capacity_; }
+
+    int num_cache_hits() const noexcept
+    {
+        int hits = 0;
+        for(const auto& s : shards_) { hits += s.num_cache_hits.load(std::memory_order_relaxed); }
+        return hits;
+    }
+
+    int num_cache_misses() const noexcept
+    {
+        int misses = 0;
+        for(const auto& s : shards_) { misses += s.num_cache_misses.load(std::memory_order_relaxed); }
+        return misses;
+    }
+
+    bool contains(const K& key)
+    {
+        auto& s = shard_of(key);
+        std::shared_lock<std::shared_timed_mutex> lock(s.mutex);
+        return s.index.find(key) != s.index.end();
+    }
+
+    void change_capacity(const int n)
+    {
+        if(n <= 0)
+        {
+            throw std::invalid_argument("cache capacity must be greater than zero");
+        }
+
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        capacity_ = n;
+        ghost_.set_capacity(main_capacity());
+        if(filter_)
+        {
+            filter_->change_capacity(n);
+        }
+        while(size() > capacity_) { evict(); }
+    }
+
+    std::shared_ptr<V> get(const K& key)
+    {
+        auto& s = shard_of(key);
+        std::shared_lock<std::shared_timed_mutex> lock(s.mutex);
+        auto it = s.index.find(key);
+        if(it != s.index.end())
+        {
+            // Racing hits may lose an increment, which is harmless.
+            page& p = *it->second;
+            const uint8_t frequency = p.frequency.load(std::memory_order_relaxed);
+            if(frequency < max_frequency)
+            {
+                p.frequency.store(frequency + 1, std::memory_order_relaxed);
+            }
+            s.num_cache_hits.fetch_add(1, std::memory_order_relaxed);
+            return p.data;
+        }
+        s.num_cache_misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    std::shared_ptr<V> operator[](const K& key)
+    {
+        return get(key);
+    }
+
+    template<typename ValueLoader>
+    std::shared_ptr<V> get_and_insert_if_missing(const K& key, ValueLoader value_loader)
+    {
+        std::shared_ptr<V> value = get(key);
+        if(value == nullptr)
+        {
+            value = std::make_shared<V>(value_loader(key));
+            insert(key, value);
+        }
+        return value;
+    }
+
+    void insert(K key, V value)
+    {
+        insert(key, std::make_shared<V>(std::move(value)));
+    }
+
+    void erase(const K& key)
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        auto& s = shard_of(key);
+        std::unique_lock<std::shared_timed_mutex> shard_lock(s.mutex);
+        auto it = s.index.find(key);
+        if(it != s.index.end())
+        {
+            page& p = *it->second;
+            p.erased = true;
+            --(p.in_main ? main_size_ : small_size_);
+            s.index.erase(it);
+        }
+    }
+
+private:
+
+    int small_capacity() const noexcept { return std::max(1, capacity_ / 10); }
+    int main_capacity() const noexcept { return std::max(1, capacity_ - small_capacity()); }
+
+    shard& shard_of(const K& key) noexcept
+    {
+        return shards_[hash_of(key) % shard_count];
+    }
+
+    static size_t hash_of(const K& key) noexcept
+    {
+        return std::hash<K>()(key);
+    }
+
+    void insert(const K& key, std::shared_ptr<V> data)
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        auto& s = shard_of(key);
+        {
+            std::unique_lock<std::shared_timed_mutex> shard_lock(s.mutex);
+            auto it = s.index.find(key);
+            if(it != s.index.end())
+            {
+                it->second->data = std::move(data);
+                return;
+            }
+        }
+
+        const size_t hash = hash_of(key);
+        const bool in_main = ghost_.contains(hash);
+        if(filter_)
+        {
+            filter_->record_access(key);
+            if(!in_main && size() >= capacity_ && !admit(key))
+            {
+                return;
+            }
+        }
+        if(in_main)
+        {
+            ghost_.erase(hash);
+        }
+
+        while(size() >= capacity_) { evict(); }
+
+        page* p = new page(key, std::move(data), in_main);
+        (in_main ? main_ : small_).push_back(p);
+        ++(in_main ? main_size_ : small_size_);
+
+        std::unique_lock<std::shared_timed_mutex> shard_lock(s.mutex);
+        s.index.emplace(key, p);
+    }
+
+    /** TinyLFU: is $key at least as popular as the small queue's next victim? */
+    bool admit(const K& key)
+    {
+        for(auto* p : small_)
+        {
+            if(!p->erased)
+            {
+                return filter_->frequency(key) >= filter_->frequency(p->key);
+            }
+        }
+        return true;
+    }
+
+    void evict()
+    {
+        if(small_size_ >= small_capacity() || main_size_ == 0)
+            evict_from_small();
+        else
+            evict_from_main();
+    }
+
+    /**
+     * Moves pages that were hit from the end of the small queue to the main queue until
+     * one that was not is found, and evicts that (remembering it in the ghost queue).
+     */
+    void evict_from_small()
+    {
+        while(!small_.empty())
+        {
+            page* p = small_.front();
+            small_.pop_front();
+            if(p->erased)
+            {
+                delete p;
+                continue;
+            }
+
+            const uint8_t frequency = p->frequency.load(std::memory_order_relaxed);
+            if(frequency > 0)
+            {
+                consume_hits(*p, frequency);
+                p->in_main = true;
+                main_.push_back(p);
+                --small_size_;
+                ++main_size_;
+                if(main_size_ > main_capacity()) { evict_from_main(); }
+            }
+            else
+            {
+                ghost_.insert(hash_of(p->key));
+                remove(p);
+                return;
+            }
+        }
+    }
+
+    /** CLOCK: pages at the end of the main queue that were hit go round again. */
+    void evict_from_main()
+    {
+        while(!main_.empty())
+        {
+            page* p = main_.front();
+            main_.pop_front();
+            if(p->erased)
+            {
+                delete p;
+                continue;
+            }
+
+            const uint8_t frequency = p->frequency.load(std::memory_order_relaxed);
+            if(frequency > 0)
+            {
+                consume_hits(*p, 1);
+                main_.push_back(p);
+            }
+            else
+            {
+                remove(p);
+                return;
+            }
+        }
+    }
+
+    /** Removes a page (no longer in any queue) from the index and frees it. */
+    void remove(page* p)
+    {
+        --(p->in_main ? main_size_ : small_size_);
+        auto& s = shard_of(p->key);
+        {
+            std::unique_lock<std::shared_timed_mutex> shard_lock(s.mutex);
+            s.index.erase(p->key);
+        }
+        delete p;
+    }
+
+    /** Takes $hits off a page's frequency, telling the sketch (which did not see them). */
+    void consume_hits(page& p, const uint8_t hits)
+    {
+        p.frequency.store(p.frequency.load(std::memory_order_relaxed) - hits,
+            std::memory_order_relaxed);
+        if(filter_)
+        {
+            for(int hit = 0; hit < hits; ++hit)
+            {
+                filter_->record_access(p.key);
+            }
+        }
+    }
+};
+
+template<typename K, typename V> constexpr int s3fifo_cache<K, V>::shard_count;
+template<typename K, typename V> constexpr uint8_t s3fifo_cache<K, V>::max_frequency;
+
+}
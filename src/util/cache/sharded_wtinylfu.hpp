@@ -0,0 +1,233 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "wtinylfu.hpp"
+#include "detail.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+/**
+ * A thread-safe wtinylfu_cache: the keys are split by hash between $shard_count
+ * wtinylfu_cache instances, each of a share of the capacity and behind its own mutex.
+ * (wtinylfu_cache updates its lists and frequency sketch on every hit, so even lookups
+ * lock their shard.) Each shard gets capacity / $shard_count (or one more), so the
+ * capacity must be at least $shard_count, and a single entry weighing more than
+ * capacity / $shard_count is never admitted (its shard could not hold it).
+ *
+ * The cache also keeps a generation number for each of $generation_count stripes of the
+ * key space, which insert() and erase() advance (after changing the value, under the
+ * shard's lock). A copy of a value taken together with the generation of its stripe read
+ * *before* the lookup (see generation()) is still the cache's value as long as the
+ * generation is unchanged. This is how front_cache keeps per-thread copies of hot values
+ * without serving stale ones. Evictions don't advance the generation, since they don't
+ * change what the value of a key is.
+ */
+
+namespace deepfabric
+{
+
+template<
+    typename K,
+    typename V,
+    typename Hash = detail::default_hash,
+    typename Compare = std::less<>,
+    typename Weigher = detail::unit_weigher
+> class sharded_wtinylfu_cache
+{
+public:
+
+    using key_type = K;
+    using mapped_type = V;
+    using hasher = Hash;
+    using key_compare = Compare;
+
+    static constexpr int shard_count = 64;
+    static constexpr int generation_count = 4096;
+
+private:
+
+    using cache_type = wtinylfu_cache<K, V, Hash, Compare, Weigher>;
+
+    /**
+     * A part of the cache with its own lock. Padded so that the locks of neighbouring
+     * shards are not on the same cache line.
+     */
+    struct shard
+    {
+        std::mutex mutex;
+        cache_type cache;
+        char padding[64];
+
+        shard(int capacity, int expected_weight) : cache(capacity, expected_weight) {}
+    };
+
+    std::vector<std::unique_ptr<shard>> shards_;
+
+    // Read on every front_cache hit and written only by insert() and erase(), so they are
+    // packed together rather than padded.
+    std::unique_ptr<std::atomic<uint32_t>[]> generations_;
+
+public:
+
+    explicit sharded_wtinylfu_cache(int capacity, int expected_weight = 1)
+        : generations_(new std::atomic<uint32_t>[generation_count])
+    {
+        if(capacity < shard_count)
+        {
+            throw std::invalid_argument("cache capacity must be at least shard_count");
+        }
+        for(int i = 0; i < shard_count; ++i)
+        {
+            shards_.emplace_back(new shard(shard_capacity(capacity, i), expected_weight));
+        }
+        for(int i = 0; i < generation_count; ++i)
+        {
+            generations_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    int size() const noexcept { return sum(&cache_type::size); }
+    int capacity() const noexcept { return sum(&cache_type::capacity); }
+
+    int num_cache_hits() const noexcept { return sum(&cache_type::num_cache_hits); }
+    int num_cache_misses() const noexcept { return sum(&cache_type::num_cache_misses); }
+
+    void change_capacity(const int n)
+    {
+        if(n < shard_count)
+        {
+            throw std::invalid_argument("cache capacity must be at least shard_count");
+        }
+        for(int i = 0; i < shard_count; ++i)
+        {
+            std::lock_guard<std::mutex> lock(shards_[i]->mutex);
+            shards_[i]->cache.change_capacity(shard_capacity(n, i));
+        }
+    }
+
+    /** The hash of $key, which the other functions can be given to save rehashing it. */
+    template<typename Key>
+    static uint32_t hash(const Key& key) noexcept { return Hash()(key); }
+
+    /** The current generation of the stripe of the key with $hash. */
+    uint32_t generation(const uint32_t hash) const noexcept
+    {
+        return generations_[stripe(hash)].load(std::memory_order_acquire);
+    }
+
+    template<typename Key>
+    bool contains(const Key& key) { return contains(key, hash(key)); }
+
+    template<typename Key>
+    bool contains(const Key& key, const uint32_t hash)
+    {
+        auto& s = shard_of(hash);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        return s.cache.contains(key);
+    }
+
+    template<typename Key>
+    std::shared_ptr<V> get(const Key& key) { return get(key, hash(key)); }
+
+    template<typename Key>
+    std::shared_ptr<V> get(const Key& key, const uint32_t hash)
+    {
+        auto& s = shard_of(hash);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        return s.cache.get(key);
+    }
+
+    void insert(K key, V value)
+    {
+        const uint32_t h = hash(key);
+        auto& s = shard_of(h);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.cache.insert(std::move(key), std::move(value));
+        advance_generation(h);
+    }
+
+    template<typename Key>
+    void erase(const Key& key)
+    {
+        const uint32_t h = hash(key);
+        auto& s = shard_of(h);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.cache.erase(key);
+        advance_generation(h);
+    }
+
+private:
+
+    /** Shard $i's share of $capacity (at least one, since $capacity >= $shard_count). */
+    static int shard_capacity(const int capacity, const int i) noexcept
+    {
+        return capacity / shard_count + (i < capacity % shard_count);
+    }
+
+    /**
+     * Remixes $hash (with MurmurHash3's fmix32) before picking a shard or stripe from it.
+     * A shard's frequency_sketch places keys by the low bits of the same hash, so taking
+     * the shard straight from them would crowd all of a shard's keys into a quarter of
+     * every counter block.
+     */
+    static uint32_t spread(uint32_t hash) noexcept
+    {
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6b;
+        hash ^= hash >> 13;
+        hash *= 0xc2b2ae35;
+        hash ^= hash >> 16;
+        return hash;
+    }
+
+    // The low bits pick the shard, so the stripes use the ones above them.
+    static int stripe(const uint32_t hash) noexcept
+    {
+        return (spread(hash) / shard_count) % generation_count;
+    }
+
+    shard& shard_of(const uint32_t hash) noexcept
+    {
+        return *shards_[spread(hash) % shard_count];
+    }
+
+    void advance_generation(const uint32_t hash) noexcept
+    {
+        generations_[stripe(hash)].fetch_add(1, std::memory_order_release);
+    }
+
+    template<typename F>
+    int sum(F f) const noexcept
+    {
+        int total = 0;
+        for(const auto& s : shards_)
+        {
+            std::lock_guard<std::mutex> lock(s->mutex);
+            total += (s->cache.*f)();
+        }
+        return total;
+    }
+};
+
+template<typename K, typename V, typename H, typename C, typename W>
+constexpr int sharded_wtinylfu_cache<K, V, H, C, W>::shard_count;
+template<typename K, typename V, typename H, typename C, typename W>
+constexpr int sharded_wtinylfu_cache<K, V, H, C, W>::generation_count;
+
+}
@@ -0,0 +1,607 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "frequency_sketch.hpp"
+#include "detail.hpp"
+#include "../offset_ptr.hpp"
+
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Window-TinyLFU cache (see wtinylfu.hpp) kept entirely in a POSIX shared memory segment
+ * so that several processes on a host share one cache instead of each keeping a copy of
+ * the same hot entries.
+ *
+ * Everything lives in the segment: the pages (a fixed array of $capacity nodes), the
+ * hash index (buckets of node indices, chained through the nodes), the window,
+ * probationary and eden LRU lists (doubly linked through node indices), and the
+ * frequency sketch (whose counter table is reached through an offset_ptr). Nothing in
+ * the segment holds a native pointer, so each process can map it at any address.
+ *
+ * All operations take one process-shared, robust mutex. If a process dies while holding
+ * it the next process to lock it finds the lists in an unknown state, so it empties the
+ * cache (keeping the frequency sketch, which cannot be left inconsistent) and carries on.
+ *
+ * K and V must be trivially copyable (they are copied into and out of the segment, never
+ * referenced), and every process must use the same K, V and capacity, which is checked
+ * when attaching. get() copies the value out rather than returning a shared_ptr.
+ *
+ * The first process to open a name creates and initialises the segment; the others wait
+ * for it to be ready and attach. The segment outlives the processes until unlink() is
+ * called.
+ */
+
+namespace deepfabric
+{
+namespace detail
+{
+    /**
+     * A fixed-capacity table of uint64_t, stored elsewhere in the same shared memory
+     * segment, for frequency_sketch.
+     */
+    class offset_table
+    {
+        offset_ptr<uint64_t> data_;
+        uint32_t size_;
+        uint32_t capacity_;
+
+    public:
+
+        offset_table(uint64_t* data, uint32_t capacity)
+            : data_(data)
+            , size_(0)
+            , capacity_(capacity)
+        {}
+
+        size_t size() const noexcept { return size_; }
+
+        /** Like std::vector::resize, except that it cannot grow beyond the capacity. */
+        void resize(size_t n)
+        {
+            if(n > capacity_)
+            {
+                throw std::length_error("offset_table cannot grow beyond its capacity");
+            }
+            if(n > size_)
+            {
+                std::memset(data_.get() + size_, 0, (n - size_) * sizeof(uint64_t));
+            }
+            size_ = n;
+        }
+
+        uint64_t& operator[](size_t i) noexcept { return data_[i]; }
+        const uint64_t& operator[](size_t i) const noexcept { return data_[i]; }
+
+        uint64_t* begin() noexcept { return data_.get(); }
+        uint64_t* end() noexcept { return data_.get() + size_; }
+    };
+} // namespace detail
+
+template<
+    typename K,
+    typename V
+> class shm_wtinylfu_cache
+{
+    static_assert(std::is_trivially_copyable<K>::value, "keys are copied into shared memory");
+    static_assert(std::is_trivially_copyable<V>::value, "values are copied into shared memory");
+
+    static constexpr uint64_t magic = 0x554652544e494d53ULL; // "SMINTRFU"
+    static constexpr uint32_t nil = ~uint32_t(0);
+
+    enum cache_slot : uint8_t
+    {
+        window,
+        probationary,
+        eden,
+        unused
+    };
+
+    struct node
+    {
+        K key;
+        V value;
+        uint32_t prev; // towards the MRU end of its list
+        uint32_t next; // towards the LRU end of its list (or the next free node)
+        uint32_t chain; // the next node in the same hash bucket
+        uint8_t cache_slot;
+    };
+
+    struct lru_list
+    {
+        uint32_t head; // the MRU node
+        uint32_t tail; // the LRU node
+        int size;
+        int capacity;
+
+        bool is_full() const noexcept { return size >= capacity; }
+    };
+
+    using sketch = frequency_sketch<K, detail::offset_table>;
+
+    struct header
+    {
+        std::atomic<uint64_t> ready; // $magic once the creator has initialised everything
+        uint64_t bytes;
+        uint32_t key_size;
+        uint32_t value_size;
+        int capacity;
+        uint32_t bucket_mask;
+        pthread_mutex_t mutex;
+        lru_list window;
+        lru_list probationary;
+        lru_list eden;
+        uint32_t free_list;
+        int64_t num_cache_hits;
+        int64_t num_cache_misses;
+        sketch filter;
+
+        header(int capacity_, uint32_t buckets, uint64_t* table, uint32_t table_size,
+            uint64_t bytes_)
+            : ready(0)
+            , bytes(bytes_)
+            , key_size(sizeof(K))
+            , value_size(sizeof(V))
+            , capacity(capacity_)
+            , bucket_mask(buckets - 1)
+            , filter(capacity_, detail::offset_table(table, table_size))
+        {}
+    };
+
+    /** Holds the segment's mutex for its lifetime, recovering it if its owner died. */
+    class scoped_lock
+    {
+        shm_wtinylfu_cache& cache_;
+
+    public:
+
+        explicit scoped_lock(shm_wtinylfu_cache& cache) : cache_(cache)
+        {
+            const int rc = pthread_mutex_lock(&cache_.header_->mutex);
+            if(rc == EOWNERDEAD)
+            {
+                cache_.clear_pages();
+                pthread_mutex_consistent(&cache_.header_->mutex);
+            }
+            else if(rc != 0)
+            {
+                throw std::system_error(rc, std::generic_category(), "pthread_mutex_lock");
+            }
+        }
+
+        ~scoped_lock()
+        {
+            pthread_mutex_unlock(&cache_.header_->mutex);
+        }
+    };
+
+    int fd_ = -1;
+    size_t bytes_ = 0;
+    header* header_ = nullptr;
+    node* nodes_ = nullptr;
+    uint32_t* buckets_ = nullptr;
+
+public:
+
+    /**
+     * Creates the segment called $name (as for shm_open, e.g. "/my_cache") holding
+     * $capacity entries, or attaches to it if another process already has.
+     */
+    shm_wtinylfu_cache(const std::string& name, const int capacity)
+    {
+        if(capacity <= 0)
+        {
+            throw std::invalid_argument("cache capacity must be greater than zero");
+        }
+
+        const uint32_t buckets = detail::nearest_power_of_two(2 * capacity);
+        const uint32_t table_size = detail::nearest_power_of_two(capacity);
+        bytes_ = nodes_offset() + capacity * sizeof(node) + buckets * sizeof(uint32_t);
+        bytes_ = (bytes_ + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+        const size_t table_offset = bytes_;
+        bytes_ += table_size * sizeof(uint64_t);
+
+        bool creator = true;
+        fd_ = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if(fd_ < 0 && errno == EEXIST)
+        {
+            creator = false;
+            fd_ = shm_open(name.c_str(), O_RDWR, 0600);
+        }
+        if(fd_ < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "shm_open " + name);
+        }
+
+        try
+        {
+            if(creator && ftruncate(fd_, bytes_) != 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "ftruncate " + name);
+            }
+            else if(!creator)
+            {
+                wait_for_size(name);
+            }
+
+            void* at = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+            if(at == MAP_FAILED)
+            {
+                throw std::system_error(errno, std::generic_category(), "mmap " + name);
+            }
+            header_ = static_cast<header*>(at);
+            nodes_ = reinterpret_cast<node*>(static_cast<char*>(at) + nodes_offset());
+            buckets_ = reinterpret_cast<uint32_t*>(nodes_ + capacity);
+
+            if(creator)
+            {
+                initialize(capacity, buckets,
+                    reinterpret_cast<uint64_t*>(static_cast<char*>(at) + table_offset),
+                    table_size);
+            }
+            else
+            {
+                attach(name, capacity);
+            }
+        }
+        catch(...)
+        {
+            if(header_ != nullptr) { munmap(header_, bytes_); }
+            close(fd_);
+            throw;
+        }
+    }
+
+    ~shm_wtinylfu_cache()
+    {
+        munmap(header_, bytes_);
+        close(fd_);
+    }
+
+    shm_wtinylfu_cache(const shm_wtinylfu_cache&) = delete;
+    shm_wtinylfu_cache& operator=(const shm_wtinylfu_cache&) = delete;
+
+    /** Removes the name; the segment goes away when the last process unmaps it. */
+    static void unlink(const std::string& name) noexcept
+    {
+        shm_unlink(name.c_str());
+    }
+
+    int size() noexcept
+    {
+        scoped_lock lock(*this);
+        return header_->window.size + header_->probationary.size + header_->eden.size;
+    }
+
+    int capacity() const noexcept { return header_->capacity; }
+
+    /** These count the hits and misses of every process sharing the cache. */
+    int64_t num_cache_hits() const noexcept { return header_->num_cache_hits; }
+    int64_t num_cache_misses() const noexcept { return header_->num_cache_misses; }
+
+    bool contains(const K& key)
+    {
+        scoped_lock lock(*this);
+        return find(key) != nil;
+    }
+
+    /** Copies the value of $key into $value and returns true, or returns false. */
+    bool get(const K& key, V& value)
+    {
+        scoped_lock lock(*this);
+        header_->filter.record_access(key);
+        const uint32_t page = find(key);
+        if(page != nil)
+        {
+            handle_hit(page);
+            value = nodes_[page].value;
+            return true;
+        }
+        ++header_->num_cache_misses;
+        return false;
+    }
+
+    /**
+     * $value_loader is called without the lock held, so two processes missing on the
+     * same key at once may both load it (the second insert just overwrites the first).
+     */
+    template<typename ValueLoader>
+    V get_and_insert_if_missing(const K& key, ValueLoader value_loader)
+    {
+        V value;
+        if(!get(key, value))
+        {
+            value = value_loader(key);
+            insert(key, value);
+        }
+        return value;
+    }
+
+    void insert(const K& key, const V& value)
+    {
+        scoped_lock lock(*this);
+        const uint32_t existing = find(key);
+        if(existing != nil)
+        {
+            nodes_[existing].value = value;
+            return;
+        }
+
+        if(header_->window.is_full()) { evict(); }
+
+        const uint32_t page = header_->free_list;
+        assert(page != nil);
+        header_->free_list = nodes_[page].next;
+        nodes_[page].key = key;
+        nodes_[page].value = value;
+        nodes_[page].cache_slot = window;
+        push_front(header_->window, page);
+        index_insert(page);
+    }
+
+    void erase(const K& key)
+    {
+        scoped_lock lock(*this);
+        const uint32_t page = find(key);
+        if(page != nil)
+        {
+            remove(page);
+        }
+    }
+
+private:
+
+    static constexpr size_t nodes_offset() noexcept
+    {
+        return (sizeof(header) + 63) & ~size_t(63);
+    }
+
+    static int window_capacity(const int total_capacity) noexcept
+    {
+        return std::max(1, int(std::ceil(0.01f * total_capacity)));
+    }
+
+    void initialize(const int capacity, const uint32_t buckets, uint64_t* table,
+        const uint32_t table_size)
+    {
+        new(header_) header(capacity, buckets, table, table_size, bytes_);
+
+        pthread_mutexattr_t attributes;
+        pthread_mutexattr_init(&attributes);
+        pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&header_->mutex, &attributes);
+        pthread_mutexattr_destroy(&attributes);
+
+        const int main_capacity = capacity - window_capacity(capacity);
+        header_->window.capacity = window_capacity(capacity);
+        header_->eden.capacity = int(0.8f * main_capacity);
+        header_->probationary.capacity = main_capacity - header_->eden.capacity;
+        clear_pages();
+
+        header_->ready.store(magic, std::memory_order_release);
+    }
+
+    /** Waits (up to about 5 seconds) for the creator to size the segment. */
+    void wait_for_size(const std::string& name)
+    {
+        struct stat status;
+        for(int attempt = 0; attempt < 5000; ++attempt)
+        {
+            if(fstat(fd_, &status) != 0)
+            {
+                throw std::system_error(errno, std::generic_category(), "fstat " + name);
+            }
+            if(status.st_size != 0) { break; }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if(size_t(status.st_size) != bytes_)
+        {
+            throw std::runtime_error(name + " is not a cache of this capacity and type");
+        }
+    }
+
+    /** Waits for the creator to finish and checks that it made the same kind of cache. */
+    void attach(const std::string& name, const int capacity)
+    {
+        for(int attempt = 0; header_->ready.load(std::memory_order_acquire) != magic;
+            ++attempt)
+        {
+            if(attempt == 5000)
+            {
+                throw std::runtime_error(name + " was never initialised");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        if(header_->bytes != bytes_ || header_->key_size != sizeof(K)
+            || header_->value_size != sizeof(V) || header_->capacity != capacity)
+        {
+            throw std::runtime_error(name + " is not a cache of this capacity and type");
+        }
+    }
+
+    /** Empties the lists and the index and puts every node on the free list. */
+    void clear_pages() noexcept
+    {
+        for(auto* list : { &header_->window, &header_->probationary, &header_->eden })
+        {
+            list->head = list->tail = nil;
+            list->size = 0;
+        }
+        for(uint32_t bucket = 0; bucket <= header_->bucket_mask; ++bucket)
+        {
+            buckets_[bucket] = nil;
+        }
+        for(int page = 0; page < header_->capacity; ++page)
+        {
+            nodes_[page].cache_slot = unused;
+            nodes_[page].next = page + 1 < header_->capacity ? page + 1 : nil;
+        }
+        header_->free_list = 0;
+    }
+
+    lru_list& list_of(const uint32_t page) noexcept
+    {
+        switch(nodes_[page].cache_slot)
+        {
+        case window: return header_->window;
+        case probationary: return header_->probationary;
+        default: return header_->eden;
+        }
+    }
+
+    uint32_t& bucket_of(const K& key) noexcept
+    {
+        return buckets_[detail::hash(key) & header_->bucket_mask];
+    }
+
+    uint32_t find(const K& key) noexcept
+    {
+        uint32_t page = bucket_of(key);
+        while(page != nil && !(nodes_[page].key == key))
+        {
+            page = nodes_[page].chain;
+        }
+        return page;
+    }
+
+    void index_insert(const uint32_t page) noexcept
+    {
+        uint32_t& bucket = bucket_of(nodes_[page].key);
+        nodes_[page].chain = bucket;
+        bucket = page;
+    }
+
+    void index_erase(const uint32_t page) noexcept
+    {
+        uint32_t* link = &bucket_of(nodes_[page].key);
+        while(*link != page)
+        {
+            link = &nodes_[*link].chain;
+        }
+        *link = nodes_[page].chain;
+    }
+
+    void unlink_page(lru_list& list, const uint32_t page) noexcept
+    {
+        node& n = nodes_[page];
+        if(n.prev != nil) { nodes_[n.prev].next = n.next; } else { list.head = n.next; }
+        if(n.next != nil) { nodes_[n.next].prev = n.prev; } else { list.tail = n.prev; }
+        --list.size;
+    }
+
+    /** Inserts page at the MRU position of $list. */
+    void push_front(lru_list& list, const uint32_t page) noexcept
+    {
+        node& n = nodes_[page];
+        n.prev = nil;
+        n.next = list.head;
+        if(list.head != nil) { nodes_[list.head].prev = page; } else { list.tail = page; }
+        list.head = page;
+        ++list.size;
+    }
+
+    /** Moves page to the MRU position of $to (which may be the list it is already in). */
+    void transfer(const uint32_t page, lru_list& to, const cache_slot slot) noexcept
+    {
+        unlink_page(list_of(page), page);
+        nodes_[page].cache_slot = slot;
+        push_front(to, page);
+    }
+
+    void remove(const uint32_t page) noexcept
+    {
+        unlink_page(list_of(page), page);
+        index_erase(page);
+        nodes_[page].cache_slot = unused;
+        nodes_[page].next = header_->free_list;
+        header_->free_list = page;
+    }
+
+    /** As slru::handle_hit and lru::handle_hit in wtinylfu.hpp. */
+    void handle_hit(const uint32_t page) noexcept
+    {
+        switch(nodes_[page].cache_slot)
+        {
+        case window:
+            transfer(page, header_->window, window);
+            break;
+        case probationary:
+            transfer(page, header_->eden, eden);
+            if(header_->eden.is_full())
+            {
+                transfer(header_->eden.tail, header_->probationary, probationary);
+            }
+            break;
+        default:
+            transfer(page, header_->eden, eden);
+            break;
+        }
+        ++header_->num_cache_hits;
+    }
+
+    /** The main cache's eviction candidate (eden's LRU page if probation is empty). */
+    uint32_t main_victim() const noexcept
+    {
+        return header_->probationary.tail != nil
+            ? header_->probationary.tail : header_->eden.tail;
+    }
+
+    /** As wtinylfu_cache::evict(). */
+    void evict() noexcept
+    {
+        const int size = header_->window.size + header_->probationary.size
+            + header_->eden.size;
+        if(size < header_->capacity)
+        {
+            transfer(header_->window.tail, header_->probationary, probationary);
+            return;
+        }
+
+        const uint32_t window_victim = header_->window.tail;
+        const uint32_t victim = main_victim();
+        if(victim != nil && header_->filter.frequency(nodes_[window_victim].key)
+            > header_->filter.frequency(nodes_[victim].key))
+        {
+            remove(victim);
+            transfer(window_victim, header_->probationary, probationary);
+        }
+        else
+        {
+            remove(window_victim);
+        }
+    }
+};
+
+template<typename K, typename V> constexpr uint64_t shm_wtinylfu_cache<K, V>::magic;
+template<typename K, typename V> constexpr uint32_t shm_wtinylfu_cache<K, V>::nil;
+
+} // namespace deepfabric
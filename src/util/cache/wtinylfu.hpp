@@ -21,11 +21,15 @@
 #pragma once
 
 #include "frequency_sketch.hpp"
+#include "mrc_estimator.hpp"
 #include "detail.hpp"
 
-#include <map>
+#include <algorithm>
+#include <iterator>
+#include <set>
 #include <list>
 #include <memory>
+#include <chrono>
 #include <cmath>
 #include <cassert>
 
@@ -58,8 +62,30 @@
  * Values are stored in shared_ptr<V> instances in order to ensure memory safety when
  * a cache entry is evicted while it is still being used by user.
  *
- * It is advised that trivially copiable, small keys be used as there persist two
- * copies of each within the cache.
+ * Each key is stored once, in its page; the page map is a set of page positions ordered
+ * by their keys. $Hash (for the frequency sketch) and $Compare (for the page map) are
+ * transparent by default, so get(), contains() and erase() accept anything they accept
+ * alongside a K without constructing a K, e.g. a boost::string_ref for std::string keys.
+ * A user-provided pair must agree: equal keys must hash equally whatever their type.
+ *
+ * Capacity is in units of weight, and $Weigher gives the weight of each value (a
+ * positive int). By default every value weighs 1, so the capacity is the number of
+ * entries; with e.g. the size in bytes as the weight it is a memory budget (see
+ * compressed_wtinylfu.hpp). The window, eden and probationary segments are then shares
+ * of the total weight rather than of the number of entries, and an entry heavier than
+ * the main cache's victim has to beat the frequency of every victim it displaces (and
+ * displaces none if it does not; one heavier than the main cache is never admitted). The
+ * frequency sketch is sized for capacity / $expected_weight entries.
+ *
+ * Entries also have a cost, that of recomputing the value (in any unit, 1 by default),
+ * given to insert() or returned by the loader passed to get_and_insert_if_missing() as a
+ * costed_value (timed_loader() measures it in microseconds). Costs are only compared
+ * with each other, so a cache's costs must all be in the same unit. Admission to the
+ * main cache compares frequency * cost / weight (as in GDSF) rather than frequency
+ * alone, so an entry that is expensive to recompute, or small, can displace more
+ * popular ones that are cheap, or big. This is only the comparison between the window
+ * victim and main victim, so every operation stays O(1); with the default costs and
+ * weights it is the plain TinyLFU comparison.
  *
  * NOTE: it is NOT thread-safe!
  */
@@ -67,9 +93,43 @@
 namespace deepfabric
 {
 
+/**
+ * A loaded value and its cost, which a loader passed to
+ * wtinylfu_cache::get_and_insert_if_missing can return to supply the cost (which is
+ * otherwise 1).
+ */
+template<typename V>
+struct costed_value
+{
+    V value;
+    float cost;
+};
+
+/**
+ * Wraps $value_loader so that it returns a costed_value whose cost is the time it took
+ * in microseconds, e.g. cache.get_and_insert_if_missing(key, timed_loader(load)). If a
+ * cache's entries are costed this way, costs given to its insert() should be in
+ * microseconds too.
+ */
+template<typename ValueLoader>
+auto timed_loader(ValueLoader value_loader)
+{
+    return [value_loader](const auto& key) mutable
+    {
+        const auto start = std::chrono::steady_clock::now();
+        auto value = value_loader(key);
+        const float elapsed = std::chrono::duration<float, std::micro>(
+            std::chrono::steady_clock::now() - start).count();
+        return costed_value<decltype(value)>{ std::move(value), elapsed };
+    };
+}
+
 template<
     typename K,
-    typename V
+    typename V,
+    typename Hash = detail::default_hash,
+    typename Compare = std::less<>,
+    typename Weigher = detail::unit_weigher
 > class wtinylfu_cache
 {
     enum class cache_slot
@@ -83,11 +143,16 @@ template<
     {
         K key;
         enum cache_slot cache_slot;
+        int weight;
+        float cost;
         std::shared_ptr<V> data;
 
-        page(K key_, enum cache_slot cache_slot_, std::shared_ptr<V> data_)
+        page(K key_, enum cache_slot cache_slot_, int weight_, float cost_,
+            std::shared_ptr<V> data_)
             : key(std::move(key_))
             , cache_slot(cache_slot_)
+            , weight(weight_)
+            , cost(cost_)
             , data(data_)
         {}
     };
@@ -96,6 +161,7 @@ template<
     {
         std::list<page> lru_;
         int capacity_;
+        int weight_ = 0;
 
     public:
 
@@ -104,9 +170,12 @@ template<
 
         explicit lru(int capacity) : capacity_(capacity) {}
 
+        /** The number of pages. */
         int size() const noexcept { return lru_.size(); }
+        /** The total weight of the pages, which is what the capacity limits. */
+        int weight() const noexcept { return weight_; }
         int capacity() const noexcept { return capacity_; }
-        bool is_full() const noexcept { return size() >= capacity(); }
+        bool is_full() const noexcept { return weight() >= capacity(); }
 
         /**
          * NOTE: doesn't actually remove any pages, it only sets the capacity.
@@ -125,6 +194,20 @@ template<
         page_position lru_pos() noexcept { return --lru_.end(); }
         const_page_position lru_pos() const noexcept { return --lru_.end(); }
 
+        /**
+         * Calls $f with each page from the coldest on until it returns false, returning
+         * false if it did.
+         */
+        template<typename F>
+        bool visit_from_coldest(F f) const
+        {
+            for(auto it = lru_.rbegin(); it != lru_.rend(); ++it)
+            {
+                if(!f(*it)) { return false; }
+            }
+            return true;
+        }
+
         const K& victim_key() const noexcept
         {
             return lru_pos()->key;
@@ -135,8 +218,27 @@ template<
             erase(lru_pos());
         }
 
+        /**
+         * Evicts the fewest coldest pages weighing at least $w in one go, calling
+         * $on_evict with the key of each first (so it can be removed from the page map).
+         */
+        template<typename OnEvict>
+        void evict(int w, OnEvict on_evict)
+        {
+            auto first = lru_.end();
+            while(w > 0 && first != lru_.begin())
+            {
+                --first;
+                w -= first->weight;
+                weight_ -= first->weight;
+                on_evict(first->key);
+            }
+            lru_.erase(first, lru_.end());
+        }
+
         void erase(page_position page)
         {
+            weight_ -= page->weight;
             lru_.erase(page);
         }
 
@@ -144,7 +246,16 @@ template<
         template<typename... Args>
         page_position insert(Args&&... args)
         {
-            return lru_.emplace(mru_pos(), std::forward<Args>(args)...);
+            auto page = lru_.emplace(mru_pos(), std::forward<Args>(args)...);
+            weight_ += page->weight;
+            return page;
+        }
+
+        /** Changes the weight of a page in this cache. */
+        void reweigh(page_position page, const int weight) noexcept
+        {
+            weight_ += weight - page->weight;
+            page->weight = weight;
         }
 
         /** Moves page to the MRU position. */
@@ -156,6 +267,8 @@ template<
         /** Moves page from $source to the MRU position of this cache. */
         void transfer_page_from(page_position page, lru& source)
         {
+            source.weight_ -= page->weight;
+            weight_ += page->weight;
             lru_.splice(mru_pos(), source.lru_, page);
         }
     };
@@ -209,6 +322,11 @@ template<
             return eden_.size() + probationary_.size();
         }
 
+        const int weight() const noexcept
+        {
+            return eden_.weight() + probationary_.weight();
+        }
+
         const int capacity() const noexcept
         {
             return eden_.capacity() + probationary_.capacity();
@@ -216,7 +334,7 @@ template<
 
         const bool is_full() const noexcept
         {
-            return size() >= capacity();
+            return weight() >= capacity();
         }
 
         void set_capacity(const int n)
@@ -225,14 +343,35 @@ template<
             probationary_.set_capacity(n - eden_.capacity());
         }
 
+        /**
+         * After set_capacity() has shrunk the cache: demotes eden's excess to the
+         * probationary segment, then evicts the excess from its cold end in one batch.
+         */
+        template<typename OnEvict>
+        void shrink_to_capacity(OnEvict on_evict)
+        {
+            while(eden_.weight() > eden_.capacity())
+            {
+                demote_to_probationary(eden_.lru_pos());
+            }
+            if(weight() > capacity())
+            {
+                probationary_.evict(weight() - capacity(), on_evict);
+            }
+        }
+
+        /**
+         * The LRU page of the probationary segment, or of eden if probation is empty
+         * (which happens when every page has been hit since it was admitted).
+         */
         page_position victim_pos() noexcept
         {
-            return probationary_.lru_pos();
+            return probationary_.size() > 0 ? probationary_.lru_pos() : eden_.lru_pos();
         }
 
         const_page_position victim_pos() const noexcept
         {
-            return probationary_.lru_pos();
+            return probationary_.size() > 0 ? probationary_.lru_pos() : eden_.lru_pos();
         }
 
         const K& victim_key() const noexcept
@@ -240,9 +379,19 @@ template<
             return victim_pos()->key;
         }
 
+        /**
+         * Calls $f with each page in the order evict() would evict them until it returns
+         * false.
+         */
+        template<typename F>
+        void visit_victims(F f) const
+        {
+            probationary_.visit_from_coldest(f) && eden_.visit_from_coldest(f);
+        }
+
         void evict()
         {
-            probationary_.evict();
+            erase(victim_pos());
         }
 
         void erase(page_position page)
@@ -253,6 +402,14 @@ template<
                 probationary_.erase(page);
         }
 
+        void reweigh(page_position page, const int weight) noexcept
+        {
+            if(page->cache_slot == cache_slot::eden)
+                eden_.reweigh(page, weight);
+            else
+                probationary_.reweigh(page, weight);
+        }
+
         /** Moves page to the MRU position of the probationary segment. */
         void transfer_page_from(page_position page, lru& source)
         {
@@ -274,7 +431,10 @@ template<
             if(page->cache_slot == cache_slot::probationary)
             {
                 promote_to_eden(page);
-                if(eden_.is_full()) { demote_to_probationary(eden_.lru_pos()); }
+                while(eden_.size() > 0 && eden_.is_full())
+                {
+                    demote_to_probationary(eden_.lru_pos());
+                }
             }
             else
             {
@@ -298,10 +458,37 @@ template<
         }
     };
 
-    frequency_sketch<K> filter_;
+    using page_position = typename lru::page_position;
+
+    /** Orders page positions by their pages' keys, and finds them by key. */
+    struct page_compare
+    {
+        using is_transparent = void;
+
+        Compare compare;
+
+        bool operator()(const page_position& a, const page_position& b) const
+        {
+            return compare(a->key, b->key);
+        }
+
+        template<typename U>
+        bool operator()(const page_position& a, const U& b) const
+        {
+            return compare(a->key, b);
+        }
+
+        template<typename U>
+        bool operator()(const U& a, const page_position& b) const
+        {
+            return compare(a, b->key);
+        }
+    };
+
+    frequency_sketch<K, std::vector<uint64_t>, Hash> filter_;
 
-    // Maps keys to page positions of the LRU caches pointing to a page.
-    std::map<K, typename lru::page_position> page_map_;
+    // The page positions of the LRU caches, by key (which lives in the page).
+    std::set<page_position, page_compare> page_map_;
 
     // Allocated 1% of the total capacity. Window victims are granted the chance to
     // reenter the cache (into $main_). This is to remediate the problem where sparse
@@ -311,23 +498,38 @@ template<
     // Allocated 99% of the total capacity.
     slru main_;
 
+    // The frequency sketch is sized for the capacity divided by this.
+    int expected_weight_;
+
     // Statistics.
     int num_cache_hits_ = 0;
     int num_cache_misses_ = 0;
 
+    // Estimates the miss ratio at other capacities, if enabled.
+    std::unique_ptr<mrc_estimator<K, Hash, Compare>> mrc_;
+
 public:
 
-    explicit wtinylfu_cache(int capacity)
-        : filter_(capacity)
+    /** $expected_weight is the typical weight of a value (see the class comment). */
+    explicit wtinylfu_cache(int capacity, int expected_weight = 1)
+        : filter_(std::max(1, capacity / expected_weight))
         , window_(window_capacity(capacity))
         , main_(capacity - window_.capacity())
+        , expected_weight_(expected_weight)
     {}
 
+    /** The number of entries. */
     int size() const noexcept
     {
         return window_.size() + main_.size();
     }
 
+    /** The total weight of the entries (the same as size() with the default Weigher). */
+    int weight() const noexcept
+    {
+        return window_.weight() + main_.weight();
+    }
+
     int capacity() const noexcept
     {
         return window_.capacity() + main_.capacity();
@@ -336,14 +538,31 @@ public:
     int num_cache_hits() const noexcept { return num_cache_hits_; }
     int num_cache_misses() const noexcept { return num_cache_misses_; }
 
-    bool contains(const K& key) const noexcept
+    /**
+     * Starts estimating the miss ratio curve of the keys passed to get() (see
+     * mrc_estimator), e.g. to pick the argument of change_capacity().
+     */
+    void enable_miss_ratio_curve(const int max_capacity, const int points = 64,
+        const int max_samples = 8192, const double initial_rate = 0.01)
+    {
+        mrc_.reset(new mrc_estimator<K, Hash, Compare>(max_capacity, points, max_samples,
+            initial_rate));
+    }
+
+    /** The miss ratio curve estimator, or nullptr if it is not enabled. */
+    const mrc_estimator<K, Hash, Compare>* miss_ratio_curve() const noexcept { return mrc_.get(); }
+
+    template<typename Key>
+    bool contains(const Key& key) const noexcept
     {
         return page_map_.find(key) != page_map_.cend();
     }
 
     /**
-     * NOTE: after this operation the accuracy of the cache will suffer until enough
-     * historic data is gathered (because the frequency sketch is cleared).
+     * The frequency sketch keeps its history (see frequency_sketch::change_capacity) and
+     * when shrinking, the window's excess pages move to the main cache and the main
+     * cache's excess is evicted from its cold end in one batch, so this is cheap enough
+     * to call often (e.g. from an autoscaler).
      */
     void change_capacity(const int n)
     {
@@ -352,61 +571,76 @@ public:
             throw std::invalid_argument("cache capacity must be greater than zero");
         }
 
-        filter_.change_capacity(n);
+        filter_.change_capacity(std::max(1, n / expected_weight_));
         window_.set_capacity(window_capacity(n));
         main_.set_capacity(n - window_.capacity());
 
-        while(window_.is_full()) { evict_from_window(); }
-        while(main_.is_full()) { evict_from_main(); }
+        while(window_.weight() > window_.capacity())
+        {
+            main_.transfer_page_from(window_.lru_pos(), window_);
+        }
+        main_.shrink_to_capacity([this](const K& key)
+            { page_map_.erase(page_map_.find(key)); });
     }
 
-    std::shared_ptr<V> get(const K& key)
+    template<typename Key>
+    std::shared_ptr<V> get(const Key& key)
     {
         filter_.record_access(key);
+        if(mrc_) { mrc_->record_access(key); }
         auto it = page_map_.find(key);
         if(it != page_map_.end())
         {
-            auto& page = it->second;
-            handle_hit(page);
-            return page->data;
+            handle_hit(*it);
+            return (*it)->data;
         }
         ++num_cache_misses_;
         return nullptr;
     }
 
-    std::shared_ptr<V> operator[](const K& key)
+    template<typename Key>
+    std::shared_ptr<V> operator[](const Key& key)
     {
         return get(key);
     }
 
-    template<typename ValueLoader>
-    std::shared_ptr<V> get_and_insert_if_missing(const K& key, ValueLoader value_loader)
+    /**
+     * A K is only constructed from $key on a miss. The entry's cost is 1 unless
+     * $value_loader returns a costed_value (see timed_loader()).
+     */
+    template<typename Key, typename ValueLoader>
+    std::shared_ptr<V> get_and_insert_if_missing(const Key& key, ValueLoader value_loader)
     {
         std::shared_ptr<V> value = get(key);
         if(value == nullptr)
         {
-            value = std::make_shared<V>(value_loader(key));
-            insert(key, value);
+            auto loaded = value_loader(key);
+            const float cost = cost_of(loaded);
+            value = std::make_shared<V>(value_of(std::move(loaded)));
+            insert(K(key), value, cost);
         }
         return value;
     }
 
-    void insert(K key, V value)
+    /** $cost is that of recomputing $value (see the class comment). */
+    void insert(K key, V value, const float cost = 1)
     {
-        insert(std::move(key), std::make_shared<V>(std::move(value)));
+        insert(std::move(key), std::make_shared<V>(std::move(value)), cost);
     }
 
-    void erase(const K& key)
+    template<typename Key>
+    void erase(const Key& key)
     {
         auto it = page_map_.find(key);
         if(it != page_map_.end())
         {
-            auto& page = it->second;
+            // Unlink the page from the map before freeing the key it is ordered by.
+            const page_position page = *it;
+            page_map_.erase(it);
             if(page->cache_slot == cache_slot::window)
                 window_.erase(page);
             else
                 main_.erase(page);
-            page_map_.erase(it);
         }
     }
 
@@ -417,18 +651,42 @@ private:
         return std::max(1, int(std::ceil(0.01f * total_capacity)));
     }
 
-    void insert(const K& key, std::shared_ptr<V> data)
+    template<typename T>
+    static float cost_of(const T&) noexcept { return 1; }
+    static float cost_of(const costed_value<V>& loaded) noexcept
     {
-        if(window_.is_full()) { evict(); }
+        return loaded.cost;
+    }
 
+    template<typename T>
+    static T&& value_of(T&& loaded) noexcept { return std::forward<T>(loaded); }
+    static V&& value_of(costed_value<V>&& loaded) noexcept { return std::move(loaded.value); }
+
+    void insert(K key, std::shared_ptr<V> data, const float cost)
+    {
+        const int weight = std::max(1, int(Weigher()(*data)));
         auto it = page_map_.find(key);
         if(it != page_map_.end())
-            it->second->data = data;
+        {
+            const page_position page = *it;
+            page->data = data;
+            page->cost = cost;
+            if(page->cache_slot == cache_slot::window)
+                window_.reweigh(page, weight);
+            else
+                main_.reweigh(page, weight);
+            // A page that got heavier in the main cache makes room like a window victim.
+            while(main_.weight() > main_.capacity()) { evict_from_main(); }
+        }
         else
-            page_map_.emplace(key, window_.insert(key, cache_slot::window, data));
+        {
+            page_map_.insert(window_.insert(std::move(key), cache_slot::window, weight, cost,
+                data));
+        }
+        while(window_.weight() > window_.capacity()) { evict(); }
     }
 
-    void handle_hit(typename lru::page_position page)
+    void handle_hit(page_position page)
     {
         if(page->cache_slot == cache_slot::window)
             window_.handle_hit(page);
@@ -437,46 +695,66 @@ private:
         ++num_cache_hits_;
     }
 
+    /** The value of keeping $page: its (estimated) frequency * cost / weight. */
+    float score(const page& page) const noexcept
+    {
+        return filter_.frequency(page.key) * page.cost / page.weight;
+    }
+
     /**
      * Evicts from the window cache to the main cache's probationary space.
-     * Called when the window cache is full.
-     * If the cache's total size exceeds its capacity, the window cache's victim and
-     * the main cache's eviction candidate are evaluated and the one with the worse
-     * (estimated) access frequency is evicted. Otherwise, the window cache's victim is
-     * just transferred to the main cache.
+     * Called when the window cache is over capacity.
+     * If the window cache's victim doesn't fit in the main cache, it is compared with the
+     * main cache's victims (in eviction order) until enough weight to fit it is found:
+     * if it scores (estimated access frequency * cost / weight) higher than each of them
+     * they are evicted and it is admitted, otherwise it is evicted and the main cache is
+     * left alone. A victim heavier than the whole main cache is evicted straight away.
+     * Otherwise, the window cache's victim is just transferred to the main cache.
      */
     void evict()
     {
-        if(size() >= capacity())
-            evict_from_window_or_main();
-        else
-            main_.transfer_page_from(window_.lru_pos(), window_);
-    }
+        const page& window_victim = *window_.lru_pos();
+        const int window_victim_weight = window_victim.weight;
+        if(window_victim_weight > main_.capacity())
+        {
+            evict_from_window();
+            return;
+        }
 
-    void evict_from_window_or_main()
-    {
-        const int window_victim_freq = filter_.frequency(window_.victim_key());
-        const int main_victim_freq = filter_.frequency(main_.victim_key());
-        if(window_victim_freq > main_victim_freq)
+        const float window_victim_score = score(window_victim);
+        int excess = main_.weight() + window_victim_weight - main_.capacity();
+        bool admit = true;
+        main_.visit_victims([&](const page& main_victim)
         {
-            evict_from_main();
+            if(excess <= 0)
+                return false;
+            if(window_victim_score <= score(main_victim))
+            {
+                admit = false;
+                return false;
+            }
+            excess -= main_victim.weight;
+            return true;
+        });
+
+        if(admit)
+        {
+            while(main_.weight() + window_victim_weight > main_.capacity()) { evict_from_main(); }
             main_.transfer_page_from(window_.lru_pos(), window_);
         }
         else
-        {
             evict_from_window();
-        }
     }
 
     void evict_from_main()
     {
-        page_map_.erase(main_.victim_key());
+        page_map_.erase(page_map_.find(main_.victim_key()));
         main_.evict();
     }
 
     void evict_from_window()
     {
-        page_map_.erase(window_.victim_key());
+        page_map_.erase(page_map_.find(window_.victim_key()));
         window_.evict();
     }
 };
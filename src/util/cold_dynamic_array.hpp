@@ -0,0 +1,624 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include <lz4.h>
+
+#include "allocator_pool.hpp"
+
+namespace deepfabric
+{
+/*
+	CLASS COLD_DYNAMIC_ARRAY
+	------------------------
+*/
+/*!
+	@brief Thread-safe grow-only dynamic array (like dynamic_array) whose older nodes can be LZ4 compressed to give their memory back.
+	@details The array data is stored in a linked list of nodes where each node is larger than the previous.  compress_cold() can be
+	called (typically from a background thread) to LZ4 compress the older, full nodes of the array, and release_cold() later to return
+	their memory to the operating system once no reader can still be using it.  The iterator transparently decompresses those nodes, a
+	block at a time, into a small buffer of its own.
+
+	Elements cannot be changed once added (a compressed node has no element to change), so the iterator gives const references and
+	operator[]() gives a copy.  The price of compression over dynamic_array is a second atomic increment in push_back() (to know when
+	a node is completely written) and an iterator that allocates a buffer when it (or a copy of it) enters a compressed node.  Needs
+	LZ4 (the ENABLE_LZ4 CMake option links it to the library).
+	@tparam TYPE The array is an array of this type, which must be trivially copyable.
+*/
+template <typename TYPE>
+class cold_dynamic_array
+{
+    static_assert(std::is_trivially_copyable<TYPE>::value, "cold_dynamic_array needs a trivially copyable TYPE");
+
+public:
+    typedef TYPE value_type;			///< So that std::back_inserter() can be used with a cold_dynamic_array.
+
+protected:
+    /*
+    	CLASS COLD_DYNAMIC_ARRAY::NODE
+    	------------------------------
+    */
+    /*!
+    	@brief The array is stored as a linked list of nodes where each node points to some number of elements.
+    */
+    class node
+    {
+    public:
+        TYPE *data;						///< The array data for this node.
+        node *next;						///< Pointer to the next node in the chain.
+        size_t allocated;				///< The size of this node's data object (in elements).
+        std::atomic<size_t> used;		///< The number of elements in data that are used (always <= allocated, except while a new node is added).
+        std::atomic<size_t> written;	///< The number of elements that have been copied into data (the node is full when this is allocated).
+        std::atomic<const uint8_t *> compressed;	///< If not nullptr then this is the LZ4 compressed node (see compress_cold()).
+        bool cold;						///< compress_cold() has already looked at this node.
+        bool released;					///< release_cold() has given the pages of data back to the operating system.
+
+    public:
+        /*
+        	COLD_DYNAMIC_ARRAY::NODE::NODE()
+        	--------------------------------
+        */
+        /*!
+        	@brief Constructor
+        	@param pool [in] The pool allocator used to allocate the data controled by this node.
+        	@param size [in] The size (in elements) of the data to be controlled by this node.
+        */
+        node(allocator_pool &pool, size_t size):
+            next(nullptr),				// this is the end of the linked list.
+            allocated(size),			// the data array is this size (in elements).
+            used(0),					// the data array is empty.
+            written(0),
+            compressed(nullptr),
+            cold(false),
+            released(false)
+        {
+            /*
+            	Allocate the data this node controls.
+            */
+            data = new (pool.malloc(size * sizeof(TYPE))) TYPE[size];
+        }
+
+        /*
+        	COLD_DYNAMIC_ARRAY::NODE::ELEMENTS()
+        	------------------------------------
+        */
+        /*!
+        	@brief Return the number of elements in the node.
+        */
+        size_t elements(void) const
+        {
+            size_t now = used;
+            return now < allocated ? now : allocated;		// used overshoots while a new node is being added
+        }
+    };
+
+protected:
+    static const size_t node_alignment = 64;	///< Nodes start on a cache line so that the used counters of different arrays do not share one.
+    static constexpr size_t compressed_block_elements = 65536 / sizeof(TYPE) == 0 ? 1 : 65536 / sizeof(TYPE);	///< Compressed nodes are compressed (and decompressed) in blocks of this many elements (about 64KB).
+
+protected:
+    /*
+    	COLD_DYNAMIC_ARRAY::DECOMPRESS_BLOCK()
+    	--------------------------------------
+    */
+    /*!
+    	@brief Decompress one block of a compressed node.
+    	@details A compressed node is a table of (blocks + 1) offsets followed by the blocks, each compressed independently with LZ4.
+    	@param from [in] The node.
+    	@param packed [in] The compressed node.
+    	@param block [in] The block to decompress.
+    	@param into [out] The decompressed elements (at least compressed_block_elements of them).
+    	@return The number of elements in the block.
+    	@throws std::runtime_error if the block does not decompress to exactly that many elements.
+    */
+    static size_t decompress_block(const node *from, const uint8_t *packed, size_t block, TYPE *into)
+    {
+        size_t first = block * compressed_block_elements;
+        size_t elements = from->allocated - first < compressed_block_elements ? from->allocated - first : compressed_block_elements;
+        size_t blocks = (from->allocated + compressed_block_elements - 1) / compressed_block_elements;
+        const uint64_t *offset = (const uint64_t *)packed;
+        const char *payload = (const char *)(packed + (blocks + 1) * sizeof(uint64_t));
+
+        /*
+        	A short (or failed) decompression would leave part of into as whatever was there before, so treat it as corruption
+        */
+        int bytes = LZ4_decompress_safe(payload + offset[block], (char *)into, offset[block + 1] - offset[block], elements * sizeof(TYPE));
+        if (bytes < 0 || (size_t)bytes != elements * sizeof(TYPE))
+            throw std::runtime_error("cold_dynamic_array: corrupt compressed node");
+
+        return elements;
+    }
+
+public:
+    /*
+    	CLASS COLD_DYNAMIC_ARRAY::ITERATOR
+    	----------------------------------
+    */
+    /*!
+    	@brief C++ iterator for iterating over a cold_dynamic_array object.
+    */
+    class iterator
+    {
+    private:
+        const node *current_node;		///< The node that this iterator is currently looking at (nullptr at the end).
+        size_t element;					///< The element within current_node that this iterator is looking at.
+        const TYPE *data;				///< Pointer to that element (in the node, or in buffer if the node is compressed).
+        const TYPE *block_end;			///< If current_node is compressed then the end of the decompressed block in buffer, else nullptr.
+        size_t block;					///< If current_node is compressed then the block of it that is in buffer.
+        std::unique_ptr<TYPE[]> buffer;	///< The decompression buffer (allocated the first time a compressed node is seen).
+
+    private:
+        /*
+        	COLD_DYNAMIC_ARRAY::ITERATOR::MOVE_TO()
+        	---------------------------------------
+        */
+        /*!
+        	@brief Point at the given element of current_node, decompressing the block it is in if current_node is compressed.
+        	@param at [in] The element within current_node.
+        */
+        void move_to(size_t at)
+        {
+            const uint8_t *packed = current_node->compressed.load(std::memory_order_acquire);
+
+            element = at;
+            if (packed == nullptr)
+            {
+                block_end = nullptr;
+                data = current_node->data + at;
+                return;
+            }
+
+            if (!buffer)
+                buffer.reset(new TYPE[compressed_block_elements]);
+            block = at / compressed_block_elements;
+            block_end = buffer.get() + decompress_block(current_node, packed, block, buffer.get());
+            data = buffer.get() + at % compressed_block_elements;
+        }
+
+        /*
+        	COLD_DYNAMIC_ARRAY::ITERATOR::NEXT_NODE()
+        	-----------------------------------------
+        */
+        /*!
+        	@brief Move on to the start of the next node.
+        */
+        void next_node(void)
+        {
+            current_node = current_node->next;
+
+            /*
+            	If we're past the end of the list then we're done.
+            */
+            if (current_node == nullptr)
+            {
+                element = 0;
+                data = block_end = nullptr;
+            }
+            else
+                move_to(0);
+        }
+
+    public:
+        /*
+        	COLD_DYNAMIC_ARRAY::ITERATOR::ITERATOR()
+        	----------------------------------------
+        */
+        /*!
+        	@brief constructor
+        	@param node [in] The node that this iterator should start looking at.
+        	@param element [in] Which element within node this iterator should start looking at (normally 0).
+        */
+        iterator(const node *node, size_t element):
+            current_node(node),
+            element(element),
+            data(nullptr),					// the "end" is represented as (nullptr, 0)
+            block_end(nullptr),
+            block(0)
+        {
+            if (node != nullptr)
+                move_to(element);
+        }
+
+        /*
+        	COLD_DYNAMIC_ARRAY::ITERATOR::ITERATOR()
+        	----------------------------------------
+        */
+        /*!
+        	@brief Copy constructor, the copy gets its own decompression buffer.
+        	@param other [in] The iterator to copy.
+        */
+        iterator(const iterator &other):
+            current_node(other.current_node),
+            element(other.element),
+            data(other.data),
+            block_end(other.block_end),
+            block(other.block)
+        {
+            if (other.block_end != nullptr)
+            {
+                buffer.reset(new TYPE[compressed_block_elements]);
+                memcpy((void *)buffer.get(), other.buffer.get(), (other.block_end - other.buffer.get()) * sizeof(TYPE));
+                data = buffer.get() + (other.data - other.buffer.get());
+                block_end = buffer.get() + (other.block_end - other.buffer.get());
+            }
+        }
+
+        iterator(iterator &&other) = default;
+        iterator &operator=(iterator &&other) = default;
+
+        iterator &operator=(const iterator &other)
+        {
+            if (this != &other)
+                *this = iterator(other);
+            return *this;
+        }
+
+        /*
+        	COLD_DYNAMIC_ARRAY::ITERATOR::OPERATOR!=()
+        	------------------------------------------
+        */
+        /*!
+        	@brief Compare two iterator objects for non-equality.
+        	@param other [in] The iterator object to compare to.
+        	@return true if they point at different elements, else false.
+        */
+        bool operator!=(const iterator &other) const
+        {
+            return current_node != other.current_node || element != other.element;
+        }
+
+        /*
+        	COLD_DYNAMIC_ARRAY::ITERATOR::OPERATOR*()
+        	-----------------------------------------
+        */
+        /*!
+        	@brief Return a reference to the element pointed to by this iterator (valid until the iterator moves).
+        */
+        const TYPE &operator*() const
+        {
+            return *data;
+        }
+
+        /*
+        	COLD_DYNAMIC_ARRAY::ITERATOR::OPERATOR++()
+        	------------------------------------------
+        */
+        /*!
+        	@brief Increment this iterator.
+        */
+        const iterator &operator++()
+        {
+            /*
+            	Just move on to the next element
+            */
+            element++;
+            data++;
+
+            /*
+            	In a compressed node move on through the block, then to the next block, then to the next node
+            */
+            if (block_end != nullptr)
+            {
+                if (data < block_end)
+                    return *this;
+                if (element < current_node->allocated)
+                    move_to(element);
+                else
+                    next_node();
+                return *this;
+            }
+
+            /*
+            	but if we're past the end of the current node then move on to the next node
+            */
+            if (element >= current_node->elements())
+                next_node();
+            return *this;
+        }
+    };
+
+protected:
+    allocator_pool &pool;				///< The pool allocator used for all allocation by this object.
+    node *head;							///< Pointer to the head of the linked list of blocks of data.
+    std::atomic<node *> tail;			///< Pointer to the tail of the linked list of blocks of data.  It std::atomic<> so that it can grow lock-free
+    double growth_factor;				///< The next chunk in the linked list is this much larger than the previous.
+
+public:
+    /*
+    	COLD_DYNAMIC_ARRAY::COLD_DYNAMIC_ARRAY()
+    	----------------------------------------
+    */
+    /*!
+    	@brief Constructor.
+    	@param pool [in] The pool allocator used for all allocation done by this object.
+    	@param initial_size [in] The size (in elements) of the initial allocation in the linked list.
+    	@param growth_factor [in] The next node in the linked list stores this many times more elements than the previous (and at least one more).
+    */
+    explicit cold_dynamic_array(allocator_pool &pool, size_t initial_size = compressed_block_elements, double growth_factor = 1.5) :
+        pool(pool),
+        growth_factor(growth_factor)
+    {
+        /*
+        	Allocate space for the first write
+        */
+        head = tail = new (pool.malloc(sizeof(node), node_alignment)) node(pool, initial_size);
+    }
+
+    /*
+    	COLD_DYNAMIC_ARRAY::BEGIN()
+    	---------------------------
+    */
+    /*!
+    	@brief Return an iterator pointing to the start of the array.
+    	@return Iterator pointing to start of array.
+    */
+    iterator begin(void) const
+    {
+        /*
+        	If there's nothing in the array then we're at the end, else we're at the head.
+        */
+        if (head->elements() == 0)
+            return end();
+        else
+            return iterator(head, 0);
+    }
+
+    /*
+    	COLD_DYNAMIC_ARRAY::END()
+    	-------------------------
+    */
+    /*!
+    	@brief Return an iterator pointing to the end of the array.
+    	@return Iterator pointing to end of array.
+    */
+    iterator end(void) const
+    {
+        return iterator(nullptr, 0);
+    }
+
+    /*
+    	COLD_DYNAMIC_ARRAY::SIZE()
+    	--------------------------
+    */
+    /*!
+    	@brief Return the number of elements in the array.
+    	@details This walks the linked list, it is O(number of nodes).
+    	@return The number of elements.
+    */
+    size_t size(void) const
+    {
+        size_t elements = 0;
+
+        for (const node *current = head; current != nullptr; current = current->next)
+            elements += current->elements();
+
+        return elements;
+    }
+
+    /*
+    	COLD_DYNAMIC_ARRAY::PUSH_BACK()
+    	-------------------------------
+    */
+    /*!
+    	@brief Add an element to the end of the array.
+    	@param element [in] The element to add.
+    */
+    void push_back(const TYPE &element)
+    {
+        do
+        {
+            /*
+            	Take a copy of the pointer to the end of the list, and a slot in it (using std::atomic<>++)
+            */
+            node *last = tail;
+            size_t slot = last->used++;
+
+            /*
+            	If that slot is within range then copy the element into the array
+            */
+            if (slot < last->allocated)
+            {
+                last->data[slot] = element;
+                last->written++;
+                break;
+            }
+            else
+            {
+                /*
+                	We've walked past the end so we allocate space for a new node (and elements in that node) and add it to the list.
+                */
+                last->used = last->allocated;
+                size_t grown = (size_t)(last->allocated * growth_factor);
+                node *another = new (pool.malloc(sizeof(node), node_alignment)) node(pool, grown > last->allocated ? grown : last->allocated + 1);
+                /*
+                	Atomicly make it the tail and if we succeed than make the previous node in the list point to this one.
+                	If we fail then the pool allocator won't take the memory back so ignore and re-try
+                */
+                if (tail.compare_exchange_strong(last, another))
+                    last->next = another;
+            }
+        }
+        while(true);
+    }
+
+    /*
+    	COLD_DYNAMIC_ARRAY::OPERATOR[]()
+    	--------------------------------
+    */
+    /*!
+    	@brief Return a copy of the given element (counting from 0).
+    	@details This walks the linked list (so it is O(number of nodes)) and, if the element is in a compressed node, decompresses
+    	the block it is in.  The preferred method for iterating over the array is to use a for each iterator.  As with std::array
+    	the behaviour is undefined if the given index is out-of-range.
+    	@param element [in] The element to find.
+    	@return The element.
+    */
+    TYPE operator[](size_t element) const
+    {
+        /*
+        	Walk the linked list until we find the requested element
+        */
+        for (const node *current = head; current != nullptr; current = current->next)
+        {
+            size_t elements = current->elements();
+            if (element >= elements)
+            {
+                element -= elements;						// its further down the list
+                continue;
+            }
+
+            const uint8_t *packed = current->compressed.load(std::memory_order_acquire);
+            if (packed == nullptr)
+                return current->data[element];				// got it
+
+            static thread_local std::unique_ptr<TYPE[]> buffer(new TYPE[compressed_block_elements]);
+            decompress_block(current, packed, element / compressed_block_elements, buffer.get());
+            return buffer[element % compressed_block_elements];
+        }
+
+        /*
+        	The undefined behaviour is to return the first element in the array.
+        */
+        return head->data[0];
+    }
+
+    /*
+    	COLD_DYNAMIC_ARRAY::COMPRESS_COLD()
+    	-----------------------------------
+    */
+    /*!
+    	@brief LZ4 compress the older, full nodes of the array so that release_cold() can give the memory they used back to the operating system.
+    	@details The tail node and the keep_hot nodes before it are left alone, as are nodes that do not compress by at least 1/8th.
+    	Iterators and operator[]() use the compressed node from when it is published, but one that was already inside the node (or a
+    	reference into it) keeps reading the original, so that is left intact here.  This may be called (typically from a background
+    	thread) while other threads push_back(), iterate and read, but not concurrently with itself or release_cold().
+    	@param keep_hot [in] The number of full nodes before the tail to leave uncompressed.
+    	@return The number of bytes release_cold() can then save (memory it can give back less memory used by the compressed nodes).
+    */
+    size_t compress_cold(size_t keep_hot = 1)
+    {
+        static const size_t page_size = sysconf(_SC_PAGESIZE);
+        std::vector<uint8_t> scratch;
+        size_t saved = 0;
+
+        /*
+        	Count the nodes before the tail so that the last keep_hot of them can be skipped
+        */
+        node *last = tail;
+        size_t nodes = 0;
+        for (node *current = head; current != nullptr && current != last; current = current->next)
+            nodes++;
+
+        node *current = head;
+        for (size_t which = 0; which + keep_hot < nodes; which++, current = current->next)
+        {
+            /*
+            	Only look at each node once, and only once every push_back() into it has finished
+            */
+            if (current->cold || current->written != current->allocated)
+                continue;
+            current->cold = true;
+
+            /*
+            	The pages wholly inside the node are the ones that can be given back, if there are none then there is no point
+            */
+            size_t raw_bytes = current->allocated * sizeof(TYPE);
+            uintptr_t from = ((uintptr_t)current->data + page_size - 1) / page_size * page_size;
+            uintptr_t to = ((uintptr_t)current->data + raw_bytes) / page_size * page_size;
+            if (to <= from)
+                continue;
+
+            /*
+            	Compress each block into scratch
+            */
+            size_t blocks = (current->allocated + compressed_block_elements - 1) / compressed_block_elements;
+            size_t table_bytes = (blocks + 1) * sizeof(uint64_t);
+            size_t block_bound = LZ4_compressBound(compressed_block_elements * sizeof(TYPE));
+            scratch.resize(table_bytes + blocks * block_bound);
+            uint64_t *offset = (uint64_t *)scratch.data();
+            char *payload = (char *)scratch.data() + table_bytes;
+
+            offset[0] = 0;
+            size_t block;
+            for (block = 0; block < blocks; block++)
+            {
+                size_t first = block * compressed_block_elements;
+                size_t elements = current->allocated - first < compressed_block_elements ? current->allocated - first : compressed_block_elements;
+                int bytes = LZ4_compress_default((const char *)(current->data + first), payload + offset[block], elements * sizeof(TYPE), block_bound);
+                if (bytes <= 0)
+                    break;
+                offset[block + 1] = offset[block] + bytes;
+            }
+
+            /*
+            	Keep the compressed node only if it is worthwhile
+            */
+            size_t packed_bytes = table_bytes + offset[block];
+            if (block != blocks || packed_bytes >= raw_bytes - raw_bytes / 8 || packed_bytes >= to - from)
+                continue;
+
+            uint8_t *packed = (uint8_t *)pool.malloc(packed_bytes, alignof(uint64_t));
+            if (packed == nullptr)
+                continue;
+            memcpy(packed, scratch.data(), packed_bytes);
+            current->compressed.store(packed, std::memory_order_release);
+            saved += (to - from) - packed_bytes;
+        }
+
+        return saved;
+    }
+
+    /*
+    	COLD_DYNAMIC_ARRAY::RELEASE_COLD()
+    	----------------------------------
+    */
+    /*!
+    	@brief Give the memory of the nodes compressed by compress_cold() back to the operating system.
+    	@details As the pool never frees, the memory of each original node is given back with madvise(MADV_DONTNEED) (only the whole
+    	pages inside it, its first and last pages may be shared with other allocations), after which it reads as zeros.  So this must
+    	only be called once every iterator and reference obtained before the compress_cold() call that compressed the node has gone
+    	(a grace period, e.g. once every reader has finished the request it was serving), and not concurrently with compress_cold().
+    	@return The number of bytes given back.
+    */
+    size_t release_cold(void)
+    {
+        static const size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t released = 0;
+
+        for (node *current = head; current != nullptr; current = current->next)
+        {
+            if (current->released || current->compressed.load(std::memory_order_acquire) == nullptr)
+                continue;
+            current->released = true;
+
+            uintptr_t from = ((uintptr_t)current->data + page_size - 1) / page_size * page_size;
+            uintptr_t to = ((uintptr_t)current->data + current->allocated * sizeof(TYPE)) / page_size * page_size;
+            if (madvise((void *)from, to - from, MADV_DONTNEED) == 0)
+                released += to - from;
+        }
+
+        return released;
+    }
+};
+}
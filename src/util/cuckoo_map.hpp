@@ -0,0 +1,755 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace deepfabric
+{
+/*
+	CLASS CUCKOO_MAP
+	----------------
+*/
+/*!
+	@brief Concurrent hash map (bucketized cuckoo hashing) with lock-free lookups, for shared lookup tables such as term to postings or
+	docname to docid.
+	@details Each key has two candidate buckets of 4 slots, and is in one of them.  The second bucket is computed from the first and an
+	8-bit tag of the key's hash (partial-key cuckoo hashing), so entries can be moved between their buckets without rehashing the key.
+	Each slot has its tag alongside, and a lookup compares the 8 tags of both buckets with the key's at once (SWAR, 8 bytes in a 64-bit
+	word) before comparing any key, so a miss usually reads no keys at all.
+
+	Buckets are guarded by a fixed number of lock stripes, each a version counter that is odd while a writer holds it (a seqlock).
+	Writers lock the (one or two) stripes of the key's buckets.  Readers take no lock: they read the stripes' versions, copy out the
+	entry, and start again if either version has changed (or was odd).  Hence KEY and VALUE must be trivially copyable (intern strings,
+	e.g. in a string_pool, and use the pointer or an id).
+
+	When both buckets are full, a breadth-first search (serialized by a mutex, so that displacements don't fight each other) finds the
+	shortest path of moves that frees a slot in one of them, and the moves are made from the free end backwards, each under the locks of
+	its two buckets, so every key stays findable throughout.  If there is no such path of at most max_path_length moves the table is
+	doubled online: the resize locks every stripe, rehashes into a new table and publishes it.  Readers can still be reading the old
+	table, so it is kept (not freed) until the map is destroyed, which at most doubles the memory used.
+*/
+template <typename KEY, typename VALUE, typename HASH = std::hash<KEY>, typename EQUAL = std::equal_to<KEY>>
+class cuckoo_map
+{
+    static_assert(std::is_trivially_copyable<KEY>::value && std::is_trivially_copyable<VALUE>::value,
+                  "cuckoo_map lookups copy entries while they may be being written, so KEY and VALUE must be trivially copyable");
+
+public:
+    static constexpr size_t slots_per_bucket = 4;			///< The number of entries in a bucket.
+    static constexpr size_t stripes = 2048;				///< The number of lock stripes (buckets share stripes round-robin).
+    static constexpr size_t max_path_length = 5;			///< The longest cuckoo path searched for before the table grows.
+
+protected:
+    /*
+    	CLASS CUCKOO_MAP::BUCKET
+    	------------------------
+    */
+    /*!
+    	@brief Four slots.  A slot is empty if its tag is 0.
+    */
+    class bucket
+    {
+    public:
+        uint8_t tag[slots_per_bucket];				///< The tag of each slot's key (never 0 for a full slot).
+        KEY key[slots_per_bucket];				///< The keys.
+        VALUE value[slots_per_bucket];				///< The values.
+
+    public:
+        /*!
+        	@brief The tags as one word, one byte per slot.
+        */
+        uint32_t tags(void) const
+        {
+            uint32_t word;
+            memcpy(&word, tag, sizeof(word));
+            return word;
+        }
+    };
+
+    /*
+    	CLASS CUCKOO_MAP::TABLE
+    	-----------------------
+    */
+    /*!
+    	@brief An array of buckets (a power of two of them).
+    */
+    class table
+    {
+    public:
+        size_t mask;							///< The number of buckets minus 1.
+        std::unique_ptr<bucket[]> buckets;			///< The buckets.
+
+    public:
+        explicit table(size_t bucket_count) :
+            mask(bucket_count - 1),
+            buckets(new bucket[bucket_count]())
+        {
+            /*
+            	Nothing
+            */
+        }
+    };
+
+    /*
+    	CLASS CUCKOO_MAP::STRIPE
+    	------------------------
+    */
+    /*!
+    	@brief A seqlock over the buckets whose index is congruent to its own modulo stripes.  Padded so that neighbouring stripes are
+    	on different cache lines.
+    */
+    class stripe
+    {
+    public:
+        std::atomic<uint64_t> version;			///< Odd while a writer holds the lock, and advanced by each writer.
+        int64_t entries;						///< The change in the number of entries made under this lock (so size() sums them).
+        uint8_t padding[48];					///< Keeps the next stripe off this cache line.
+
+    public:
+        stripe() :
+            version(0),
+            entries(0)
+        {
+            /*
+            	Nothing
+            */
+        }
+    };
+
+    /*
+    	CLASS CUCKOO_MAP::STEP
+    	----------------------
+    */
+    /*!
+    	@brief A node of the breadth-first search for a cuckoo path: a bucket reached by moving the entry in slot of the parent's bucket.
+    */
+    class step
+    {
+    public:
+        size_t bucket;							///< The bucket.
+        int parent;								///< The previous step (-1 for the key's own buckets).
+        int slot;								///< The slot of the parent's bucket whose entry moves here.
+        int depth;								///< The number of moves from the key's buckets.
+    };
+
+protected:
+    std::atomic<table *> current;				///< The table in use.
+    std::vector<std::unique_ptr<table>> tables;	///< Every table ever used (see the class comment), the current one last.
+    std::unique_ptr<stripe[]> locks;			///< The lock stripes.
+    std::mutex cuckoo_mutex;					///< Held while searching for and moving along a cuckoo path, or resizing.
+
+private:
+    cuckoo_map(const cuckoo_map &) = delete;
+    cuckoo_map &operator=(const cuckoo_map &) = delete;
+
+protected:
+    /*
+    	CUCKOO_MAP::HASH_OF()
+    	---------------------
+    */
+    /*!
+    	@brief Return the hash of key, mixed (with the MurmurHash3 finalizer) so that weak hash functions (std::hash of an integer is the
+    	integer) still spread over the buckets and tags.
+    */
+    static uint64_t hash_of(const KEY &key)
+    {
+        uint64_t hash = HASH()(key);
+
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    /*
+    	CUCKOO_MAP::TAG_OF()
+    	--------------------
+    */
+    /*!
+    	@brief Return the tag of a hash: its top 8 bits, but never 0 (which marks an empty slot).
+    */
+    static uint8_t tag_of(uint64_t hash)
+    {
+        uint8_t tag = hash >> 56;
+        return tag + (tag == 0);
+    }
+
+    /*
+    	CUCKOO_MAP::ALTERNATE()
+    	-----------------------
+    */
+    /*!
+    	@brief Return the other bucket of an entry in a bucket with a tag (from either bucket, this gives the other).
+    */
+    static size_t alternate(const table &in, size_t index, uint8_t tag)
+    {
+        return (index ^ ((tag + 1) * 0xc6a4a7935bd1e995ULL)) & in.mask;
+    }
+
+    /*
+    	CUCKOO_MAP::MATCHES()
+    	---------------------
+    */
+    /*!
+    	@brief Return a mask with the top bit of each byte of tags that may equal tag set (SWAR: exact, except that a byte above a match
+    	can also be set), so that the caller need only compare the keys of those slots.
+    */
+    static uint64_t matches(uint64_t tags, uint8_t tag)
+    {
+        uint64_t difference = tags ^ (0x0101010101010101ULL * tag);
+        return (difference - 0x0101010101010101ULL) & ~difference & 0x8080808080808080ULL;
+    }
+
+    /*
+    	CUCKOO_MAP::PAUSE()
+    	-------------------
+    */
+    /*!
+    	@brief Back off while waiting for a lock: spin briefly then give up the processor, since the holder may not be running.
+    */
+    static void pause(int &spins)
+    {
+        if (++spins < 64)
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+        else
+            std::this_thread::yield();
+    }
+
+    /*
+    	CUCKOO_MAP::LOCK()
+    	------------------
+    */
+    /*!
+    	@brief Acquire a stripe.
+    */
+    void lock(size_t which)
+    {
+        std::atomic<uint64_t> &version = locks[which].version;
+        int spins = 0;
+        while (true)
+        {
+            uint64_t seen = version.load(std::memory_order_relaxed);
+            if ((seen & 1) == 0 && version.compare_exchange_weak(seen, seen + 1, std::memory_order_acquire))
+                break;
+            pause(spins);
+        }
+        /*
+        	Keep the writes to the buckets after the version becomes odd (as seen by readers)
+        */
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    /*
+    	CUCKOO_MAP::UNLOCK()
+    	--------------------
+    */
+    /*!
+    	@brief Release a stripe.
+    */
+    void unlock(size_t which)
+    {
+        locks[which].version.fetch_add(1, std::memory_order_release);
+    }
+
+    /*
+    	CUCKOO_MAP::LOCK_PAIR()
+    	-----------------------
+    */
+    /*!
+    	@brief Acquire the stripes of two buckets (in stripe order, so that writers cannot deadlock).
+    	@return The two stripes, the same one twice if they share it.
+    */
+    std::pair<size_t, size_t> lock_pair(size_t first, size_t second)
+    {
+        size_t one = first % stripes;
+        size_t two = second % stripes;
+        if (one > two)
+            std::swap(one, two);
+        lock(one);
+        if (two != one)
+            lock(two);
+        return {one, two};
+    }
+
+    /*
+    	CUCKOO_MAP::UNLOCK_PAIR()
+    	-------------------------
+    */
+    /*!
+    	@brief Release the stripes returned by lock_pair().
+    */
+    void unlock_pair(std::pair<size_t, size_t> held)
+    {
+        if (held.second != held.first)
+            unlock(held.second);
+        unlock(held.first);
+    }
+
+    /*
+    	CUCKOO_MAP::LOCK_KEY()
+    	----------------------
+    */
+    /*!
+    	@brief Acquire the stripes of the buckets of the key with a hash, in the current table.
+    	@param hash [in] The key's hash.
+    	@param into [out] The current table (which cannot change until the stripes are released).
+    	@param first [out] The key's first bucket.
+    	@param second [out] The key's second bucket.
+    	@return The stripes held.
+    */
+    std::pair<size_t, size_t> lock_key(uint64_t hash, table *&into, size_t &first, size_t &second)
+    {
+        while (true)
+        {
+            into = current.load(std::memory_order_acquire);
+            first = hash & into->mask;
+            second = alternate(*into, first, tag_of(hash));
+            std::pair<size_t, size_t> held = lock_pair(first, second);
+            if (current.load(std::memory_order_relaxed) == into)
+                return held;
+            unlock_pair(held);			// resized in the meantime
+        }
+    }
+
+    /*
+    	CUCKOO_MAP::LOCATE()
+    	--------------------
+    */
+    /*!
+    	@brief Find a key in its two buckets.
+    	@return The bucket (0 for first, 1 for second) times slots_per_bucket plus the slot, or -1 if the key is not there.
+    */
+    static int locate(const table &in, size_t first, size_t second, uint8_t tag, const KEY &key)
+    {
+        const bucket &one = in.buckets[first];
+        const bucket &two = in.buckets[second];
+        uint64_t candidates = matches(one.tags() | (uint64_t)two.tags() << 32, tag);
+        while (candidates != 0)
+        {
+            int which = __builtin_ctzll(candidates) / 8;
+            const bucket &in_bucket = which < (int)slots_per_bucket ? one : two;
+            int slot = which % slots_per_bucket;
+            if (in_bucket.tag[slot] == tag && EQUAL()(in_bucket.key[slot], key))
+                return which;
+            candidates &= candidates - 1;
+        }
+        return -1;
+    }
+
+    /*
+    	CUCKOO_MAP::FREE_SLOT()
+    	-----------------------
+    */
+    /*!
+    	@brief Return the first empty slot of a bucket, or -1 if it is full.
+    */
+    static int free_slot(const bucket &in)
+    {
+        uint64_t empty = matches(in.tags(), 0) & 0xFFFFFFFFULL;
+        return empty == 0 ? -1 : __builtin_ctzll(empty) / 8;
+    }
+
+    /*
+    	CUCKOO_MAP::PUT()
+    	-----------------
+    */
+    /*!
+    	@brief Insert or (if assign) update a key.
+    	@return true if the key was inserted, false if it was already there.
+    */
+    bool put(const KEY &key, const VALUE &value, bool assign)
+    {
+        uint64_t hash = hash_of(key);
+        uint8_t tag = tag_of(hash);
+
+        while (true)
+        {
+            table *into;
+            size_t first, second;
+            std::pair<size_t, size_t> held = lock_key(hash, into, first, second);
+
+            int found = locate(*into, first, second, tag, key);
+            if (found >= 0)
+            {
+                if (assign)
+                    into->buckets[found < (int)slots_per_bucket ? first : second].value[found % slots_per_bucket] = value;
+                unlock_pair(held);
+                return false;
+            }
+
+            for (size_t index : {first, second})
+            {
+                bucket &in = into->buckets[index];
+                int slot = free_slot(in);
+                if (slot >= 0)
+                {
+                    in.key[slot] = key;
+                    in.value[slot] = value;
+                    in.tag[slot] = tag;
+                    locks[held.first].entries++;
+                    unlock_pair(held);
+                    return true;
+                }
+            }
+            unlock_pair(held);
+
+            /*
+            	Both buckets are full, so make room (or grow) and try again
+            */
+            std::lock_guard<std::mutex> critical_section(cuckoo_mutex);
+            if (current.load(std::memory_order_relaxed) == into && !cuckoo(*into, first, second))
+                grow(into);
+        }
+    }
+
+    /*
+    	CUCKOO_MAP::CUCKOO()
+    	--------------------
+    */
+    /*!
+    	@brief Free a slot in one of two buckets by moving entries along the shortest cuckoo path (the caller holds cuckoo_mutex).
+    	@return false if there is no path of at most max_path_length moves.  true if a path was moved along, or if another writer got
+    	in the way (either way the caller should look again).
+    */
+    bool cuckoo(table &in, size_t first, size_t second)
+    {
+        /*
+        	Breadth-first search without locks (the path is checked as it is moved along)
+        */
+        std::vector<step> queue;
+        queue.push_back({first, -1, -1, 0});
+        queue.push_back({second, -1, -1, 0});
+        int goal = -1;
+        int free = -1;
+        for (size_t at = 0; at < queue.size() && goal < 0; at++)
+        {
+            step here = queue[at];
+            const bucket &from = in.buckets[here.bucket];
+            int slot = free_slot(from);
+            if (slot >= 0)
+            {
+                goal = at;
+                free = slot;
+                break;
+            }
+            if ((size_t)here.depth == max_path_length)
+                continue;
+            for (size_t which = 0; which < slots_per_bucket; which++)
+                queue.push_back({alternate(in, here.bucket, from.tag[which]), (int)at, (int)which, here.depth + 1});
+        }
+        if (goal < 0)
+            return false;
+
+        /*
+        	Move from the free end backwards: each move fills the slot emptied by the one before
+        */
+        for (int at = goal; queue[at].parent >= 0; at = queue[at].parent)
+        {
+            const step &to = queue[at];
+            const step &from = queue[to.parent];
+            std::pair<size_t, size_t> held = lock_pair(from.bucket, to.bucket);
+            bucket &source = in.buckets[from.bucket];
+            bucket &destination = in.buckets[to.bucket];
+            uint8_t tag = source.tag[to.slot];
+            if (tag == 0 || destination.tag[free] != 0 || alternate(in, from.bucket, tag) != to.bucket)
+            {
+                unlock_pair(held);			// a writer changed the path
+                return true;
+            }
+            destination.key[free] = source.key[to.slot];
+            destination.value[free] = source.value[to.slot];
+            destination.tag[free] = tag;
+            source.tag[to.slot] = 0;
+            unlock_pair(held);
+            free = to.slot;
+        }
+        return true;
+    }
+
+    /*
+    	CUCKOO_MAP::GROW()
+    	------------------
+    */
+    /*!
+    	@brief Double the table (the caller holds cuckoo_mutex).
+    	@param from [in] The table the caller found to be too full (if it has already been replaced, there's nothing to do).
+    */
+    void grow(table *from)
+    {
+        if (current.load(std::memory_order_relaxed) == from)
+            rehash(2 * (from->mask + 1));
+    }
+
+    /*
+    	CUCKOO_MAP::REHASH()
+    	--------------------
+    */
+    /*!
+    	@brief Move every entry into a new table of at least a number of buckets (the caller holds cuckoo_mutex).
+    */
+    void rehash(size_t bucket_count)
+    {
+        for (size_t which = 0; which < stripes; which++)
+            lock(which);
+
+        table *from = current.load(std::memory_order_relaxed);
+        std::unique_ptr<table> to;
+        for (size_t size = bucket_count; to == nullptr; size *= 2)
+        {
+            to.reset(new table(size));
+            for (size_t index = 0; index <= from->mask && to != nullptr; index++)
+                for (size_t slot = 0; slot < slots_per_bucket && to != nullptr; slot++)
+                    if (from->buckets[index].tag[slot] != 0 && !place(*to, from->buckets[index].key[slot], from->buckets[index].value[slot]))
+                        to = nullptr;			// too full even for the new table, try a bigger one
+        }
+
+        current.store(to.get(), std::memory_order_release);
+        tables.push_back(std::move(to));
+
+        for (size_t which = stripes; which-- > 0;)
+            unlock(which);
+    }
+
+    /*
+    	CUCKOO_MAP::PLACE()
+    	-------------------
+    */
+    /*!
+    	@brief Put an entry in a table nobody else can see (for rehash()), using a random walk to make room.
+    	@return false if no room was found.
+    */
+    static bool place(table &in, KEY key, VALUE value)
+    {
+        uint64_t hash = hash_of(key);
+        uint8_t tag = tag_of(hash);
+        size_t index = hash & in.mask;
+
+        for (size_t kicks = 0; kicks < 500; kicks++)
+        {
+            for (size_t candidate : {index, alternate(in, index, tag)})
+            {
+                int slot = free_slot(in.buckets[candidate]);
+                if (slot >= 0)
+                {
+                    in.buckets[candidate].key[slot] = key;
+                    in.buckets[candidate].value[slot] = value;
+                    in.buckets[candidate].tag[slot] = tag;
+                    return true;
+                }
+            }
+            /*
+            	Swap with an entry of the first bucket and place that instead
+            */
+            bucket &full = in.buckets[index];
+            size_t slot = (hash >> (kicks % 32)) % slots_per_bucket;
+            std::swap(key, full.key[slot]);
+            std::swap(value, full.value[slot]);
+            std::swap(tag, full.tag[slot]);
+            index = alternate(in, index, tag);
+        }
+        return false;
+    }
+
+public:
+    /*
+    	CUCKOO_MAP::CUCKOO_MAP()
+    	------------------------
+    */
+    /*!
+    	@brief Constructor.
+    	@param expected [in] The number of entries to make room for up front (the map grows as needed anyway).
+    */
+    explicit cuckoo_map(size_t expected = 0) :
+        locks(new stripe[stripes])
+    {
+        size_t bucket_count = 16;
+        while (bucket_count * slots_per_bucket * 9 < expected * 10)			// 90% full
+            bucket_count *= 2;
+        tables.emplace_back(new table(bucket_count));
+        current.store(tables.back().get(), std::memory_order_release);
+    }
+
+    /*
+    	CUCKOO_MAP::FIND()
+    	------------------
+    */
+    /*!
+    	@brief Look a key up, without locking.
+    	@param key [in] The key.
+    	@param value [out] Its value, if it is there.
+    	@return true if the key is there.
+    */
+    bool find(const KEY &key, VALUE &value) const
+    {
+        uint64_t hash = hash_of(key);
+        uint8_t tag = tag_of(hash);
+        int spins = 0;
+
+        while (true)
+        {
+            const table *in = current.load(std::memory_order_acquire);
+            size_t first = hash & in->mask;
+            size_t second = alternate(*in, first, tag);
+            const std::atomic<uint64_t> &one = locks[first % stripes].version;
+            const std::atomic<uint64_t> &two = locks[second % stripes].version;
+            uint64_t before_one = one.load(std::memory_order_acquire);
+            uint64_t before_two = two.load(std::memory_order_acquire);
+            if (((before_one | before_two) & 1) == 0)
+            {
+                int found = locate(*in, first, second, tag, key);
+                if (found >= 0)
+                    value = in->buckets[found < (int)slots_per_bucket ? first : second].value[found % slots_per_bucket];
+
+                /*
+                	Valid only if no writer held either stripe meanwhile and the table was not replaced
+                */
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (one.load(std::memory_order_relaxed) == before_one && two.load(std::memory_order_relaxed) == before_two
+                        && current.load(std::memory_order_relaxed) == in)
+                    return found >= 0;
+            }
+            pause(spins);
+        }
+    }
+
+    /*
+    	CUCKOO_MAP::CONTAINS()
+    	----------------------
+    */
+    /*!
+    	@brief Return true if the key is in the map.
+    */
+    bool contains(const KEY &key) const
+    {
+        VALUE ignored;
+        return find(key, ignored);
+    }
+
+    /*
+    	CUCKOO_MAP::INSERT()
+    	--------------------
+    */
+    /*!
+    	@brief Add a key, unless it is already there.
+    	@return true if the key was added, false if it was already there (and its value has not been changed).
+    */
+    bool insert(const KEY &key, const VALUE &value)
+    {
+        return put(key, value, false);
+    }
+
+    /*
+    	CUCKOO_MAP::INSERT_OR_ASSIGN()
+    	------------------------------
+    */
+    /*!
+    	@brief Add a key, or change its value if it is already there.
+    	@return true if the key was added, false if its value was changed.
+    */
+    bool insert_or_assign(const KEY &key, const VALUE &value)
+    {
+        return put(key, value, true);
+    }
+
+    /*
+    	CUCKOO_MAP::ERASE()
+    	-------------------
+    */
+    /*!
+    	@brief Remove a key.
+    	@return true if it was there.
+    */
+    bool erase(const KEY &key)
+    {
+        uint64_t hash = hash_of(key);
+        table *in;
+        size_t first, second;
+        std::pair<size_t, size_t> held = lock_key(hash, in, first, second);
+
+        int found = locate(*in, first, second, tag_of(hash), key);
+        if (found >= 0)
+        {
+            in->buckets[found < (int)slots_per_bucket ? first : second].tag[found % slots_per_bucket] = 0;
+            locks[held.first].entries--;
+        }
+        unlock_pair(held);
+        return found >= 0;
+    }
+
+    /*
+    	CUCKOO_MAP::RESERVE()
+    	---------------------
+    */
+    /*!
+    	@brief Grow the table (if need be) to hold a number of entries without further resizing.
+    */
+    void reserve(size_t expected)
+    {
+        std::lock_guard<std::mutex> critical_section(cuckoo_mutex);
+        size_t bucket_count = current.load(std::memory_order_relaxed)->mask + 1;
+        size_t needed = bucket_count;
+        while (needed * slots_per_bucket * 9 < expected * 10)
+            needed *= 2;
+        if (needed != bucket_count)
+            rehash(needed);
+    }
+
+    /*
+    	CUCKOO_MAP::SIZE()
+    	------------------
+    */
+    /*!
+    	@brief Return the number of entries (only exact when no writer is running).
+    */
+    size_t size(void) const
+    {
+        int64_t total = 0;
+        for (size_t which = 0; which < stripes; which++)
+            total += locks[which].entries;
+        return total;
+    }
+
+    /*
+    	CUCKOO_MAP::BUCKET_COUNT()
+    	--------------------------
+    */
+    /*!
+    	@brief Return the number of buckets in the current table.
+    */
+    size_t bucket_count(void) const
+    {
+        return current.load(std::memory_order_acquire)->mask + 1;
+    }
+};
+
+template <typename KEY, typename VALUE, typename HASH, typename EQUAL> constexpr size_t cuckoo_map<KEY, VALUE, HASH, EQUAL>::slots_per_bucket;
+template <typename KEY, typename VALUE, typename HASH, typename EQUAL> constexpr size_t cuckoo_map<KEY, VALUE, HASH, EQUAL>::stripes;
+template <typename KEY, typename VALUE, typename HASH, typename EQUAL> constexpr size_t cuckoo_map<KEY, VALUE, HASH, EQUAL>::max_path_length;
+}
@@ -35,6 +35,9 @@ namespace deepfabric
 template <typename TYPE>
 class dynamic_array
 {
+public:
+    typedef TYPE value_type;			///< So that std::back_inserter() can be used with a dynamic_array.
+
 protected:
     /*
     	CLASS DYNAMIC_ARRAY::NODE
@@ -170,6 +173,9 @@ public:
         }
     };
 
+protected:
+    static const size_t node_alignment = 64;	///< Nodes start on a cache line so that the used counters of different arrays (e.g. lanes of a laned_dynamic_array) do not share one.
+
 public:
     allocator_pool &pool;				///< The pool allocator used for all allocation by this object.
     node *head;							///< Pointer to the head of the linked list of blocks of data.
@@ -194,7 +200,7 @@ public:
         /*
         	Allocate space for the first write
         */
-        head = tail = new (pool.malloc(sizeof(node))) node(pool, initial_size);
+        head = tail = new (pool.malloc(sizeof(node), node_alignment)) node(pool, initial_size);
     }
 
     /*
@@ -242,6 +248,28 @@ public:
         return tail.load()->data[tail.load()->used - 1];
     }
 
+    /*
+    	DYNAMIC_ARRAY::SIZE()
+    	---------------------
+    */
+    /*!
+    	@brief Return the number of elements in the array.
+    	@details This walks the linked list, it is O(number of nodes).
+    	@return The number of elements.
+    */
+    size_t size(void) const
+    {
+        size_t elements = 0;
+
+        for (const node *current = head; current != nullptr; current = current->next)
+        {
+            size_t used = current->used;
+            elements += used < current->allocated ? used : current->allocated;		// used overshoots while a new node is being added
+        }
+
+        return elements;
+    }
+
     /*
     	DYNAMIC_ARRAY::PUSH_BACK()
     	--------------------------
@@ -281,7 +309,7 @@ public:
                 	We've walked past the end so we allocate space for a new node (and elements in that node) and add it to the list.
                 */
                 last->used = last->allocated;
-                node *another = new (pool.malloc(sizeof(node))) node(pool, (size_t)(last->allocated * growth_factor));
+                node *another = new (pool.malloc(sizeof(node), node_alignment)) node(pool, (size_t)(last->allocated * growth_factor));
                 /*
                 	Atomicly make it the tail and if we succeed than make the previous node in the list point to this one.
                 	If we fail then the pool allocator won't take the memory back so ignore and re-try
@@ -0,0 +1,888 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h> // for SYS_gettid
+
+#include <cmath>
+#include <cstddef>
+#include <new>
+
+#include "flight_recorder.hpp"
+
+// Everything reachable from dump() only calls async-signal-safe functions (write(),
+// clock_gettime(), sigaction(), ...) and only uses static memory, hence the hand-rolled
+// formatting below rather than snprintf(...).
+
+namespace deepfabric
+{
+namespace flight_recorder
+{
+
+std::atomic<int> recorded_level(-1);
+
+namespace
+{
+
+const size_t max_rings = 1024; // the most threads that can record (rings are reused after a thread exits)
+const size_t signal_stack_size = 65536;
+
+// a thread's records: bytes [head - mask - 1, head) of the ring are the newest records, the
+// oldest of which may be partly overwritten
+struct ring
+{
+    std::atomic<uint64_t> head; // the number of bytes ever written
+    std::atomic<bool> owned; // by a live thread
+    uint32_t thread;
+    uint64_t mask; // size - 1
+    char* bytes;
+    char* signal_stack;
+};
+
+std::atomic<ring*> rings[max_rings];
+std::atomic<size_t> ring_count(0);
+std::atomic<size_t> default_ring_size(size_t(1) << 20);
+std::atomic<bool> handling_signals(false);
+int signal_fd = 2;
+
+// gives the calling thread's ring back when it exits
+struct owner
+{
+    ring* owned = nullptr;
+
+    ~owner()
+    {
+        if (owned)
+        {
+            detail::current_ring.bytes = nullptr;
+            owned->owned.store(false, std::memory_order_release);
+        }
+    }
+};
+
+thread_local owner thread_ring;
+
+// a timestamp() and the clocks at the same moment, to convert timestamps with
+struct anchor
+{
+    uint64_t ticks;
+    int64_t monotonic;
+    int64_t realtime;
+};
+
+anchor start_anchor;
+
+int64_t clock_ns(clockid_t clock) noexcept
+{
+    timespec now;
+    clock_gettime(clock, &now);
+    return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+anchor now() noexcept
+{
+    anchor result;
+    result.monotonic = clock_ns(CLOCK_MONOTONIC);
+    result.ticks = detail::timestamp();
+    result.realtime = clock_ns(CLOCK_REALTIME);
+    return result;
+}
+
+void use_signal_stack(ring& r) noexcept
+{
+    stack_t current;
+    if (r.signal_stack && 0 == sigaltstack(nullptr, &current) && (current.ss_flags & SS_DISABLE))
+    {
+        stack_t stack;
+        stack.ss_sp = r.signal_stack;
+        stack.ss_size = signal_stack_size;
+        stack.ss_flags = 0;
+        sigaltstack(&stack, nullptr);
+    }
+}
+
+ring* claim() noexcept
+{
+    // reuse the ring of a thread that has exited
+    for (size_t i = 0, count = std::min(ring_count.load(std::memory_order_acquire), max_rings); i < count; ++i)
+    {
+        ring* r = rings[i].load(std::memory_order_acquire);
+        bool owned = false;
+        if (r && !r->owned.load(std::memory_order_relaxed) && r->owned.compare_exchange_strong(owned, true))
+        {
+            r->thread = uint32_t(syscall(SYS_gettid));
+            return r;
+        }
+    }
+
+    if (ring_count.load(std::memory_order_relaxed) >= max_rings)
+    {
+        return nullptr;
+    }
+
+    const size_t size = default_ring_size.load(std::memory_order_relaxed);
+    ring* r = new (std::nothrow) ring;
+    char* bytes = new (std::nothrow) char[size];
+    char* signal_stack = new (std::nothrow) char[signal_stack_size];
+    const size_t index = ring_count.fetch_add(1);
+    if (!r || !bytes || index >= max_rings)
+    {
+        delete r;
+        delete[] bytes;
+        delete[] signal_stack;
+        return nullptr;
+    }
+    r->head.store(0, std::memory_order_relaxed);
+    r->owned.store(true, std::memory_order_relaxed);
+    r->thread = uint32_t(syscall(SYS_gettid));
+    r->mask = size - 1;
+    r->bytes = bytes;
+    r->signal_stack = signal_stack;
+    rings[index].store(r, std::memory_order_release); // never freed, so that dump() can always read it
+    return r;
+}
+
+// copies 'size' bytes from 'offset' (a count of bytes ever written) of a ring
+void read_ring(const ring& r, uint64_t offset, char* out, size_t size) noexcept
+{
+    const size_t at = offset & r.mask;
+    const size_t first = std::min(size, size_t(r.mask + 1 - at));
+    std::memcpy(out, r.bytes + at, first);
+    std::memcpy(out + first, r.bytes, size - first);
+}
+
+// the offset from which records are not being (or about to be) overwritten, given a head
+uint64_t floor(const ring& r, uint64_t head) noexcept
+{
+    const uint64_t size = r.mask + 1;
+    return head + max_record_size > size ? head + max_record_size - size : 0;
+}
+
+// buffered, async-signal-safe text output
+class writer
+{
+public:
+    explicit writer(int fd) noexcept: fd_(fd), size_(0) {}
+    ~writer() { flush(); }
+
+    void put(char ch) noexcept
+    {
+        if (size_ == sizeof(buf_))
+        {
+            flush();
+        }
+        buf_[size_++] = ch;
+    }
+
+    void put(const char* str, size_t size) noexcept
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            put(str[i]);
+        }
+    }
+
+    void put(const char* str) noexcept { put(str, std::strlen(str)); }
+
+    void put_padded(const char* prefix, const char* body, size_t body_size, int width, bool left, bool zero) noexcept
+    {
+        const size_t prefix_size = std::strlen(prefix);
+        int padding = width - int(prefix_size + body_size);
+        if (!left && !zero)
+        {
+            for (; padding > 0; --padding) put(' ');
+        }
+        put(prefix, prefix_size);
+        if (!left && zero)
+        {
+            for (; padding > 0; --padding) put('0');
+        }
+        put(body, body_size);
+        for (; padding > 0; --padding) put(' ');
+    }
+
+    void put_unsigned(uint64_t value, int digits = 1) noexcept
+    {
+        char tmp[64];
+        size_t size = unsigned_to(tmp, value, 10, false, digits);
+        put(tmp, size);
+    }
+
+    void flush() noexcept
+    {
+        for (size_t done = 0; done < size_;)
+        {
+            const ssize_t written = ::write(fd_, buf_ + done, size_ - done);
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (written <= 0)
+            {
+                break; // nowhere to report it
+            }
+            done += size_t(written);
+        }
+        size_ = 0;
+    }
+
+    // writes 'value' in 'base' (with at least 'digits' digits) to 'out', returning the size
+    static size_t unsigned_to(char* out, uint64_t value, unsigned base, bool upper, int digits) noexcept
+    {
+        const char* symbols = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+        char tmp[64];
+        size_t size = 0;
+        do
+        {
+            tmp[size++] = symbols[value % base];
+            value /= base;
+        } while (value);
+        for (; int(size) < digits && size < sizeof(tmp); )
+        {
+            tmp[size++] = '0';
+        }
+        for (size_t i = 0; i < size; ++i)
+        {
+            out[i] = tmp[size - 1 - i];
+        }
+        return size;
+    }
+
+private:
+    int fd_;
+    size_t size_;
+    char buf_[4096]; // small, as dump() may run on a signal stack
+};
+
+// a recorded argument
+struct argument
+{
+    detail::tag_t tag;
+    uint64_t value;
+    const char* str;
+    size_t size;
+
+    int64_t as_signed() const noexcept
+    {
+        if (tag == detail::FLOATING)
+        {
+            double d;
+            std::memcpy(&d, &value, sizeof(d));
+            return int64_t(d);
+        }
+        return int64_t(value);
+    }
+
+    double as_double() const noexcept
+    {
+        if (tag == detail::FLOATING)
+        {
+            double d;
+            std::memcpy(&d, &value, sizeof(d));
+            return d;
+        }
+        return tag == detail::SIGNED ? double(int64_t(value)) : double(value);
+    }
+};
+
+// the arguments of a record
+class arguments
+{
+public:
+    arguments(const char* begin, const char* end) noexcept: pos_(begin), end_(end) {}
+
+    bool next(argument& arg) noexcept
+    {
+        if (pos_ >= end_ || *pos_ == detail::END)
+        {
+            return false;
+        }
+        arg.tag = detail::tag_t(*pos_++);
+        arg.value = 0;
+        arg.str = nullptr;
+        arg.size = 0;
+        if (arg.tag == detail::STRING)
+        {
+            if (pos_ >= end_)
+            {
+                return false;
+            }
+            const size_t size = uint8_t(*pos_++);
+            arg.size = std::min(size, size_t(end_ - pos_));
+            arg.str = pos_;
+            pos_ += arg.size;
+            return true;
+        }
+        if (arg.tag > detail::OTHER || pos_ + sizeof(arg.value) > end_)
+        {
+            return false;
+        }
+        std::memcpy(&arg.value, pos_, sizeof(arg.value));
+        pos_ += sizeof(arg.value);
+        return true;
+    }
+
+private:
+    const char* pos_;
+    const char* end_;
+};
+
+// writes a double as %f/%e/%g would
+void put_double(writer& out, double value, char conversion, int precision, bool alternate, const char* sign_prefix, int width, bool left, bool zero) noexcept
+{
+    char body[96];
+    size_t size = 0;
+    char prefix[2] = { 0, 0 };
+    if (value < 0 || (value == 0 && std::signbit(value)))
+    {
+        prefix[0] = '-';
+        value = -value;
+    }
+    else if (*sign_prefix)
+    {
+        prefix[0] = *sign_prefix;
+    }
+    const bool upper = conversion >= 'A' && conversion <= 'Z';
+    if (value != value)
+    {
+        out.put_padded(prefix, upper ? "NAN" : "nan", 3, width, left, false);
+        return;
+    }
+    if (value > 1.7976931348623157e308)
+    {
+        out.put_padded(prefix, upper ? "INF" : "inf", 3, width, left, false);
+        return;
+    }
+
+    precision = std::min(precision < 0 ? 6 : precision, 17);
+    char kind = conversion | 0x20; // lower case
+    int exponent = 0;
+    for (double scaled = value; scaled >= 10; scaled /= 10) ++exponent;
+    for (double scaled = value; scaled != 0 && scaled < 1; scaled *= 10) --exponent;
+    bool strip = false;
+    if (kind == 'g')
+    {
+        const int p = precision == 0 ? 1 : precision;
+        strip = !alternate;
+        if (exponent >= -4 && exponent < p)
+        {
+            kind = 'f';
+            precision = p - 1 - exponent;
+        }
+        else
+        {
+            kind = 'e';
+            precision = p - 1;
+        }
+    }
+    if (kind == 'f' && value >= 1e18)
+    {
+        kind = 'e'; // not worth printing all those digits exactly
+    }
+    double mantissa = value;
+    if (kind == 'e')
+    {
+        for (int i = 0; i < exponent; ++i) mantissa /= 10;
+        for (int i = 0; i > exponent; --i) mantissa *= 10;
+    }
+
+    // the digits, as an integer number of 10^-precision
+    double scale = 1;
+    for (int i = 0; i < precision; ++i) scale *= 10;
+    uint64_t scaled;
+    while ((scaled = uint64_t(mantissa * scale + 0.5)) >= 18446744073709551615.0 / 10 && precision > 0)
+    {
+        --precision;
+        scale /= 10;
+    }
+    uint64_t whole = uint64_t(double(scaled) / scale);
+    if (kind == 'e' && whole >= 10)
+    {
+        // rounding made it 10.0
+        ++exponent;
+        mantissa /= 10;
+        scaled = uint64_t(mantissa * scale + 0.5);
+        whole = uint64_t(double(scaled) / scale);
+    }
+    const uint64_t fraction = scaled - uint64_t(double(whole) * scale);
+    size += writer::unsigned_to(body + size, whole, 10, false, 1);
+    if (precision > 0 || alternate)
+    {
+        body[size++] = '.';
+    }
+    if (precision > 0)
+    {
+        size += writer::unsigned_to(body + size, fraction, 10, false, precision);
+    }
+    if (strip && precision > 0)
+    {
+        while (body[size - 1] == '0') --size;
+        if (body[size - 1] == '.') --size;
+    }
+    if (kind == 'e')
+    {
+        body[size++] = upper ? 'E' : 'e';
+        body[size++] = exponent < 0 ? '-' : '+';
+        size += writer::unsigned_to(body + size, uint64_t(exponent < 0 ? -exponent : exponent), 10, false, 2);
+    }
+    out.put_padded(prefix, body, size, width, left, zero);
+}
+
+// writes a record's message, i.e. its site's printf(...) format with its arguments
+void put_message(writer& out, const char* format, arguments args) noexcept
+{
+    argument arg;
+    for (const char* pos = format; *pos; ++pos)
+    {
+        if (*pos != '%')
+        {
+            out.put(*pos);
+            continue;
+        }
+        if (*++pos == '%')
+        {
+            out.put('%');
+            continue;
+        }
+
+        // flags, width, precision and length
+        bool left = false, zero = false, alternate = false;
+        const char* sign = "";
+        for (;; ++pos)
+        {
+            if (*pos == '-') left = true;
+            else if (*pos == '0') zero = true;
+            else if (*pos == '#') alternate = true;
+            else if (*pos == '+') sign = "+";
+            else if (*pos == ' ') { if (!*sign) sign = " "; }
+            else break;
+        }
+        int width = 0;
+        if (*pos == '*')
+        {
+            ++pos;
+            width = args.next(arg) ? int(arg.as_signed()) : 0;
+            if (width < 0) { left = true; width = -width; }
+        }
+        for (; *pos >= '0' && *pos <= '9'; ++pos) width = width * 10 + (*pos - '0');
+        int precision = -1;
+        if (*pos == '.')
+        {
+            precision = 0;
+            if (*++pos == '*')
+            {
+                ++pos;
+                precision = args.next(arg) ? int(arg.as_signed()) : 0;
+            }
+            for (; *pos >= '0' && *pos <= '9'; ++pos) precision = precision * 10 + (*pos - '0');
+        }
+        int bits = 32;
+        for (;; ++pos)
+        {
+            if (*pos == 'h') bits /= 2;
+            else if (*pos == 'l' || *pos == 'z' || *pos == 'j' || *pos == 't' || *pos == 'q' || *pos == 'L') bits = 64;
+            else break;
+        }
+        const char conversion = *pos;
+        if (!conversion)
+        {
+            break;
+        }
+        if (!args.next(arg))
+        {
+            out.put("(missing)");
+            continue;
+        }
+
+        // a string, whatever the conversion
+        if (arg.tag == detail::STRING)
+        {
+            const size_t size = precision >= 0 && conversion == 's' ? std::min(arg.size, size_t(precision)) : arg.size;
+            out.put_padded("", arg.str, size, width, left, false);
+            continue;
+        }
+        if (arg.tag == detail::OTHER)
+        {
+            out.put_padded("", "?", 1, width, left, false);
+            continue;
+        }
+
+        char body[72];
+        size_t size = 0;
+        const char* prefix = "";
+        char sign_prefix[2] = { 0, 0 };
+        const uint64_t mask = bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+        switch (conversion)
+        {
+        case 'd':
+        case 'i':
+        case 's': // a number for %s: print it in decimal
+        {
+            int64_t value = arg.as_signed();
+            if (arg.tag == detail::UNSIGNED && conversion == 's')
+            {
+                size = writer::unsigned_to(body, arg.value, 10, false, 1);
+                break;
+            }
+            if (bits < 64)
+            {
+                value = int64_t(uint64_t(value) << (64 - bits)) >> (64 - bits); // as the narrower type
+            }
+            const uint64_t magnitude = value < 0 ? uint64_t(0) - uint64_t(value) : uint64_t(value);
+            sign_prefix[0] = value < 0 ? '-' : *sign;
+            prefix = sign_prefix;
+            size = writer::unsigned_to(body, magnitude, 10, false, precision < 0 ? 1 : precision);
+            break;
+        }
+        case 'u':
+            size = writer::unsigned_to(body, uint64_t(arg.as_signed()) & mask, 10, false, precision < 0 ? 1 : precision);
+            break;
+        case 'x':
+        case 'X':
+        {
+            const uint64_t value = uint64_t(arg.as_signed()) & mask;
+            prefix = alternate && value ? (conversion == 'x' ? "0x" : "0X") : "";
+            size = writer::unsigned_to(body, value, 16, conversion == 'X', precision < 0 ? 1 : precision);
+            break;
+        }
+        case 'o':
+        {
+            const uint64_t value = uint64_t(arg.as_signed()) & mask;
+            prefix = alternate && value ? "0" : "";
+            size = writer::unsigned_to(body, value, 8, false, precision < 0 ? 1 : precision);
+            break;
+        }
+        case 'p':
+            if (!arg.value)
+            {
+                std::memcpy(body, "(nil)", 5);
+                size = 5;
+                break;
+            }
+            prefix = "0x";
+            size = writer::unsigned_to(body, arg.value, 16, false, 1);
+            break;
+        case 'c':
+            body[0] = char(arg.value);
+            size = 1;
+            zero = false;
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            put_double(out, arg.as_double(), conversion == 'a' ? 'e' : conversion == 'A' ? 'E' : conversion, precision, alternate, sign, width, left, zero);
+            continue;
+        default: // unknown, write the specification as it is
+            out.put('%');
+            out.put(conversion);
+            continue;
+        }
+        out.put_padded(prefix, body, size, width, left, zero && precision < 0);
+    }
+}
+
+// writes a time (ns since the epoch) as UTC "YYYY-MM-DD hh:mm:ss.nnnnnnnnn"
+void put_time(writer& out, int64_t ns) noexcept
+{
+    int64_t seconds = ns / 1000000000;
+    const int64_t nanoseconds = ns % 1000000000;
+    int64_t days = seconds / 86400;
+    const int64_t in_day = seconds % 86400;
+
+    // civil_from_days(), see http://howardhinnant.github.io/date_algorithms.html
+    days += 719468;
+    const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const int64_t day_of_era = days - era * 146097;
+    const int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    const int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    const int64_t shifted_month = (5 * day_of_year + 2) / 153;
+    const int64_t day = day_of_year - (153 * shifted_month + 2) / 5 + 1;
+    const int64_t month = shifted_month < 10 ? shifted_month + 3 : shifted_month - 9;
+    const int64_t year = year_of_era + era * 400 + (month <= 2);
+
+    out.put_unsigned(uint64_t(year), 4);
+    out.put('-');
+    out.put_unsigned(uint64_t(month), 2);
+    out.put('-');
+    out.put_unsigned(uint64_t(day), 2);
+    out.put(' ');
+    out.put_unsigned(uint64_t(in_day / 3600), 2);
+    out.put(':');
+    out.put_unsigned(uint64_t(in_day / 60 % 60), 2);
+    out.put(':');
+    out.put_unsigned(uint64_t(in_day % 60), 2);
+    out.put('.');
+    out.put_unsigned(uint64_t(nanoseconds), 9);
+}
+
+// where dump() is in each ring
+struct cursor
+{
+    ring* r;
+    uint64_t at; // the next record
+    uint64_t end; // the head when the dump started
+    uint64_t timestamp; // of the next record
+};
+
+// dump()'s state, static so that dumping needs neither the heap nor much stack
+std::atomic<bool> dumping(false);
+cursor cursors[max_rings];
+char record_bytes[max_record_size];
+
+// reads the record of a cursor into 'record_bytes' and its timestamp into the cursor, or moves the
+// cursor to its end if the record is not (or no longer) valid
+bool load(cursor& c) noexcept
+{
+    if (c.at >= c.end)
+    {
+        return false;
+    }
+    detail::header head;
+    read_ring(*c.r, c.at, reinterpret_cast<char*>(&head), sizeof(head));
+    if (head.size < sizeof(head) + sizeof(uint32_t) || head.size > max_record_size || head.size % 8 || c.at + head.size > c.end)
+    {
+        c.at = c.end;
+        return false;
+    }
+    read_ring(*c.r, c.at, record_bytes, head.size);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint32_t trailer;
+    std::memcpy(&trailer, record_bytes + head.size - sizeof(trailer), sizeof(trailer));
+    if (trailer != head.size || c.at < floor(*c.r, c.r->head.load(std::memory_order_relaxed)))
+    {
+        c.at = c.end; // overwritten while being read
+        return false;
+    }
+    c.timestamp = head.timestamp;
+    return true;
+}
+
+struct sigaction previous_actions[NSIG];
+const int fatal_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+
+void dump_signal(int signal, siginfo_t*, void*)
+{
+    const int saved_errno = errno;
+    {
+        writer out(signal_fd);
+        out.put("\nflight recorder: caught signal ");
+        out.put_unsigned(uint64_t(signal));
+        out.put(" in thread ");
+        out.put_unsigned(uint64_t(syscall(SYS_gettid)));
+        out.put("\n");
+    }
+    dump(signal_fd);
+
+    // let the signal take its previous course: re-raised (if it was sent) or re-triggered (by
+    // returning to the faulting instruction)
+    sigaction(signal, &previous_actions[signal], nullptr);
+    if (signal == SIGABRT)
+    {
+        raise(signal);
+    }
+    errno = saved_errno;
+}
+
+}
+
+namespace detail
+{
+
+thread_local ring_view current_ring;
+
+bool claim_ring() noexcept
+{
+    ring* r = claim();
+    if (!r)
+    {
+        return false;
+    }
+    if (handling_signals.load(std::memory_order_acquire))
+    {
+        use_signal_stack(*r);
+    }
+    thread_ring.owned = r;
+    current_ring.mask = r->mask;
+    current_ring.head = &r->head;
+    current_ring.thread = r->thread;
+    current_ring.bytes = r->bytes;
+    return true;
+}
+
+void copy_wrapped(const ring_view& ring, size_t at, const char* data, size_t size) noexcept
+{
+    const size_t first = std::min(size, size_t(ring.mask + 1 - at));
+    std::memcpy(ring.bytes + at, data, first);
+    std::memcpy(ring.bytes, data + first, size - first);
+}
+
+}
+
+void record_le(int level) noexcept
+{
+    if (start_anchor.ticks == 0)
+    {
+        start_anchor = now();
+    }
+    recorded_level.store(level, std::memory_order_relaxed);
+}
+
+void ring_size(size_t bytes) noexcept
+{
+    size_t size = max_record_size * 2;
+    while (size < bytes)
+    {
+        size *= 2;
+    }
+    default_ring_size.store(size, std::memory_order_relaxed);
+}
+
+void dump(int fd) noexcept
+{
+    writer out(fd);
+    bool expected = false;
+    if (!dumping.compare_exchange_strong(expected, true, std::memory_order_acquire))
+    {
+        out.put("flight recorder: already dumping\n");
+        return;
+    }
+    const int level = recorded_level.exchange(-1); // pause recording, so the rings hold still
+
+    // the oldest whole record of each ring, found by walking back from its newest
+    size_t count = std::min(ring_count.load(std::memory_order_acquire), max_rings);
+    size_t threads = 0;
+    size_t records = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        cursor& c = cursors[threads];
+        c.r = rings[i].load(std::memory_order_acquire);
+        if (!c.r)
+        {
+            continue;
+        }
+        c.end = c.r->head.load(std::memory_order_acquire);
+        c.at = c.end;
+        const uint64_t limit = floor(*c.r, c.end);
+        while (c.at >= limit + sizeof(detail::header) + sizeof(uint32_t))
+        {
+            uint32_t size;
+            read_ring(*c.r, c.at - sizeof(size), reinterpret_cast<char*>(&size), sizeof(size));
+            if (size < sizeof(detail::header) + sizeof(uint32_t) || size > max_record_size || size % 8 || c.at - limit < size)
+            {
+                break;
+            }
+            c.at -= size;
+        }
+        if (load(c))
+        {
+            ++threads;
+        }
+    }
+
+    // convert timestamps to wall-clock time with the ticks per ns since recording started
+    const anchor end = now();
+    const anchor& start = start_anchor.ticks ? start_anchor : end;
+    const double ns_per_tick = end.ticks > start.ticks && end.monotonic > start.monotonic
+        ? double(end.monotonic - start.monotonic) / double(end.ticks - start.ticks) : 1;
+
+    out.put("flight recorder: dump of ");
+    out.put_unsigned(threads);
+    out.put(" thread(s) at ");
+    put_time(out, end.realtime);
+    out.put(" UTC\n");
+
+    // merge the rings oldest first
+    for (;;)
+    {
+        cursor* oldest = nullptr;
+        for (size_t i = 0; i < threads; ++i)
+        {
+            if (cursors[i].at < cursors[i].end && (!oldest || cursors[i].timestamp < oldest->timestamp))
+            {
+                oldest = &cursors[i];
+            }
+        }
+        if (!oldest)
+        {
+            break;
+        }
+        if (!load(*oldest)) // 'record_bytes' holds the last record loaded, which may be another ring's
+        {
+            continue;
+        }
+
+        detail::header head;
+        std::memcpy(&head, record_bytes, sizeof(head));
+        const int64_t ago = int64_t(double(end.ticks - std::min(head.timestamp, end.ticks)) * ns_per_tick);
+        put_time(out, end.realtime - ago);
+        out.put(" [");
+        out.put_unsigned(head.thread);
+        out.put("] ");
+        out.put(head.where->prefix);
+        out.put(": ");
+        out.put(head.where->file);
+        out.put(':');
+        out.put_unsigned(head.where->line);
+        out.put(' ');
+        put_message(out, head.where->format, arguments(record_bytes + sizeof(head), record_bytes + head.size - sizeof(uint32_t)));
+        out.put('\n');
+        ++records;
+
+        oldest->at += head.size;
+        load(*oldest);
+    }
+
+    out.put("flight recorder: end of dump, ");
+    out.put_unsigned(records);
+    out.put(" record(s)\n");
+    out.flush();
+
+    int paused = -1;
+    recorded_level.compare_exchange_strong(paused, level); // unless record_le() was called meanwhile
+    dumping.store(false, std::memory_order_release);
+}
+
+bool dump_on_fatal_signals(int fd) noexcept
+{
+    signal_fd = fd;
+    handling_signals.store(true, std::memory_order_release);
+    if (thread_ring.owned)
+    {
+        use_signal_stack(*thread_ring.owned);
+    }
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_sigaction = dump_signal;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    for (const int signal : fatal_signals)
+    {
+        if (sigaction(signal, &action, &previous_actions[signal]) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+}
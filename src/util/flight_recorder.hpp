@@ -0,0 +1,268 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // for __rdtsc()
+#else
+#include <time.h> // for clock_gettime(...)
+#endif
+
+// An in-memory flight recorder for the FRMT_* log macros: each thread that logs at a
+// recorded level appends a binary record (a timestamp, a pointer to the call site and the
+// arguments, unformatted) to a fixed-size ring buffer of its own, overwriting its oldest
+// records, so that detailed (e.g. TRACE) logging costs a few ns per event and the last
+// moments before a failure can still be looked at. Formatting is left to dump(), which
+// merges the threads' records by time into text, and is async-signal-safe, so that it can
+// be called from the handlers installed by dump_on_fatal_signals(). EXCEPTION() also dumps
+// (see logger::dump_recorded()).
+//
+// String arguments are copied (up to max_string_size bytes), everything else is kept as a
+// 64-bit value, so a record can be formatted long after the call.
+
+namespace deepfabric
+{
+namespace flight_recorder
+{
+
+// where records are made (one per FRMT_* call site, so records only point to it)
+struct site
+{
+    int level;
+    const char* prefix;
+    const char* file;
+    unsigned line;
+    const char* format;
+};
+
+const size_t max_record_size = 1024; // in bytes, arguments that do not fit are dropped
+const size_t max_string_size = 255; // in bytes, longer string arguments are truncated
+
+extern std::atomic<int> recorded_level; // use record_le()
+
+inline bool recording(int level) noexcept
+{
+    return level <= recorded_level.load(std::memory_order_relaxed);
+}
+
+// records the levels up to and including 'level' (e.g. logger::TRACE), -1 == none (the default)
+void record_le(int level) noexcept;
+
+// the size of the ring of each thread that starts recording afterwards, rounded up to a
+// power of two (default 1 MiB)
+void ring_size(size_t bytes) noexcept;
+
+// writes the recorded events of every thread, oldest first, as text to 'fd'
+// (async-signal-safe, recording is paused while it runs)
+void dump(int fd) noexcept;
+
+// dumps to 'fd' on SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT, then lets the signal take its
+// previous course (threads that record afterwards get an alternate signal stack, so a stack
+// overflow is dumped too)
+bool dump_on_fatal_signals(int fd) noexcept;
+
+namespace detail
+{
+
+enum tag_t : uint8_t
+{
+    END, // padding
+    SIGNED,
+    UNSIGNED,
+    FLOATING,
+    POINTER,
+    STRING,
+    OTHER // an argument of a type that cannot be recorded
+};
+
+// the start of a record, which is followed by the arguments (a tag then the value of each),
+// padded to a multiple of 8 bytes whose last 4 are the record's size again (so that the
+// ring can be walked backwards from its newest record)
+struct header
+{
+    uint32_t size;
+    uint32_t thread;
+    uint64_t timestamp;
+    const site* where;
+};
+
+inline uint64_t timestamp() noexcept
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+#endif
+}
+
+// the calling thread's ring (bytes == nullptr until it first records)
+struct ring_view
+{
+    char* bytes;
+    uint64_t mask; // size - 1
+    std::atomic<uint64_t>* head; // the number of bytes ever written
+    uint32_t thread;
+};
+
+extern thread_local ring_view current_ring;
+
+// gives the calling thread a ring, returning false if it cannot have one
+bool claim_ring() noexcept;
+
+// copies a record that would wrap around the end of the ring into it
+void copy_wrapped(const ring_view& ring, size_t at, const char* data, size_t size) noexcept;
+
+// a record being put together (straight into the ring unless it might wrap)
+class record_buffer
+{
+public:
+    record_buffer(char* data, const site& where, uint32_t thread) noexcept: data_(data), pos_(data + sizeof(header))
+    {
+        header head;
+        head.size = 0;
+        head.thread = thread;
+        head.timestamp = timestamp();
+        head.where = &where;
+        std::memcpy(data_, &head, sizeof(head));
+    }
+
+    void put(tag_t tag, uint64_t value) noexcept
+    {
+        if(pos_ + 1 + sizeof(value) <= end())
+        {
+            *pos_++ = char(tag);
+            std::memcpy(pos_, &value, sizeof(value));
+            pos_ += sizeof(value);
+        }
+    }
+
+    void put(const char* str, size_t size) noexcept
+    {
+        if(pos_ + 1 + sizeof(uint8_t) <= end())
+        {
+            size = std::min(size, std::min(max_string_size, size_t(end() - pos_) - 1 - sizeof(uint8_t)));
+            *pos_++ = char(STRING);
+            *pos_++ = char(uint8_t(size));
+            std::memcpy(pos_, str, size);
+            pos_ += size;
+        }
+    }
+
+    // pads the record and fills in its size, returning it
+    size_t finish() noexcept
+    {
+        const size_t size = (pos_ - data_ + sizeof(uint32_t) + 7) & ~size_t(7);
+        std::memset(pos_, 0, data_ + size - pos_);
+        const uint32_t size32 = uint32_t(size);
+        std::memcpy(data_, &size32, sizeof(size32));
+        std::memcpy(data_ + size - sizeof(size32), &size32, sizeof(size32));
+        return size;
+    }
+
+private:
+    const char* end() const noexcept { return data_ + max_record_size - sizeof(uint32_t); }
+
+    char* data_;
+    char* pos_;
+};
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+put(record_buffer& buf, const T& value) noexcept { buf.put(SIGNED, uint64_t(int64_t(value))); }
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+put(record_buffer& buf, const T& value) noexcept { buf.put(UNSIGNED, uint64_t(value)); }
+
+template<typename T>
+inline typename std::enable_if<std::is_enum<T>::value>::type
+put(record_buffer& buf, const T& value) noexcept { buf.put(SIGNED, uint64_t(int64_t(value))); }
+
+template<typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type
+put(record_buffer& buf, const T& value) noexcept
+{
+    const double d = value;
+    uint64_t bits;
+    std::memcpy(&bits, &d, sizeof(bits));
+    buf.put(FLOATING, bits);
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_pointer<T>::value
+    && !std::is_same<typename std::decay<typename std::remove_pointer<T>::type>::type, char>::value>::type
+put(record_buffer& buf, const T& value) noexcept { buf.put(POINTER, uint64_t(uintptr_t(value))); }
+
+inline void put(record_buffer& buf, const char* value) noexcept
+{
+    if(value)
+    {
+        buf.put(value, std::strlen(value));
+    }
+    else
+    {
+        buf.put("(null)", 6);
+    }
+}
+
+inline void put(record_buffer& buf, char* value) noexcept { put(buf, static_cast<const char*>(value)); }
+
+inline void put(record_buffer& buf, const std::string& value) noexcept { buf.put(value.data(), value.size()); }
+
+template<size_t Size>
+inline void put(record_buffer& buf, const char(&value)[Size]) noexcept { put(buf, static_cast<const char*>(value)); }
+
+template<typename T>
+inline typename std::enable_if<!std::is_arithmetic<T>::value && !std::is_enum<T>::value && !std::is_pointer<T>::value>::type
+put(record_buffer& buf, const T&) noexcept { buf.put(OTHER, 0); }
+
+}
+
+template<typename... Args>
+void record(const site& where, const Args&... args) noexcept
+{
+    detail::ring_view& ring = detail::current_ring;
+    if(!ring.bytes && !detail::claim_ring())
+    {
+        return; // out of memory or too many threads, drop it
+    }
+
+    // bytes from the head on are not read (see dump()) until the head is moved past them
+    const uint64_t head = ring.head->load(std::memory_order_relaxed);
+    const size_t at = head & ring.mask;
+    char local[max_record_size];
+    char* data = ring.mask + 1 - at >= max_record_size ? ring.bytes + at : local;
+
+    detail::record_buffer buf(data, where, ring.thread);
+    const int expand[] = { 0, (detail::put(buf, args), 0)... };
+    (void)(expand);
+    const size_t size = buf.finish();
+    if(data == local)
+    {
+        detail::copy_wrapped(ring, at, local, size);
+    }
+    ring.head->store(head + size, std::memory_order_release);
+}
+
+}
+}
@@ -0,0 +1,313 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "allocator_pool.hpp"
+#include "dynamic_array.hpp"
+#include "thread_utils.hpp"
+
+namespace deepfabric
+{
+/*
+	CLASS LANED_DYNAMIC_ARRAY
+	-------------------------
+*/
+/*!
+	@brief Thread-safe grow-only unordered array for many writers, where each thread appends to its own lane.
+	@details Every dynamic_array::push_back() increments the same tail->used, so with many writers that one cache line becomes
+	the bottleneck.  Here each thread appends to a lane (a dynamic_array from the same pool) chosen by its thread_ordinal(), so
+	threads do not contend unless there are more than LANES of them (in which case threads share lanes, which is still correct).
+	Lanes are created the first time a thread appends to them.
+
+	The elements from one thread stay in the order that thread added them, but there is no order across threads.  The iterator
+	walks the lanes one after the other.  If each thread appends in sorted order (for example, timestamps or sequence numbers)
+	then ordered() visits all the elements in sorted order by merging the lanes.
+	@tparam TYPE The array is an array of this type.
+	@tparam LANES The maximum number of lanes.
+*/
+template <typename TYPE, size_t LANES = 64>
+class laned_dynamic_array
+{
+public:
+    typedef dynamic_array<TYPE> lane_type;				///< Each lane is one of these.
+
+public:
+    /*
+    	CLASS LANED_DYNAMIC_ARRAY::ITERATOR
+    	-----------------------------------
+    */
+    /*!
+    	@brief C++ iterator for iterating over a laned_dynamic_array object (lane by lane).
+    */
+    class iterator
+    {
+    private:
+        const laned_dynamic_array *array;			///< The array being iterated over.
+        size_t current_lane;						///< The lane being iterated over (LANES at the end).
+        typename lane_type::iterator at;			///< Where in current_lane we are.
+
+    private:
+        /*
+        	LANED_DYNAMIC_ARRAY::ITERATOR::SKIP_EMPTY()
+        	-------------------------------------------
+        */
+        /*!
+        	@brief If at is at the end of current_lane then move on to the first non-empty lane after it.
+        */
+        void skip_empty(void)
+        {
+            while (current_lane < LANES && !(at != array->lane_end))
+            {
+                current_lane++;
+                while (current_lane < LANES && array->lane[current_lane].load() == nullptr)
+                    current_lane++;
+                if (current_lane < LANES)
+                    at = array->lane[current_lane].load()->begin();
+            }
+        }
+
+    public:
+        /*
+        	LANED_DYNAMIC_ARRAY::ITERATOR::ITERATOR()
+        	-----------------------------------------
+        */
+        /*!
+        	@brief constructor
+        	@param array [in] The array to iterate over.
+        	@param lane [in] The lane to start at (LANES for the end).
+        */
+        iterator(const laned_dynamic_array *array, size_t lane) :
+            array(array),
+            current_lane(lane),
+            at(array->lane_end)
+        {
+            while (current_lane < LANES && array->lane[current_lane].load() == nullptr)
+                current_lane++;
+            if (current_lane < LANES)
+            {
+                at = array->lane[current_lane].load()->begin();
+                skip_empty();
+            }
+        }
+
+        /*
+        	LANED_DYNAMIC_ARRAY::ITERATOR::OPERATOR!=()
+        	-------------------------------------------
+        */
+        /*!
+        	@brief Compare two iterator objects for non-equality.
+        	@param other [in] The iterator object to compare to.
+        	@return true if they differ, else false.
+        */
+        bool operator!=(const iterator &other) const
+        {
+            return current_lane != other.current_lane || at != other.at;
+        }
+
+        /*
+        	LANED_DYNAMIC_ARRAY::ITERATOR::OPERATOR*()
+        	------------------------------------------
+        */
+        /*!
+        	@brief Return a reference to the element pointed to by this iterator.
+        */
+        TYPE &operator*() const
+        {
+            return *at;
+        }
+
+        /*
+        	LANED_DYNAMIC_ARRAY::ITERATOR::OPERATOR++()
+        	-------------------------------------------
+        */
+        /*!
+        	@brief Increment this iterator.
+        */
+        const iterator &operator++()
+        {
+            ++at;
+            skip_empty();
+            return *this;
+        }
+    };
+
+protected:
+    static const size_t lane_alignment = 64;		///< Lanes start on a cache line so that their atomics are aligned and not shared between lanes.
+    static constexpr size_t minimum_lane_size = 64;	///< The first node of a lane holds at least this many elements (so that (size_t)(size * growth_factor) grows).
+
+public:
+    static constexpr size_t default_lane_size = 4096 / sizeof(TYPE) > minimum_lane_size ? 4096 / sizeof(TYPE) : minimum_lane_size;	///< By default the first node of a lane is a page of elements.
+
+protected:
+    allocator_pool &pool;							///< The pool allocator used for all allocation by this object.
+    size_t initial_size;							///< The size (in elements) of the first node of each lane.
+    double growth_factor;							///< The growth factor of each lane.
+    std::array<std::atomic<lane_type *>, LANES> lane;	///< The lanes (nullptr until first used).
+    typename lane_type::iterator lane_end;			///< The end() of every lane.
+
+protected:
+    /*
+    	LANED_DYNAMIC_ARRAY::THIS_THREADS_LANE()
+    	----------------------------------------
+    */
+    /*!
+    	@brief Return the lane the calling thread appends to, creating it if necessary.
+    	@return The lane.
+    */
+    lane_type &this_threads_lane(void)
+    {
+        std::atomic<lane_type *> &slot = lane[thread_ordinal() % LANES];
+        lane_type *mine = slot.load(std::memory_order_acquire);
+
+        if (mine == nullptr)
+        {
+            /*
+            	If another thread that shares this lane beats us to creating it then the pool won't take the memory back so ignore it and use theirs
+            */
+            lane_type *another = new (pool.malloc(sizeof(lane_type), lane_alignment)) lane_type(pool, initial_size, growth_factor);
+            if (slot.compare_exchange_strong(mine, another, std::memory_order_acq_rel))
+                mine = another;
+        }
+
+        return *mine;
+    }
+
+public:
+    /*
+    	LANED_DYNAMIC_ARRAY::LANED_DYNAMIC_ARRAY()
+    	------------------------------------------
+    */
+    /*!
+    	@brief Constructor.
+    	@param pool [in] The pool allocator used for all allocation done by this object.
+    	@param initial_size [in] The size (in elements) of the first node of each lane (at least minimum_lane_size).
+    	@param growth_factor [in] The growth factor of each lane (see dynamic_array).
+    */
+    explicit laned_dynamic_array(allocator_pool &pool, size_t initial_size = default_lane_size, double growth_factor = 1.5) :
+        pool(pool),
+        initial_size(initial_size > minimum_lane_size ? initial_size : minimum_lane_size),
+        growth_factor(growth_factor),
+        lane_end(nullptr, 0)
+    {
+        for (auto &slot : lane)
+            slot = nullptr;
+    }
+
+    /*
+    	LANED_DYNAMIC_ARRAY::BEGIN()
+    	----------------------------
+    */
+    /*!
+    	@brief Return an iterator pointing to the start of the array.
+    	@return Iterator pointing to start of array.
+    */
+    iterator begin(void) const
+    {
+        return iterator(this, 0);
+    }
+
+    /*
+    	LANED_DYNAMIC_ARRAY::END()
+    	--------------------------
+    */
+    /*!
+    	@brief Return an iterator pointing to the end of the array.
+    	@return Iterator pointing to end of array.
+    */
+    iterator end(void) const
+    {
+        return iterator(this, LANES);
+    }
+
+    /*
+    	LANED_DYNAMIC_ARRAY::PUSH_BACK()
+    	--------------------------------
+    */
+    /*!
+    	@brief Add an element to the end of the calling thread's lane.
+    	@param element [in] The element to add.
+    */
+    void push_back(const TYPE &element)
+    {
+        this_threads_lane().push_back(element);
+    }
+
+    /*
+    	LANED_DYNAMIC_ARRAY::SIZE()
+    	---------------------------
+    */
+    /*!
+    	@brief Return the number of elements in the array (in all lanes).
+    	@return The number of elements.
+    */
+    size_t size(void) const
+    {
+        size_t elements = 0;
+
+        for (const auto &slot : lane)
+            if (slot.load() != nullptr)
+                elements += slot.load()->size();
+
+        return elements;
+    }
+
+    /*
+    	LANED_DYNAMIC_ARRAY::ORDERED()
+    	------------------------------
+    */
+    /*!
+    	@brief Visit every element in sorted order by merging the lanes, each of which must already be sorted.
+    	@param visit [in] Called with each element in turn.
+    	@param compare [in] The less-than comparison the lanes are sorted by.
+    */
+    template <typename FUNCTION, typename COMPARE = std::less<TYPE>>
+    void ordered(FUNCTION &&visit, COMPARE compare = COMPARE()) const
+    {
+        typedef std::pair<typename lane_type::iterator, size_t> source;		// where we are in a lane, and which lane
+
+        /*
+        	A min-heap of the lanes, ordered by their current element
+        */
+        std::vector<source> heap;
+        for (size_t which = 0; which < LANES; which++)
+            if (lane[which].load() != nullptr)
+            {
+                typename lane_type::iterator from = lane[which].load()->begin();
+                if (from != lane_end)
+                    heap.emplace_back(std::move(from), which);
+            }
+
+        auto later = [&compare](const source &first, const source &second) { return compare(*second.first, *first.first); };
+        std::make_heap(heap.begin(), heap.end(), later);
+
+        while (!heap.empty())
+        {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            source &smallest = heap.back();
+            visit(*smallest.first);
+            ++smallest.first;
+            if (smallest.first != lane_end)
+                std::push_heap(heap.begin(), heap.end(), later);
+            else
+                heap.pop_back();
+        }
+    }
+};
+}
@@ -1,3 +1,4 @@
+#include <functional>
 #include <memory>
 #include <mutex>
 
@@ -689,5 +690,17 @@ std::ostream& stream(level_t level)
     return logger_ctx::instance().stream(level);
 }
 
+void dump_recorded(level_t level)
+{
+    if (!enabled(level) || !flight_recorder::recording(FATAL))
+    {
+        return; // nowhere to dump to or nothing recorded
+    }
+
+    auto* out = output(level);
+    std::fflush(out); // so that the dump follows what was logged before
+    flight_recorder::dump(fileno(out));
+}
+
 }
 }
\ No newline at end of file
@@ -13,9 +13,12 @@
 
 #pragma once
 
+#include <cstdio>
 #include <string>
 #include <iostream>
 
+#include "flight_recorder.hpp"
+
 namespace deepfabric
 {
 namespace logger
@@ -39,6 +42,23 @@ void output_le(level_t level, FILE* out); // nullptr == /dev/null
 void stack_trace(level_t level);
 void stack_trace(level_t level, const std::exception_ptr& eptr);
 std::ostream& stream(level_t level);
+void dump_recorded(level_t level); // dumps the flight recorder to output(level), if anything is recorded
+
+// records and/or outputs an FRMT_* call ('line_format' is "%s: %s:%u " format "\n"), so that
+// its arguments are evaluated once whatever is done with them
+template<typename... Args>
+void log_recorded(const flight_recorder::site& where, const char* line_format, const Args&... args)
+{
+    const level_t level = level_t(where.level);
+    if (flight_recorder::recording(level))
+    {
+        flight_recorder::record(where, args...);
+    }
+    if (enabled(level))
+    {
+        std::fprintf(output(level), line_format, where.prefix, where.file, where.line, args...);
+    }
+}
 
 }
 }
@@ -50,15 +70,26 @@ inline __attribute__ ((always_inline)) constexpr deepfabric::logger::level_t exc
 
 #define LOG_FORMATED(level, prefix, format, ...) \
   std::fprintf(::deepfabric::logger::output(level), "%s: %s:%u " format "\n", prefix, __FILE__, __LINE__, __VA_ARGS__)
+
+// formats only if 'level' is output, and also records it if the flight recorder records 'level'
+// (the unevaluated sizeof keeps the compiler checking the arguments against the format)
+#define LOG_RECORDED(level, prefix, format, ...) \
+  do { \
+    static const ::deepfabric::flight_recorder::site flight_recorder_site = { level, prefix, __FILE__, __LINE__, format }; \
+    (void)sizeof(std::printf(format, __VA_ARGS__)); \
+    if (::deepfabric::flight_recorder::recording(level) || ::deepfabric::logger::enabled(level)) \
+      ::deepfabric::logger::log_recorded(flight_recorder_site, "%s: %s:%u " format "\n", __VA_ARGS__); \
+  } while (0)
+
 #define LOG_STREM(level, prefix) \
   ::deepfabric::logger::stream(level) << prefix << " " << __FILE__ << ":" << __LINE__ << " "
 
-#define FRMT_FATAL(format, ...) LOG_FORMATED(::deepfabric::logger::FATAL, "FATAL", format, __VA_ARGS__)
-#define FRMT_ERROR(format, ...) LOG_FORMATED(::deepfabric::logger::ERROR, "ERROR", format, __VA_ARGS__)
-#define FRMT_WARN(format, ...) LOG_FORMATED(::deepfabric::logger::WARN, "WARN", format, __VA_ARGS__)
-#define FRMT_INFO(format, ...) LOG_FORMATED(::deepfabric::logger::INFO, "INFO", format, __VA_ARGS__)
-#define FRMT_DEBUG(format, ...) LOG_FORMATED(::deepfabric::logger::DEBUG, "DEBUG", format, __VA_ARGS__)
-#define FRMT_TRACE(format, ...) LOG_FORMATED(::deepfabric::logger::TRACE, "TRACE", format, __VA_ARGS__)
+#define FRMT_FATAL(format, ...) LOG_RECORDED(::deepfabric::logger::FATAL, "FATAL", format, __VA_ARGS__)
+#define FRMT_ERROR(format, ...) LOG_RECORDED(::deepfabric::logger::ERROR, "ERROR", format, __VA_ARGS__)
+#define FRMT_WARN(format, ...) LOG_RECORDED(::deepfabric::logger::WARN, "WARN", format, __VA_ARGS__)
+#define FRMT_INFO(format, ...) LOG_RECORDED(::deepfabric::logger::INFO, "INFO", format, __VA_ARGS__)
+#define FRMT_DEBUG(format, ...) LOG_RECORDED(::deepfabric::logger::DEBUG, "DEBUG", format, __VA_ARGS__)
+#define FRMT_TRACE(format, ...) LOG_RECORDED(::deepfabric::logger::TRACE, "TRACE", format, __VA_ARGS__)
 
 #define STRM_FATAL() LOG_STREM(::deepfabric::logger::FATAL, "FATAL")
 #define STRM_ERROR() LOG_STREM(::deepfabric::logger::ERROR, "ERROR")
@@ -68,8 +99,11 @@ inline __attribute__ ((always_inline)) constexpr deepfabric::logger::level_t exc
 #define STRM_TRACE() LOG_STREM(::deepfabric::logger::TRACE, "TRACE")
 
 #define EXCEPTION() \
-  LOG_FORMATED(exception_stack_trace_level(), "EXCEPTION", "@%s\nstack trace:", __FUNCTION__); \
-  ::deepfabric::logger::stack_trace(exception_stack_trace_level(), std::current_exception());
+  do { \
+    LOG_FORMATED(exception_stack_trace_level(), "EXCEPTION", "@%s\nstack trace:", __FUNCTION__); \
+    ::deepfabric::logger::stack_trace(exception_stack_trace_level(), std::current_exception()); \
+    ::deepfabric::logger::dump_recorded(exception_stack_trace_level()); \
+  } while (0)
 #define STACK_TRACE() \
   LOG_FORMATED(exception_stack_trace_level(), "STACK_TRACE", "@%s\nstack trace:", __FUNCTION__); \
   ::deepfabric::logger::stack_trace(exception_stack_trace_level());
@@ -0,0 +1,303 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace deepfabric
+{
+/*
+	CLASS LOSER_TREE
+	----------------
+*/
+/*!
+	@brief k-way merge of sorted sequences using a tournament tree of losers.
+	@details Each internal node of the tree holds the source that lost the match played there and the overall winner (the source
+	with the smallest current element) is held above the root.  Taking the smallest element and advancing its source then replays
+	only the matches on the path from that source to the root, which is exactly log2(k) comparisons (a binary heap needs about
+	twice that).  The replay loop has no data-dependent branches, the winner of each match is selected rather than branched on.
+
+	Exhausted sources (and the padding that rounds k up to a power of 2) act as sentinels that lose every match, so there is no
+	special case for a source running dry.  Ties go to the source added first, so the merge is stable.
+
+	Sources are pairs of iterators that need only support !=, * and prefix ++, so dynamic_array, compressed_dynamic_array, and
+	the like can be merged as well as standard containers.  The current element of each source is copied into the tree, so
+	VALUE should be cheap to copy.
+	@tparam ITERATOR The type of iterator over each sorted source.
+	@tparam VALUE The type of the elements.
+	@tparam COMPARE The less-than comparison the sources are sorted by.
+*/
+template <typename ITERATOR, typename VALUE = typename std::decay<decltype(*std::declval<ITERATOR &>())>::type, typename COMPARE = std::less<VALUE>>
+class loser_tree
+{
+protected:
+    /*
+    	CLASS LOSER_TREE::SOURCE
+    	------------------------
+    */
+    /*!
+    	@brief One of the sequences being merged.
+    */
+    class source
+    {
+    public:
+        ITERATOR at;					///< The current position in the sequence.
+        ITERATOR end;					///< The end of the sequence.
+
+    public:
+        source(ITERATOR begin, ITERATOR end) :
+            at(std::move(begin)),
+            end(std::move(end))
+        {
+        }
+    };
+
+protected:
+    COMPARE compare;					///< The less-than comparison.
+    std::vector<source> sources;		///< The sequences being merged.
+    size_t leaves;						///< The number of leaves of the tree (sources.size() rounded up to a power of 2).
+    std::vector<VALUE> key;				///< The current element of each source (each leaf).
+    std::vector<uint8_t> exhausted;		///< Non-zero if the leaf is a sentinel (the source is exhausted or there is no source for the leaf).
+    std::vector<size_t> tree;			///< tree[0] is the winner, tree[1..leaves - 1] are the losers of the match at each internal node.
+    bool built;							///< Has the tree been built yet?
+
+protected:
+    /*
+    	LOSER_TREE::BEATS()
+    	-------------------
+    */
+    /*!
+    	@brief Does leaf first win the match against leaf second?
+    	@details Sentinels lose to everything, ties go to the lower numbered leaf.  This costs a second comparison, but for the cheap
+    	comparisons this is intended for that is far less than a mispredicted branch.
+    */
+    bool beats(size_t first, size_t second) const
+    {
+        /*
+        	Computed with bitwise operations (not && and ||) so that the compiler selects rather than branches
+        */
+        unsigned first_less = compare(key[first], key[second]);
+        unsigned second_less = compare(key[second], key[first]);
+        unsigned first_wins = first_less | ((second_less ^ 1) & (first < second));
+
+        return exhausted[second] | ((exhausted[first] ^ 1) & first_wins);
+    }
+
+    /*
+    	LOSER_TREE::LOAD()
+    	------------------
+    */
+    /*!
+    	@brief Copy the current element of a source into its leaf (or mark the leaf as a sentinel if the source is exhausted).
+    */
+    void load(size_t leaf)
+    {
+        source &from = sources[leaf];
+
+        if (from.at != from.end)
+            key[leaf] = *from.at;
+        else
+            exhausted[leaf] = 1;
+    }
+
+    /*
+    	LOSER_TREE::BUILD()
+    	-------------------
+    */
+    /*!
+    	@brief Play every match to fill the tree.
+    */
+    void build(void)
+    {
+        leaves = 1;
+        while (leaves < sources.size())
+            leaves *= 2;
+
+        key.assign(leaves, VALUE());
+        exhausted.assign(leaves, 1);
+        tree.assign(leaves, 0);
+
+        for (size_t leaf = 0; leaf < sources.size(); leaf++)
+        {
+            exhausted[leaf] = 0;
+            load(leaf);
+        }
+
+        /*
+        	Play the matches bottom up, winner[node] is the winner of the match at node (winner[leaves + i] is leaf i)
+        */
+        std::vector<size_t> winner(2 * leaves);
+        for (size_t leaf = 0; leaf < leaves; leaf++)
+            winner[leaves + leaf] = leaf;
+        for (size_t node = leaves - 1; node >= 1; node--)
+        {
+            size_t left = winner[2 * node];
+            size_t right = winner[2 * node + 1];
+            bool left_wins = beats(left, right);
+            winner[node] = left_wins ? left : right;
+            tree[node] = left_wins ? right : left;
+        }
+        tree[0] = winner[1];		// with one leaf this is the leaf itself
+
+        built = true;
+    }
+
+    /*
+    	LOSER_TREE::REPLAY()
+    	--------------------
+    */
+    /*!
+    	@brief The current element of the winner has changed so replay the matches from its leaf to the root.
+    */
+    void replay(void)
+    {
+        size_t winner = tree[0];
+
+        for (size_t node = (leaves + winner) / 2; node >= 1; node /= 2)
+        {
+            size_t loser = tree[node];
+            size_t swap = (loser ^ winner) & (0 - (size_t)beats(loser, winner));		// all ones in the mask if the loser wins
+            tree[node] = loser ^ swap;
+            winner ^= swap;
+        }
+
+        tree[0] = winner;
+    }
+
+public:
+    /*
+    	LOSER_TREE::LOSER_TREE()
+    	------------------------
+    */
+    /*!
+    	@brief Constructor.
+    	@param compare [in] The less-than comparison the sources are sorted by.
+    */
+    explicit loser_tree(COMPARE compare = COMPARE()) :
+        compare(compare),
+        leaves(0),
+        built(false)
+    {
+    }
+
+    /*
+    	LOSER_TREE::ADD()
+    	-----------------
+    */
+    /*!
+    	@brief Add a sorted sequence to merge.  All sources must be added before the first call to empty(), top(), pop() or merge_into().
+    	@param begin [in] The start of the sequence.
+    	@param end [in] The end of the sequence.
+    */
+    void add(ITERATOR begin, ITERATOR end)
+    {
+        sources.emplace_back(std::move(begin), std::move(end));
+    }
+
+    /*
+    	LOSER_TREE::EMPTY()
+    	-------------------
+    */
+    /*!
+    	@brief Have all the sources been exhausted?
+    */
+    bool empty(void)
+    {
+        if (!built)
+            build();
+        return exhausted[tree[0]] != 0;
+    }
+
+    /*
+    	LOSER_TREE::TOP()
+    	-----------------
+    */
+    /*!
+    	@brief Return the smallest current element (undefined if empty()).
+    */
+    const VALUE &top(void)
+    {
+        if (!built)
+            build();
+        return key[tree[0]];
+    }
+
+    /*
+    	LOSER_TREE::TOP_SOURCE()
+    	------------------------
+    */
+    /*!
+    	@brief Return the index (in the order added) of the source of top().
+    */
+    size_t top_source(void)
+    {
+        if (!built)
+            build();
+        return tree[0];
+    }
+
+    /*
+    	LOSER_TREE::POP()
+    	-----------------
+    */
+    /*!
+    	@brief Move past the smallest element (undefined if empty()).
+    */
+    void pop(void)
+    {
+        if (!built)
+            build();
+
+        source &from = sources[tree[0]];
+        ++from.at;
+        load(tree[0]);
+        replay();
+    }
+
+    /*
+    	LOSER_TREE::MERGE_INTO()
+    	------------------------
+    */
+    /*!
+    	@brief Write all the remaining elements, in order, to an output iterator.
+    	@param into [in] Where to write.
+    	@return The output iterator after the last element written.
+    */
+    template <typename OUTPUT>
+    OUTPUT merge_into(OUTPUT into)
+    {
+        if (!built)
+            build();
+
+        while (exhausted[tree[0]] == 0)
+        {
+            size_t winner = tree[0];
+            source &from = sources[winner];
+            *into = key[winner];
+            ++into;
+            ++from.at;
+            load(winner);
+            replay();
+        }
+
+        return into;
+    }
+};
+}
@@ -0,0 +1,364 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+namespace deepfabric
+{
+/*
+	CLASS MAPPED_DYNAMIC_ARRAY
+	--------------------------
+*/
+/*!
+	@brief Grow-only array of fixed-size records that lives in a memory-mapped file and so survives restarts.
+	@details The file is a one-page header followed by the records.  A large range of address space (reserve_bytes)
+	is mapped when the file is opened and the file is grown into it with ftruncate() as records are appended, so appending never
+	moves the records and a pointer to a record remains valid.  Only if the reservation is used up is the file re-mapped (which
+	can move it, invalidating pointers and iterators just as std::vector does when it reallocates).
+
+	Records are written straight into the page cache.  sync() is the durability point: it flushes the records then writes the
+	number of records to the header and flushes that, so after a crash the file is re-opened with every record up to the last
+	sync() (and possibly some after).  Re-opening is O(1) as the number of records is read from the header.
+
+	Unlike dynamic_array this class is NOT thread-safe, it is intended for a single writer (for example, an append-only log).
+	@tparam TYPE The array is an array of this type (which must be trivially copyable).
+*/
+template <typename TYPE>
+class mapped_dynamic_array
+{
+    static_assert(std::is_trivially_copyable<TYPE>::value, "mapped_dynamic_array records must be trivially copyable");
+
+public:
+    typedef TYPE *iterator;								///< The records are contiguous, so a pointer is an iterator.
+    typedef const TYPE *const_iterator;					///< The records are contiguous, so a pointer is an iterator.
+
+protected:
+    static const size_t header_size = 4096;				///< The size (in bytes) of the header at the start of the file (a page, so the records are page aligned).
+    static const uint64_t file_magic = 0x59415252414D4544ULL;	///< "DEMARRAY" (little endian), the first 8 bytes of the file.
+    static const size_t default_reserve = (size_t)1 << 36;		///< The default amount of address space (in bytes) to reserve for the records.
+    static const size_t minimum_growth = (size_t)1 << 20;		///< The file grows by at least this many bytes at a time.
+
+    /*
+    	CLASS MAPPED_DYNAMIC_ARRAY::HEADER
+    	----------------------------------
+    */
+    /*!
+    	@brief The start of the file.
+    */
+    class header
+    {
+    public:
+        uint64_t magic;					///< Always file_magic.
+        uint64_t element_size;			///< sizeof(TYPE) of the array that wrote the file.
+        uint64_t elements;				///< The number of records as of the last sync().
+    };
+
+protected:
+    int file;							///< The file descriptor of the open file.
+    uint8_t *base;						///< The start of the mapping (the header).
+    size_t reserved;					///< The size (in bytes) of the mapping.
+    size_t file_size;					///< The size (in bytes) of the file.
+    size_t used;						///< The number of records in the array.
+    size_t synced;						///< The number of records that were in the array at the last sync().
+
+private:
+    /*
+    	MAPPED_DYNAMIC_ARRAY::MAPPED_DYNAMIC_ARRAY()
+    	--------------------------------------------
+    */
+    /*!
+    	@brief Private copy constructor prevents object copying
+    */
+    mapped_dynamic_array(const mapped_dynamic_array &) = delete;
+
+    /*
+    	MAPPED_DYNAMIC_ARRAY::OPERATOR=()
+    	---------------------------------
+    */
+    /*!
+    	@brief Private assignment operator prevents assigning to this object
+    */
+    mapped_dynamic_array &operator=(const mapped_dynamic_array &) = delete;
+
+protected:
+    /*
+    	MAPPED_DYNAMIC_ARRAY::HEAD()
+    	----------------------------
+    */
+    /*!
+    	@brief Return the header at the start of the file.
+    */
+    header *head(void) const
+    {
+        return (header *)base;
+    }
+
+    /*
+    	MAPPED_DYNAMIC_ARRAY::DATA()
+    	----------------------------
+    */
+    /*!
+    	@brief Return a pointer to the first record.
+    */
+    TYPE *data(void) const
+    {
+        return (TYPE *)(base + header_size);
+    }
+
+    /*
+    	MAPPED_DYNAMIC_ARRAY::FAIL()
+    	----------------------------
+    */
+    /*!
+    	@brief Throw a std::system_error describing the failure of the last system call.
+    	@param what [in] What was being done.
+    */
+    [[noreturn]] static void fail(const char *what)
+    {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    /*
+    	MAPPED_DYNAMIC_ARRAY::GROW()
+    	----------------------------
+    */
+    /*!
+    	@brief Make the file (and if necessary the mapping) large enough to hold at least one more record.
+    */
+    void grow(void)
+    {
+        size_t wanted = file_size + (file_size / 2 > minimum_growth ? file_size / 2 : minimum_growth);
+
+        /*
+        	If the reservation is used up then re-map (this may move the records)
+        */
+        if (wanted > reserved)
+        {
+            size_t bigger = reserved * 2 > wanted ? reserved * 2 : wanted;
+            void *mapping = mremap(base, reserved, bigger, MREMAP_MAYMOVE);
+            if (mapping == MAP_FAILED)
+                fail("mapped_dynamic_array: mremap");
+            base = (uint8_t *)mapping;
+            reserved = bigger;
+        }
+
+        if (ftruncate(file, wanted) != 0)
+            fail("mapped_dynamic_array: ftruncate");
+        file_size = wanted;
+    }
+
+public:
+    /*
+    	MAPPED_DYNAMIC_ARRAY::MAPPED_DYNAMIC_ARRAY()
+    	--------------------------------------------
+    */
+    /*!
+    	@brief Constructor.  Open (or create) the file and map it.
+    	@details Throws std::system_error if the file cannot be opened or mapped, and std::runtime_error if the file is not a
+    	mapped_dynamic_array of records of this size.
+    	@param filename [in] The name of the file.
+    	@param reserve_bytes [in] The amount of address space (in bytes) to reserve for the records.
+    */
+    explicit mapped_dynamic_array(const char *filename, size_t reserve_bytes = default_reserve) :
+        file(-1),
+        base(nullptr),
+        reserved(0),
+        file_size(0),
+        used(0),
+        synced(0)
+    {
+        if ((file = open(filename, O_RDWR | O_CREAT, 0644)) < 0)
+            fail("mapped_dynamic_array: open");
+
+        struct stat details;
+        if (fstat(file, &details) != 0)
+        {
+            close(file);
+            fail("mapped_dynamic_array: fstat");
+        }
+
+        /*
+        	A new file gets an empty header
+        */
+        bool created = details.st_size == 0;
+        file_size = created ? header_size : details.st_size;
+        if (created && ftruncate(file, file_size) != 0)
+        {
+            close(file);
+            fail("mapped_dynamic_array: ftruncate");
+        }
+
+        reserved = header_size + reserve_bytes > file_size ? header_size + reserve_bytes : file_size;
+        void *mapping = mmap(nullptr, reserved, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, file, 0);
+        if (mapping == MAP_FAILED)
+        {
+            close(file);
+            fail("mapped_dynamic_array: mmap");
+        }
+        base = (uint8_t *)mapping;
+
+        if (created)
+        {
+            head()->magic = file_magic;
+            head()->element_size = sizeof(TYPE);
+            head()->elements = 0;
+        }
+        else if (file_size < header_size || head()->magic != file_magic || head()->element_size != sizeof(TYPE) || header_size + head()->elements * sizeof(TYPE) > file_size)
+        {
+            munmap(base, reserved);
+            close(file);
+            throw std::runtime_error("mapped_dynamic_array: not an array of records of this type");
+        }
+
+        used = synced = head()->elements;
+    }
+
+    /*
+    	MAPPED_DYNAMIC_ARRAY::~MAPPED_DYNAMIC_ARRAY()
+    	---------------------------------------------
+    */
+    /*!
+    	@brief Destructor.  sync() then close the file.
+    */
+    ~mapped_dynamic_array()
+    {
+        sync();
+        munmap(base, reserved);
+        close(file);
+    }
+
+    /*
+    	MAPPED_DYNAMIC_ARRAY::BEGIN()
+    	-----------------------------
+    */
+    /*!
+    	@brief Return an iterator pointing to the start of the array.
+    	@return Iterator pointing to start of array.
+    */
+    iterator begin(void) const
+    {
+        return data();
+    }
+
+    /*
+    	MAPPED_DYNAMIC_ARRAY::END()
+    	---------------------------
+    */
+    /*!
+    	@brief Return an iterator pointing to the end of the array.
+    	@return Iterator pointing to end of array.
+    */
+    iterator end(void) const
+    {
+        return data() + used;
+    }
+
+    /*
+    	MAPPED_DYNAMIC_ARRAY::BACK()
+    	----------------------------
+    */
+    /*!
+    	@brief Return an reference to the final (used) element in the array.
+    	@return Reference to the last used element in the array.
+    */
+    TYPE &back(void) const
+    {
+        return data()[used - 1];
+    }
+
+    /*
+    	MAPPED_DYNAMIC_ARRAY::SIZE()
+    	----------------------------
+    */
+    /*!
+    	@brief Return the number of records in the array.
+    	@return The number of records.
+    */
+    size_t size(void) const
+    {
+        return used;
+    }
+
+    /*
+    	MAPPED_DYNAMIC_ARRAY::PUSH_BACK()
+    	---------------------------------
+    */
+    /*!
+    	@brief Add an element to the end of the array.  Throws std::system_error if the file cannot be grown.
+    	@param element [in] The element to add.
+    */
+    void push_back(const TYPE &element)
+    {
+        if (header_size + (used + 1) * sizeof(TYPE) > file_size)
+            grow();
+
+        data()[used] = element;
+        used++;
+    }
+
+    /*
+    	MAPPED_DYNAMIC_ARRAY::OPERATOR[]()
+    	----------------------------------
+    */
+    /*!
+    	@brief Return a reference to the given element (counting from 0).  Unlike dynamic_array this is O(1).
+    	@param element [in] The element to find.
+    */
+    TYPE &operator[](size_t element) const
+    {
+        return data()[element];
+    }
+
+    /*
+    	MAPPED_DYNAMIC_ARRAY::SYNC()
+    	----------------------------
+    */
+    /*!
+    	@brief Durability point: flush the records appended since the last sync() to disk, then record their number in the header and flush that.
+    	@return true on success, false on failure.
+    */
+    bool sync(void)
+    {
+        static const size_t page_size = 4096;
+
+        if (used == synced)
+            return true;
+
+        /*
+        	msync() needs a page-aligned start address
+        */
+        size_t from = (header_size + synced * sizeof(TYPE)) / page_size * page_size;
+        size_t to = header_size + used * sizeof(TYPE);
+        if (msync(base + from, to - from, MS_SYNC) != 0)
+            return false;
+
+        head()->elements = used;
+        if (msync(base, header_size, MS_SYNC) != 0)
+            return false;
+
+        synced = used;
+        return true;
+    }
+};
+}
@@ -0,0 +1,928 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace deepfabric
+{
+/*
+	CLASS MINIMAL_PERFECT_HASH
+	--------------------------
+*/
+/*!
+	@brief Minimal perfect hash function of a frozen key set: maps each of the N keys it was built from to a different number in
+	[0, N), in about 2.7 bits per key, so that a term dictionary or docname table can be a plain array indexed by it.
+	@details This is PTHash (Pibiri and Trani, "PTHash: Revisiting FCH Minimal Perfect Hashing", SIGIR 2021), partitioned.  The keys
+	are hashed (with HASH then a seeded mix) to 64 bits and spread over partitions of about partition_keys keys, each of which is
+	built on its own (in parallel) and takes the numbers from the partition's first.  Within a partition of n keys, the keys are
+	spread over about bucket_density * n / log2(n) buckets, skewed so that 60% of the keys go to the first 30% of the buckets.  Each
+	bucket has a pilot, the first value (found by trial, biggest buckets first) for which the positions (hash of the key XOR hash
+	of the pilot) of the bucket's keys in a table of n / load_factor slots are free.  The slots past n that are used are remapped to
+	the free slots below n.  A lookup is thus a few multiplications and two or three reads: the partition, the pilot and (for 1% of
+	the keys) the remapped slot.
+
+	The pilots are mostly small and repeat a lot, so they are stored as indexes into a dictionary of their distinct values (most
+	frequent first) in as few bits as the dictionary needs, one dictionary for the dense buckets and one for the sparse.
+
+	The function is a flat array of 64-bit words (a header, the partitions, the dictionaries and the bit-packed indexes) that can be
+	saved to a file and used straight from a read-only mapping of it (or from memory holding such an array, e.g. part of a mapped
+	segment), so loading does not read or copy it.
+
+	A key that was not in the set maps to some number in [0, N), so if that matters the key must be checked against the slot it
+	maps to.  Keys whose HASH values are equal cannot be told apart: build() throws std::invalid_argument if it is given any (which
+	includes duplicate keys).
+	@tparam KEY The type of the keys.
+	@tparam HASH The hash function of KEY (its result is mixed, so std::hash of an integer, which is the integer, is fine).
+*/
+template <typename KEY, typename HASH = std::hash<KEY>>
+class minimal_perfect_hash
+{
+public:
+    static constexpr size_t partition_keys = 8192;			///< The average number of keys in a partition.
+    static constexpr double bucket_density = 3.0;			///< The number of buckets of a partition of n keys is bucket_density * n / log2(n).
+    static constexpr double load_factor = 0.99;			///< The number of keys of a partition divided by the size of its table.
+
+protected:
+    static constexpr uint64_t file_magic = 0x48504D484854504DULL;	///< "MPTHHMPH" (little endian), the first 8 bytes of the function.
+    static constexpr uint32_t dense_threshold = 2576980377U;		///< A key is in a dense bucket if the low 32 bits of its bucket hash are below this (60%).
+    static constexpr double dense_fraction = 0.3;					///< The fraction of the buckets that are dense.
+    static constexpr uint32_t max_pilot = 1U << 24;					///< The build starts over with another seed if a bucket needs a bigger pilot.
+    static constexpr int max_attempts = 8;							///< The number of seeds to try before giving up.
+
+    /*
+    	CLASS MINIMAL_PERFECT_HASH::HEADER
+    	----------------------------------
+    */
+    /*!
+    	@brief The start of the function.  The "at" members are offsets (in 64-bit words) from the start of the header.
+    */
+    class header
+    {
+    public:
+        uint64_t magic;					///< Always file_magic.
+        uint64_t seed;					///< The seed of the key hash.
+        uint64_t keys;					///< N.
+        uint64_t partitions;			///< The number of partitions.
+        uint64_t dense_width;			///< The width (in bits) of a dense bucket's dictionary index.
+        uint64_t sparse_width;			///< The width (in bits) of a sparse bucket's dictionary index.
+        uint64_t remap_width;			///< The width (in bits) of a remapped slot.
+        uint64_t dense_pilots;			///< The number of entries in the dense dictionary.
+        uint64_t sparse_pilots;			///< The number of entries in the sparse dictionary.
+        uint64_t partitions_at;			///< Where the partitions are.
+        uint64_t dense_dictionary_at;	///< Where the dense dictionary is (uint32_t pilots).
+        uint64_t sparse_dictionary_at;	///< Where the sparse dictionary is (uint32_t pilots).
+        uint64_t dense_index_at;		///< Where the dense buckets' dictionary indexes are (bit-packed).
+        uint64_t sparse_index_at;		///< Where the sparse buckets' dictionary indexes are (bit-packed).
+        uint64_t remap_at;				///< Where the remapped slots are (bit-packed).
+        uint64_t words;					///< The size of the function (in 64-bit words).
+    };
+
+    /*
+    	CLASS MINIMAL_PERFECT_HASH::PARTITION
+    	-------------------------------------
+    */
+    /*!
+    	@brief What a lookup needs to know about a partition.
+    */
+    class partition
+    {
+    public:
+        uint64_t first;					///< The number of keys in the partitions before this one (the number of its first key).
+        uint64_t dense_first;			///< The number of dense buckets in the partitions before this one.
+        uint64_t sparse_first;			///< The number of sparse buckets in the partitions before this one.
+        uint64_t remap_first;			///< The number of remapped slots in the partitions before this one.
+        uint32_t keys;					///< The number of keys in this partition.
+        uint32_t table_size;			///< The number of slots of its table.
+        uint32_t dense_buckets;			///< The number of its dense buckets.
+        uint32_t sparse_buckets;		///< The number of its sparse buckets.
+    };
+
+    /*
+    	CLASS MINIMAL_PERFECT_HASH::BUILT
+    	---------------------------------
+    */
+    /*!
+    	@brief A partition as built, before its pilots are encoded.
+    */
+    class built
+    {
+    public:
+        std::vector<uint32_t> pilots;	///< The pilot of each bucket, dense then sparse.
+        std::vector<uint32_t> remap;	///< The slot below keys that each slot from keys up is remapped to.
+    };
+
+protected:
+    std::vector<uint64_t> storage;		///< The function, if it was built (rather than loaded or attached).
+    void *mapping;						///< The mapping of the file it was loaded from (or nullptr).
+    size_t mapping_size;				///< The size (in bytes) of mapping.
+    const header *head;					///< The header (or nullptr if there is no function).
+    const partition *parts;				///< The partitions.
+    const uint32_t *dense_dictionary;	///< The distinct pilots of the dense buckets.
+    const uint32_t *sparse_dictionary;	///< The distinct pilots of the sparse buckets.
+    const uint64_t *dense_index;		///< The dense dictionary index of each dense bucket.
+    const uint64_t *sparse_index;		///< The sparse dictionary index of each sparse bucket.
+    const uint64_t *remapped;			///< The remapped slots.
+
+private:
+    minimal_perfect_hash(const minimal_perfect_hash &) = delete;
+    minimal_perfect_hash &operator=(const minimal_perfect_hash &) = delete;
+
+protected:
+    /*
+    	MINIMAL_PERFECT_HASH::MIX()
+    	---------------------------
+    */
+    /*!
+    	@brief Return the MurmurHash3 finalizer of a value (a bijection that spreads every bit of the input over the output).
+    */
+    static uint64_t mix(uint64_t value)
+    {
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccdULL;
+        value ^= value >> 33;
+        value *= 0xc4ceb9fe1a85ec53ULL;
+        value ^= value >> 33;
+        return value;
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::SCALE()
+    	-----------------------------
+    */
+    /*!
+    	@brief Return a (uniform 64-bit) hash scaled to [0, range) without a division.
+    */
+    static uint64_t scale(uint64_t hash, uint64_t range)
+    {
+        return (uint64_t)(((unsigned __int128)hash * range) >> 64);
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::BUCKET_OF()
+    	---------------------------------
+    */
+    /*!
+    	@brief Return the bucket (dense then sparse) of a key in a partition.
+    */
+    static uint32_t bucket_of(uint64_t hash, uint32_t dense_buckets, uint32_t sparse_buckets)
+    {
+        uint64_t bucket_hash = mix(hash + 0x9e3779b97f4a7c15ULL);
+        if ((uint32_t)bucket_hash < dense_threshold || sparse_buckets == 0)
+            return ((bucket_hash >> 32) * dense_buckets) >> 32;
+        return dense_buckets + (((bucket_hash >> 32) * sparse_buckets) >> 32);
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::SLOT_OF()
+    	-------------------------------
+    */
+    /*!
+    	@brief Return the slot of a key in its partition's table, given the pilot_hash() of its bucket's pilot.  The XOR is mixed
+    	before it is scaled, as otherwise two keys whose hashes differ only in their low bits would collide whatever the pilot.
+    */
+    static uint64_t slot_of(uint64_t hash, uint64_t pilot_hash, uint32_t table_size)
+    {
+        return scale(mix(hash ^ pilot_hash), table_size);
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::PILOT_HASH()
+    	----------------------------------
+    */
+    /*!
+    	@brief Return the hash of a pilot.
+    */
+    static uint64_t pilot_hash(uint32_t pilot)
+    {
+        return mix(pilot + 0xd6e8feb86659fd93ULL);
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::READ_BITS()
+    	---------------------------------
+    */
+    /*!
+    	@brief Return the width-bit value at a bit offset of a bit-packed array (whose last word is followed by a spare one).
+    */
+    static uint64_t read_bits(const uint64_t *words, uint64_t at, uint64_t width)
+    {
+        uint64_t word = at / 64;
+        uint64_t shift = at % 64;
+        uint64_t value = words[word] >> shift;
+        if (shift + width > 64)
+            value |= words[word + 1] << (64 - shift);
+        return value & ((1ULL << width) - 1);
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::WRITE_BITS()
+    	----------------------------------
+    */
+    /*!
+    	@brief Store a width-bit value at a bit offset of a (zeroed) bit-packed array.
+    */
+    static void write_bits(uint64_t *words, uint64_t at, uint64_t width, uint64_t value)
+    {
+        uint64_t word = at / 64;
+        uint64_t shift = at % 64;
+        words[word] |= value << shift;
+        if (shift + width > 64)
+            words[word + 1] |= value >> (64 - shift);
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::WIDTH_OF()
+    	--------------------------------
+    */
+    /*!
+    	@brief Return the number of bits needed to store the numbers below a count.
+    */
+    static uint64_t width_of(uint64_t count)
+    {
+        return count <= 1 ? 0 : 64 - __builtin_clzll(count - 1);
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::DIMENSION()
+    	---------------------------------
+    */
+    /*!
+    	@brief Set the table size and bucket counts of a partition of a number of keys.
+    */
+    static void dimension(partition &into, uint32_t keys)
+    {
+        into.keys = keys;
+        into.table_size = keys == 0 ? 0 : std::max(keys, (uint32_t)std::ceil(keys / load_factor));
+        uint32_t buckets = keys == 0 ? 0 : (uint32_t)std::ceil(bucket_density * keys / std::log2(std::max(keys, 4U)));
+        into.dense_buckets = keys == 0 ? 0 : std::max(1U, (uint32_t)std::ceil(dense_fraction * buckets));
+        into.sparse_buckets = buckets > into.dense_buckets ? buckets - into.dense_buckets : 0;
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::BUILD_PARTITION()
+    	---------------------------------------
+    */
+    /*!
+    	@brief Find the pilots of a partition.
+    	@param shape [in] The partition's table size and bucket counts.
+    	@param hashes [in] The partition's key hashes (sorted into order).
+    	@param into [out] The pilots and remapped slots.
+    	@param scratch [in] Space to work in (reused across calls).
+    	@return false if a pilot could not be found (so another seed is needed).
+    */
+    static bool build_partition(const partition &shape, const uint64_t *hashes, built &into, std::vector<uint64_t> &scratch)
+    {
+        uint32_t buckets = shape.dense_buckets + shape.sparse_buckets;
+        into.pilots.assign(buckets, 0);
+        into.remap.assign(shape.table_size - shape.keys, 0);
+
+        /*
+        	Sort the keys by bucket (the bucket in the top 32 bits, the key number below), then the buckets biggest first
+        */
+        scratch.resize(shape.keys);
+        for (uint32_t key = 0; key < shape.keys; key++)
+            scratch[key] = (uint64_t)bucket_of(hashes[key], shape.dense_buckets, shape.sparse_buckets) << 32 | key;
+        std::sort(scratch.begin(), scratch.end());
+
+        std::vector<std::pair<uint32_t, uint32_t>> order;			// (size, start in scratch) of each non-empty bucket
+        for (uint32_t start = 0, end; start < shape.keys; start = end)
+        {
+            for (end = start + 1; end < shape.keys && scratch[end] >> 32 == scratch[start] >> 32; end++)
+                ;	// nothing
+            order.push_back({end - start, start});
+        }
+        std::stable_sort(order.begin(), order.end(), [](const std::pair<uint32_t, uint32_t> &a, const std::pair<uint32_t, uint32_t> &b)
+        {
+            return a.first > b.first;
+        });
+
+        /*
+        	Find each bucket's pilot
+        */
+        std::vector<uint64_t> taken((shape.table_size + 63) / 64, 0);
+        uint64_t slots[64];
+        for (const auto &bucket : order)
+        {
+            const uint64_t *members = &scratch[bucket.second];
+            uint32_t size = bucket.first;
+            if (size > 64)
+                return false;					// a bucket this big means the hash is not working, so try another seed
+            uint32_t pilot;
+            for (pilot = 0; pilot < max_pilot; pilot++)
+            {
+                uint64_t mixed = pilot_hash(pilot);
+                uint32_t placed;
+                for (placed = 0; placed < size; placed++)
+                {
+                    uint64_t slot = slot_of(hashes[(uint32_t)members[placed]], mixed, shape.table_size);
+                    if ((taken[slot / 64] >> (slot % 64)) & 1)
+                        break;
+                    uint32_t other;
+                    for (other = 0; other < placed; other++)
+                        if (slots[other] == slot)
+                            break;
+                    if (other != placed)
+                        break;
+                    slots[placed] = slot;
+                }
+                if (placed == size)
+                    break;
+            }
+            if (pilot == max_pilot)
+                return false;
+            into.pilots[members[0] >> 32] = pilot;
+            for (uint32_t member = 0; member < size; member++)
+                taken[slots[member] / 64] |= 1ULL << (slots[member] % 64);
+        }
+
+        /*
+        	Remap the slots used from keys up to the slots free below keys
+        */
+        uint32_t free_slot = 0;
+        for (uint32_t slot = shape.keys; slot < shape.table_size; slot++)
+            if ((taken[slot / 64] >> (slot % 64)) & 1)
+            {
+                while ((taken[free_slot / 64] >> (free_slot % 64)) & 1)
+                    free_slot++;
+                into.remap[slot - shape.keys] = free_slot++;
+            }
+
+        return true;
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::DICTIONARY_OF()
+    	-------------------------------------
+    */
+    /*!
+    	@brief Return the distinct pilots of the dense (or sparse) buckets of the partitions, most frequent first.
+    */
+    static std::vector<uint32_t> dictionary_of(const std::vector<partition> &shapes, const std::vector<built> &pilots, bool dense)
+    {
+        std::unordered_map<uint32_t, uint64_t> frequency;
+        for (size_t which = 0; which < shapes.size(); which++)
+        {
+            auto from = pilots[which].pilots.begin() + (dense ? 0 : shapes[which].dense_buckets);
+            auto to = pilots[which].pilots.begin() + (dense ? shapes[which].dense_buckets : pilots[which].pilots.size());
+            for (; from != to; from++)
+                frequency[*from]++;
+        }
+
+        std::vector<std::pair<uint64_t, uint32_t>> ranked;
+        for (const auto &entry : frequency)
+            ranked.push_back({entry.second, entry.first});
+        std::sort(ranked.begin(), ranked.end(), [](const std::pair<uint64_t, uint32_t> &a, const std::pair<uint64_t, uint32_t> &b)
+        {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        });
+
+        std::vector<uint32_t> dictionary;
+        for (const auto &entry : ranked)
+            dictionary.push_back(entry.second);
+        return dictionary;
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::ENCODE()
+    	------------------------------
+    */
+    /*!
+    	@brief Lay out the function in storage.
+    */
+    void encode(uint64_t seed, uint64_t keys, const std::vector<partition> &shapes, const std::vector<built> &pilots)
+    {
+        std::vector<uint32_t> dense = dictionary_of(shapes, pilots, true);
+        std::vector<uint32_t> sparse = dictionary_of(shapes, pilots, false);
+
+        header layout;
+        memset(&layout, 0, sizeof(layout));
+        layout.magic = file_magic;
+        layout.seed = seed;
+        layout.keys = keys;
+        layout.partitions = shapes.size();
+        layout.dense_width = width_of(dense.size());
+        layout.sparse_width = width_of(sparse.size());
+        layout.remap_width = 0;
+        for (const auto &shape : shapes)
+            layout.remap_width = std::max(layout.remap_width, width_of(shape.keys));
+        layout.dense_pilots = dense.size();
+        layout.sparse_pilots = sparse.size();
+
+        const partition &last = shapes.back();
+        uint64_t words = sizeof(header) / sizeof(uint64_t);
+        layout.partitions_at = words;
+        words += shapes.size() * sizeof(partition) / sizeof(uint64_t);
+        layout.dense_dictionary_at = words;
+        words += (dense.size() + 1) / 2;
+        layout.sparse_dictionary_at = words;
+        words += (sparse.size() + 1) / 2;
+        layout.dense_index_at = words;
+        words += (last.dense_first + last.dense_buckets) * layout.dense_width / 64 + 1;
+        layout.sparse_index_at = words;
+        words += (last.sparse_first + last.sparse_buckets) * layout.sparse_width / 64 + 1;
+        layout.remap_at = words;
+        words += (last.remap_first + last.table_size - last.keys) * layout.remap_width / 64 + 1;
+        layout.words = words;
+
+        storage.assign(words, 0);
+        memcpy(&storage[0], &layout, sizeof(layout));
+        memcpy(&storage[layout.partitions_at], &shapes[0], shapes.size() * sizeof(partition));
+        if (!dense.empty())
+            memcpy(&storage[layout.dense_dictionary_at], &dense[0], dense.size() * sizeof(uint32_t));
+        if (!sparse.empty())
+            memcpy(&storage[layout.sparse_dictionary_at], &sparse[0], sparse.size() * sizeof(uint32_t));
+
+        std::unordered_map<uint32_t, uint32_t> dense_rank, sparse_rank;
+        for (uint32_t rank = 0; rank < dense.size(); rank++)
+            dense_rank[dense[rank]] = rank;
+        for (uint32_t rank = 0; rank < sparse.size(); rank++)
+            sparse_rank[sparse[rank]] = rank;
+
+        for (size_t which = 0; which < shapes.size(); which++)
+        {
+            const partition &shape = shapes[which];
+            const built &from = pilots[which];
+            for (uint32_t bucket = 0; bucket < shape.dense_buckets; bucket++)
+                write_bits(&storage[layout.dense_index_at], (shape.dense_first + bucket) * layout.dense_width, layout.dense_width, dense_rank[from.pilots[bucket]]);
+            for (uint32_t bucket = 0; bucket < shape.sparse_buckets; bucket++)
+                write_bits(&storage[layout.sparse_index_at], (shape.sparse_first + bucket) * layout.sparse_width, layout.sparse_width, sparse_rank[from.pilots[shape.dense_buckets + bucket]]);
+            for (uint32_t slot = 0; slot < from.remap.size(); slot++)
+                write_bits(&storage[layout.remap_at], (shape.remap_first + slot) * layout.remap_width, layout.remap_width, from.remap[slot]);
+        }
+
+        bind(&storage[0], words * sizeof(uint64_t));
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::VALID()
+    	-----------------------------
+    */
+    /*!
+    	@brief Return true if memory holds a function: its header, its partitions and the extent of each of its arrays are checked
+    	(so that a lookup only reads within the function), which takes time in the number of partitions.  The bit-packed contents
+    	(the dictionary indexes and remapped slots) are not, so a function damaged there gives wrong numbers.
+    */
+    static bool valid(const void *bytes, size_t length)
+    {
+        const header *from = (const header *)bytes;
+        if (((uintptr_t)bytes % sizeof(uint64_t)) != 0 || length < sizeof(header) || from->magic != file_magic)
+            return false;
+
+        /*
+        	The function must fit in length, and each array must fit in the function
+        */
+        uint64_t words = from->words;
+        if (words > length / sizeof(uint64_t) || words < sizeof(header) / sizeof(uint64_t))
+            return false;
+        auto inside = [words](uint64_t at, uint64_t extent)
+        {
+            return at <= words && extent <= words - at;
+        };
+        auto packed_inside = [words, &inside](uint64_t at, uint64_t count, uint64_t width)
+        {
+            return count / 64 <= words && inside(at, count * width / 64 + 1);
+        };
+
+        if (from->dense_width != width_of(from->dense_pilots) || from->sparse_width != width_of(from->sparse_pilots) || from->remap_width > 32)
+            return false;
+        if (from->partitions == 0 || from->partitions > words || !inside(from->partitions_at, from->partitions * sizeof(partition) / sizeof(uint64_t)))
+            return false;
+        if (from->dense_pilots / 2 > words || !inside(from->dense_dictionary_at, (from->dense_pilots + 1) / 2))
+            return false;
+        if (from->sparse_pilots / 2 > words || !inside(from->sparse_dictionary_at, (from->sparse_pilots + 1) / 2))
+            return false;
+
+        /*
+        	The bit-packed arrays are as long as the last partition says, and every partition must lie within them
+        */
+        const partition *parts = (const partition *)((const uint64_t *)bytes + from->partitions_at);
+        const partition &last = parts[from->partitions - 1];
+        if (last.dense_first / 64 > words || last.sparse_first / 64 > words || last.remap_first / 64 > words || last.keys > last.table_size)
+            return false;
+        uint64_t dense_buckets = last.dense_first + last.dense_buckets;
+        uint64_t sparse_buckets = last.sparse_first + last.sparse_buckets;
+        uint64_t remapped_slots = last.remap_first + (last.table_size - last.keys);
+        if (!packed_inside(from->dense_index_at, dense_buckets, from->dense_width) || !packed_inside(from->sparse_index_at, sparse_buckets, from->sparse_width) || !packed_inside(from->remap_at, remapped_slots, from->remap_width))
+            return false;
+
+        for (uint64_t which = 0; which < from->partitions; which++)
+        {
+            const partition &part = parts[which];
+            if (part.keys > part.table_size || part.first > from->keys || part.keys > from->keys - part.first)
+                return false;
+            if (part.dense_first > dense_buckets || part.dense_buckets > dense_buckets - part.dense_first)
+                return false;
+            if (part.sparse_first > sparse_buckets || part.sparse_buckets > sparse_buckets - part.sparse_first)
+                return false;
+            if (part.remap_first > remapped_slots || part.table_size - part.keys > remapped_slots - part.remap_first)
+                return false;
+        }
+
+        return true;
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::BIND()
+    	----------------------------
+    */
+    /*!
+    	@brief Point the members at a function (which must be valid()).
+    */
+    void bind(const void *bytes, size_t length)
+    {
+        const header *from = (const header *)bytes;
+        const uint64_t *words = (const uint64_t *)bytes;
+        head = from;
+        parts = (const partition *)(words + from->partitions_at);
+        dense_dictionary = (const uint32_t *)(words + from->dense_dictionary_at);
+        sparse_dictionary = (const uint32_t *)(words + from->sparse_dictionary_at);
+        dense_index = words + from->dense_index_at;
+        sparse_index = words + from->sparse_index_at;
+        remapped = words + from->remap_at;
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::UNMAP()
+    	-----------------------------
+    */
+    /*!
+    	@brief Drop the function (and the mapping of the file it was loaded from, if it was).
+    */
+    void unmap(void)
+    {
+        if (mapping != nullptr)
+            munmap(mapping, mapping_size);
+        mapping = nullptr;
+        mapping_size = 0;
+        head = nullptr;
+        storage.clear();
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::FAIL()
+    	----------------------------
+    */
+    /*!
+    	@brief Throw a std::system_error describing the failure of the last system call.
+    	@param what [in] What was being done.
+    */
+    [[noreturn]] static void fail(const char *what)
+    {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+public:
+    /*
+    	MINIMAL_PERFECT_HASH::MINIMAL_PERFECT_HASH()
+    	--------------------------------------------
+    */
+    /*!
+    	@brief Constructor.  The function is of no keys until it is built, loaded or attached.
+    */
+    minimal_perfect_hash() :
+        mapping(nullptr),
+        mapping_size(0),
+        head(nullptr)
+    {
+        /*
+        	Nothing
+        */
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::~MINIMAL_PERFECT_HASH()
+    	---------------------------------------------
+    */
+    /*!
+    	@brief Destructor.
+    */
+    ~minimal_perfect_hash()
+    {
+        unmap();
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::BUILD()
+    	-----------------------------
+    */
+    /*!
+    	@brief Build the function of a set of keys.
+    	@details The keys are hashed and the partitions built by a number of threads.  Besides the function, the build needs 16 bytes
+    	per key.  Throws std::invalid_argument if two keys hash equally and std::runtime_error if (improbably) no seed works.
+    	@param begin [in] A random access iterator to the first key.
+    	@param end [in] A random access iterator past the last key.
+    	@param threads [in] The number of threads to build with (0 for one per core).
+    */
+    template <typename ITERATOR>
+    void build(ITERATOR begin, ITERATOR end, size_t threads = 0)
+    {
+        uint64_t keys = end - begin;
+        if (threads == 0)
+            threads = std::max(1U, std::thread::hardware_concurrency());
+        uint64_t partitions = std::max((uint64_t)1, (keys + partition_keys - 1) / partition_keys);
+
+        /*
+        	Run a function of a thread number on each of the threads
+        */
+        auto in_parallel = [threads](const std::function<void(size_t)> &work)
+        {
+            std::vector<std::thread> pool;
+            for (size_t thread = 1; thread < threads; thread++)
+                pool.emplace_back(work, thread);
+            work(0);
+            for (auto &thread : pool)
+                thread.join();
+        };
+
+        std::vector<uint64_t> hashes(keys);
+        std::vector<uint64_t> grouped(keys);
+        std::vector<partition> shapes(partitions);
+        std::vector<built> pilots(partitions);
+
+        for (int attempt = 0; attempt < max_attempts; attempt++)
+        {
+            uint64_t seed = mix(attempt + 0x5851f42d4c957f2dULL);
+
+            /*
+            	Hash the keys and count the keys of each partition (each thread a range of keys)
+            */
+            std::vector<std::vector<uint64_t>> counts(threads, std::vector<uint64_t>(partitions, 0));
+            in_parallel([&](size_t thread)
+            {
+                uint64_t from = keys * thread / threads;
+                uint64_t to = keys * (thread + 1) / threads;
+                for (uint64_t key = from; key < to; key++)
+                {
+                    hashes[key] = mix(HASH()(begin[key]) + seed);
+                    counts[thread][scale(hashes[key], partitions)]++;
+                }
+            });
+
+            /*
+            	Group the hashes by partition, and lay out the partitions
+            */
+            uint64_t first = 0;
+            for (uint64_t which = 0; which < partitions; which++)
+            {
+                uint64_t size = 0;
+                for (size_t thread = 0; thread < threads; thread++)
+                {
+                    uint64_t count = counts[thread][which];
+                    counts[thread][which] = first + size;
+                    size += count;
+                }
+                partition &shape = shapes[which];
+                shape.first = first;
+                dimension(shape, size);
+                shape.dense_first = which == 0 ? 0 : shapes[which - 1].dense_first + shapes[which - 1].dense_buckets;
+                shape.sparse_first = which == 0 ? 0 : shapes[which - 1].sparse_first + shapes[which - 1].sparse_buckets;
+                shape.remap_first = which == 0 ? 0 : shapes[which - 1].remap_first + shapes[which - 1].table_size - shapes[which - 1].keys;
+                first += size;
+            }
+            in_parallel([&](size_t thread)
+            {
+                uint64_t from = keys * thread / threads;
+                uint64_t to = keys * (thread + 1) / threads;
+                for (uint64_t key = from; key < to; key++)
+                    grouped[counts[thread][scale(hashes[key], partitions)]++] = hashes[key];
+            });
+
+            /*
+            	Build the partitions (each thread taking the next one to do)
+            */
+            std::atomic<uint64_t> next(0);
+            std::atomic<bool> duplicate(false), stuck(false);
+            in_parallel([&](size_t thread)
+            {
+                std::vector<uint64_t> scratch;
+                for (uint64_t which; !duplicate && !stuck && (which = next++) < partitions;)
+                {
+                    uint64_t *from = &grouped[0] + shapes[which].first;
+                    uint64_t *to = from + shapes[which].keys;
+                    std::sort(from, to);
+                    if (std::adjacent_find(from, to) != to)
+                        duplicate = true;
+                    else if (!build_partition(shapes[which], from, pilots[which], scratch))
+                        stuck = true;
+                }
+            });
+            if (duplicate)
+                throw std::invalid_argument("minimal_perfect_hash: keys with equal hashes (or duplicate keys)");
+            if (stuck)
+                continue;
+
+            unmap();
+            encode(seed, keys, shapes, pilots);
+            return;
+        }
+        throw std::runtime_error("minimal_perfect_hash: no seed worked");
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::OPERATOR()()
+    	----------------------------------
+    */
+    /*!
+    	@brief Return the number of a key: different for each key of the set, and in [0, size()).  For other keys, any number in
+    	[0, size()).  There must be a function (built, loaded or attached), as there is no number to give otherwise.
+    */
+    uint64_t operator()(const KEY &key) const
+    {
+        assert(head != nullptr);
+
+        uint64_t hash = mix(HASH()(key) + head->seed);
+        const partition &in = parts[scale(hash, head->partitions)];
+        uint32_t bucket = bucket_of(hash, in.dense_buckets, in.sparse_buckets);
+        uint32_t pilot;
+        if (bucket < in.dense_buckets)
+            pilot = dense_dictionary[read_bits(dense_index, (in.dense_first + bucket) * head->dense_width, head->dense_width)];
+        else
+            pilot = sparse_dictionary[read_bits(sparse_index, (in.sparse_first + bucket - in.dense_buckets) * head->sparse_width, head->sparse_width)];
+
+        uint64_t slot = slot_of(hash, pilot_hash(pilot), in.table_size);
+        if (slot >= in.keys)
+            slot = read_bits(remapped, (in.remap_first + slot - in.keys) * head->remap_width, head->remap_width);
+        return in.first + slot;
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::SIZE()
+    	----------------------------
+    */
+    /*!
+    	@brief Return the number of keys (N).
+    */
+    uint64_t size(void) const
+    {
+        return head == nullptr ? 0 : head->keys;
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::SIZE_IN_BYTES()
+    	-------------------------------------
+    */
+    /*!
+    	@brief Return the size of the function (as saved).
+    */
+    size_t size_in_bytes(void) const
+    {
+        return head == nullptr ? 0 : head->words * sizeof(uint64_t);
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::BITS_PER_KEY()
+    	------------------------------------
+    */
+    /*!
+    	@brief Return the size of the function in bits per key.
+    */
+    double bits_per_key(void) const
+    {
+        return size() == 0 ? 0 : 8.0 * size_in_bytes() / size();
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::DATA()
+    	----------------------------
+    */
+    /*!
+    	@brief Return the function as size_in_bytes() bytes, e.g. to write it into a segment and later attach() to it there.
+    */
+    const void *data(void) const
+    {
+        return head;
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::SAVE()
+    	----------------------------
+    */
+    /*!
+    	@brief Write the function to a file.  Throws std::system_error if the file cannot be written.
+    	@param filename [in] The name of the file.
+    */
+    void save(const char *filename) const
+    {
+        int file = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file < 0)
+            fail("minimal_perfect_hash: open");
+        const char *from = (const char *)data();
+        for (size_t left = size_in_bytes(); left > 0;)
+        {
+            ssize_t written = write(file, from, left);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+            {
+                int error = errno;
+                close(file);
+                errno = error;
+                fail("minimal_perfect_hash: write");
+            }
+            from += written;
+            left -= written;
+        }
+        if (close(file) != 0)
+            fail("minimal_perfect_hash: close");
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::LOAD()
+    	----------------------------
+    */
+    /*!
+    	@brief Use the function saved in a file, from a read-only mapping of the file (so pages are read as lookups touch them).
+    	@details Throws std::system_error if the file cannot be opened or mapped, and std::runtime_error if it is not a
+    	minimal_perfect_hash.
+    	@param filename [in] The name of the file.
+    */
+    void load(const char *filename)
+    {
+        int file = open(filename, O_RDONLY);
+        if (file < 0)
+            fail("minimal_perfect_hash: open");
+
+        struct stat details;
+        if (fstat(file, &details) != 0)
+        {
+            close(file);
+            fail("minimal_perfect_hash: fstat");
+        }
+        void *mapped = details.st_size == 0 ? MAP_FAILED : mmap(nullptr, details.st_size, PROT_READ, MAP_SHARED, file, 0);
+        if (mapped == MAP_FAILED)
+        {
+            if (details.st_size == 0)
+                errno = EINVAL;
+            close(file);
+            fail("minimal_perfect_hash: mmap");
+        }
+        close(file);
+
+        if (!valid(mapped, details.st_size))
+        {
+            munmap(mapped, details.st_size);
+            throw std::runtime_error("minimal_perfect_hash: not a minimal perfect hash function");
+        }
+        unmap();
+        bind(mapped, details.st_size);
+        mapping = mapped;
+        mapping_size = details.st_size;
+    }
+
+    /*
+    	MINIMAL_PERFECT_HASH::ATTACH()
+    	------------------------------
+    */
+    /*!
+    	@brief Use the function in memory (as written by save() or from data()), which must be 8-byte aligned and outlive the use.
+    	@return false if it is not a minimal_perfect_hash (in which case the function is unchanged).
+    */
+    bool attach(const void *bytes, size_t length)
+    {
+        if (!valid(bytes, length))
+            return false;
+        unmap();
+        bind(bytes, length);
+        return true;
+    }
+};
+
+template <typename KEY, typename HASH> constexpr size_t minimal_perfect_hash<KEY, HASH>::partition_keys;
+template <typename KEY, typename HASH> constexpr double minimal_perfect_hash<KEY, HASH>::bucket_density;
+template <typename KEY, typename HASH> constexpr double minimal_perfect_hash<KEY, HASH>::load_factor;
+template <typename KEY, typename HASH> constexpr uint64_t minimal_perfect_hash<KEY, HASH>::file_magic;
+template <typename KEY, typename HASH> constexpr uint32_t minimal_perfect_hash<KEY, HASH>::dense_threshold;
+template <typename KEY, typename HASH> constexpr double minimal_perfect_hash<KEY, HASH>::dense_fraction;
+template <typename KEY, typename HASH> constexpr uint32_t minimal_perfect_hash<KEY, HASH>::max_pilot;
+template <typename KEY, typename HASH> constexpr int minimal_perfect_hash<KEY, HASH>::max_attempts;
+}
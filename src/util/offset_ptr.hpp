@@ -0,0 +1,190 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace deepfabric
+{
+/*
+	CLASS OFFSET_PTR
+	----------------
+*/
+/*!
+	@brief A pointer that stores the distance from itself to the object it points to, so that it remains valid when the memory
+	it lives in is moved, written to disk, or mapped at a different address.
+	@details An offset_ptr and the object it points to must be in the same relocatable block of memory (for example, both
+	allocated from the same arena_pool), otherwise the offset is meaningless after relocation.  Copying an offset_ptr
+	re-computes the offset so the copy points to the same object, which means an offset_ptr is not trivially copyable and
+	cannot be placed in std::atomic<>.
+
+	As the distance 1 can never be the distance to a properly aligned object from a pointer, it is used to represent nullptr
+	(which leaves 0, the very common "points to the start of the same object", efficient).
+	@tparam TYPE The type of the object pointed to.
+*/
+template <typename TYPE>
+class offset_ptr
+{
+protected:
+    static constexpr ptrdiff_t null_offset = 1;		///< The offset used to represent nullptr.
+
+protected:
+    ptrdiff_t offset;								///< The distance (in bytes) from this to the object pointed to.
+
+protected:
+    /*
+    	OFFSET_PTR::SET()
+    	-----------------
+    */
+    /*!
+    	@brief Point to the given object.
+    	@param pointer [in] The object to point to (or nullptr).
+    */
+    void set(const TYPE *pointer)
+    {
+        offset = pointer == nullptr ? null_offset : (const uint8_t *)pointer - (const uint8_t *)this;
+    }
+
+public:
+    /*
+    	OFFSET_PTR::OFFSET_PTR()
+    	------------------------
+    */
+    /*!
+    	@brief Constructor.
+    	@param pointer [in] The object to point to (or nullptr).
+    */
+    offset_ptr(TYPE *pointer = nullptr)
+    {
+        set(pointer);
+    }
+
+    /*
+    	OFFSET_PTR::OFFSET_PTR()
+    	------------------------
+    */
+    /*!
+    	@brief Copy constructor (points to the same object as other).
+    	@param other [in] The offset_ptr to copy.
+    */
+    offset_ptr(const offset_ptr &other)
+    {
+        set(other.get());
+    }
+
+    /*
+    	OFFSET_PTR::OPERATOR=()
+    	-----------------------
+    */
+    /*!
+    	@brief Point to the same object as other.
+    	@param other [in] The offset_ptr to copy.
+    	@return This object.
+    */
+    offset_ptr &operator=(const offset_ptr &other)
+    {
+        set(other.get());
+        return *this;
+    }
+
+    /*
+    	OFFSET_PTR::OPERATOR=()
+    	-----------------------
+    */
+    /*!
+    	@brief Point to the given object.
+    	@param pointer [in] The object to point to (or nullptr).
+    	@return This object.
+    */
+    offset_ptr &operator=(TYPE *pointer)
+    {
+        set(pointer);
+        return *this;
+    }
+
+    /*
+    	OFFSET_PTR::GET()
+    	-----------------
+    */
+    /*!
+    	@brief Return the object pointed to as a native pointer.
+    	@return The object (or nullptr).
+    */
+    TYPE *get(void) const
+    {
+        return offset == null_offset ? nullptr : (TYPE *)((uint8_t *)this + offset);
+    }
+
+    TYPE &operator*() const
+    {
+        return *get();
+    }
+
+    TYPE *operator->() const
+    {
+        return get();
+    }
+
+    TYPE &operator[](size_t element) const
+    {
+        return get()[element];
+    }
+
+    explicit operator bool() const
+    {
+        return offset != null_offset;
+    }
+
+    operator TYPE *() const
+    {
+        return get();
+    }
+
+    /*
+    	OFFSET_PTR::OPERATOR+=()
+    	------------------------
+    */
+    /*!
+    	@brief Move the pointer forward by the given number of objects.
+    	@param elements [in] How far to move.
+    	@return This object.
+    */
+    offset_ptr &operator+=(ptrdiff_t elements)
+    {
+        offset += elements * (ptrdiff_t)sizeof(TYPE);
+        return *this;
+    }
+
+    offset_ptr &operator++()
+    {
+        return *this += 1;
+    }
+
+    offset_ptr &operator--()
+    {
+        return *this += -1;
+    }
+
+    bool operator==(const offset_ptr &other) const
+    {
+        return get() == other.get();
+    }
+
+    bool operator!=(const offset_ptr &other) const
+    {
+        return get() != other.get();
+    }
+};
+}
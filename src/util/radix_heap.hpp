@@ -18,6 +18,7 @@
 #include <climits>
 #include <cstdint>
 #include <limits>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -118,6 +119,133 @@ template<>
 class encoder<float> : public encoder_impl_decimal<float, uint32_t> {};
 template<>
 class encoder<double> : public encoder_impl_decimal<double, uint64_t> {};
+
+// Buckets of a byte-radix heap.  A key that differs from last_ first in byte
+// `level` goes in bucket (level, that byte of the key), so each level has 256
+// buckets and a bitmap of which are non-empty, and level_mask_ has a bit per
+// non-empty level.  The minimum is always in the lowest non-empty bucket of the
+// lowest non-empty level; when that bucket is emptied its entries move to a
+// lower level, so each entry is moved at most once per byte of the key (rather
+// than once per bit as in radix_heap).
+template<typename UnsignedKeyType, typename EntryType, typename KeyOf>
+class byte_radix_buckets {
+ public:
+  typedef UnsignedKeyType unsigned_key_type;
+  typedef EntryType entry_type;
+
+  static constexpr size_t levels = sizeof(unsigned_key_type);
+
+  byte_radix_buckets() : size_(0), last_(), level_mask_(0) {
+    for (auto &bitmap : bitmaps_) bitmap.fill(0);
+  }
+
+  template<class... Args>
+  void emplace(unsigned_key_type x, Args&&... args) {
+    assert(last_ <= x);
+    ++size_;
+    if (x == last_) {
+      equal_.emplace_back(std::forward<Args>(args)...);
+      return;
+    }
+    const size_t level = (find_bucket(x, last_) - 1) >> 3;
+    const size_t byte = (x >> (level * 8)) & 0xFF;
+    buckets_[level][byte].emplace_back(std::forward<Args>(args)...);
+    mark(level, byte);
+  }
+
+  // Make sure the minimum is at the back of equal().
+  void pull() {
+    assert(size_ > 0);
+    if (!equal_.empty()) return;
+
+    const size_t level = __builtin_ctz(level_mask_);
+    std::array<uint64_t, 4> &bitmap = bitmaps_[level];
+    size_t word = 0;
+    while (bitmap[word] == 0) ++word;
+    const size_t byte = word * 64 + __builtin_ctzll(bitmap[word]);
+    std::vector<entry_type> &bucket = buckets_[level][byte];
+
+    unsigned_key_type smallest = KeyOf()(bucket[0]);
+    for (const entry_type &entry : bucket) smallest = std::min(smallest, KeyOf()(entry));
+    last_ = smallest;
+
+    for (entry_type &entry : bucket) {
+      const unsigned_key_type x = KeyOf()(entry);
+      if (x == last_) {
+        equal_.emplace_back(std::move(entry));
+      } else {
+        const size_t lower = (find_bucket(x, last_) - 1) >> 3;
+        const size_t lower_byte = (x >> (lower * 8)) & 0xFF;
+        buckets_[lower][lower_byte].emplace_back(std::move(entry));
+        mark(lower, lower_byte);
+      }
+    }
+    bucket.clear();
+
+    bitmap[word] &= ~(uint64_t(1) << (byte & 63));
+    if ((bitmap[0] | bitmap[1] | bitmap[2] | bitmap[3]) == 0) level_mask_ &= ~(1u << level);
+  }
+
+  void pop() {
+    pull();
+    equal_.pop_back();
+    --size_;
+  }
+
+  unsigned_key_type last() const {
+    return last_;
+  }
+
+  std::vector<entry_type> &equal() {
+    return equal_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  void clear() {
+    size_ = 0;
+    last_ = unsigned_key_type();
+    level_mask_ = 0;
+    equal_.clear();
+    for (auto &level : buckets_)
+      for (auto &bucket : level) bucket.clear();
+    for (auto &bitmap : bitmaps_) bitmap.fill(0);
+  }
+
+  void swap(byte_radix_buckets &a) {
+    std::swap(size_, a.size_);
+    std::swap(last_, a.last_);
+    std::swap(level_mask_, a.level_mask_);
+    equal_.swap(a.equal_);
+    buckets_.swap(a.buckets_);
+    bitmaps_.swap(a.bitmaps_);
+  }
+
+ private:
+  size_t size_;
+  unsigned_key_type last_;
+  uint32_t level_mask_;
+  std::vector<entry_type> equal_;
+  std::array<std::array<std::vector<entry_type>, 256>, levels> buckets_;
+  std::array<std::array<uint64_t, 4>, levels> bitmaps_;
+
+  void mark(size_t level, size_t byte) {
+    bitmaps_[level][byte >> 6] |= uint64_t(1) << (byte & 63);
+    level_mask_ |= 1u << level;
+  }
+};
+
+template<typename UnsignedKeyType>
+struct key_of_key {
+  UnsignedKeyType operator()(UnsignedKeyType x) const { return x; }
+};
+
+template<typename PairType>
+struct key_of_pair {
+  typename PairType::first_type operator()(const PairType &x) const { return x.first; }
+};
 }  // namespace internal
 
 template<typename KeyType, typename EncoderType = internal::encoder<KeyType>>
@@ -304,4 +432,110 @@ class pair_radix_heap {
     buckets_min_[i] = std::numeric_limits<unsigned_key_type>::max();
   }
 };
+
+// Same interface as radix_heap, but with 256-way buckets per byte of the key
+// (see internal::byte_radix_buckets), so keys spanning a wide range are
+// redistributed at most sizeof(key) times rather than once per bit.
+template<typename KeyType, typename EncoderType = internal::encoder<KeyType>>
+class byte_radix_heap {
+ public:
+  typedef KeyType key_type;
+  typedef EncoderType encoder_type;
+  typedef typename encoder_type::unsigned_key_type unsigned_key_type;
+
+  void push(key_type key) {
+    const unsigned_key_type x = encoder_type::encode(key);
+    buckets_.emplace(x, x);
+  }
+
+  key_type top() {
+    buckets_.pull();
+    return encoder_type::decode(buckets_.last());
+  }
+
+  void pop() {
+    buckets_.pop();
+  }
+
+  size_t size() const {
+    return buckets_.size();
+  }
+
+  bool empty() const {
+    return buckets_.size() == 0;
+  }
+
+  void clear() {
+    buckets_.clear();
+  }
+
+  void swap(byte_radix_heap<KeyType, EncoderType> &a) {
+    buckets_.swap(a.buckets_);
+  }
+
+ private:
+  internal::byte_radix_buckets<unsigned_key_type, unsigned_key_type,
+                               internal::key_of_key<unsigned_key_type>> buckets_;
+};
+
+template<typename KeyType, typename ValueType, typename EncoderType = internal::encoder<KeyType>>
+class pair_byte_radix_heap {
+ public:
+  typedef KeyType key_type;
+  typedef ValueType value_type;
+  typedef EncoderType encoder_type;
+  typedef typename encoder_type::unsigned_key_type unsigned_key_type;
+
+  void push(key_type key, const value_type &value) {
+    const unsigned_key_type x = encoder_type::encode(key);
+    buckets_.emplace(x, x, value);
+  }
+
+  void push(key_type key, value_type &&value) {
+    const unsigned_key_type x = encoder_type::encode(key);
+    buckets_.emplace(x, x, std::move(value));
+  }
+
+  template <class... Args>
+  void emplace(key_type key, Args&&... args) {
+    const unsigned_key_type x = encoder_type::encode(key);
+    buckets_.emplace(x, std::piecewise_construct,
+                     std::forward_as_tuple(x), std::forward_as_tuple(args...));
+  }
+
+  key_type top_key() {
+    buckets_.pull();
+    return encoder_type::decode(buckets_.last());
+  }
+
+  value_type &top_value() {
+    buckets_.pull();
+    return buckets_.equal().back().second;
+  }
+
+  void pop() {
+    buckets_.pop();
+  }
+
+  size_t size() const {
+    return buckets_.size();
+  }
+
+  bool empty() const {
+    return buckets_.size() == 0;
+  }
+
+  void clear() {
+    buckets_.clear();
+  }
+
+  void swap(pair_byte_radix_heap<KeyType, ValueType, EncoderType> &a) {
+    buckets_.swap(a.buckets_);
+  }
+
+ private:
+  typedef std::pair<unsigned_key_type, value_type> entry_type;
+  internal::byte_radix_buckets<unsigned_key_type, entry_type,
+                               internal::key_of_pair<entry_type>> buckets_;
+};
 }  // namespace deepfabric
@@ -0,0 +1,210 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "string_pool.hpp"
+
+namespace deepfabric
+{
+constexpr string_pool::id_type string_pool::npos;
+
+/*
+	STRING_POOL::STRING_POOL()
+	--------------------------
+*/
+string_pool::string_pool(allocator_pool &pool, bool null_terminate) :
+    pool(pool),
+    null_terminate(null_terminate),
+    strings(0),
+    string_bytes(0)
+{
+    for (auto &current : segment)
+        current = nullptr;
+}
+
+/*
+	STRING_POOL::HASH()
+	-------------------
+	Multiply-xorshift over 8-byte words, then fold the 64-bit state down to 32 bits.
+*/
+uint32_t string_pool::hash(const char *string, size_t length)
+{
+    static const uint64_t multiplier = 0x9E3779B97F4A7C15ULL;
+    uint64_t state = length * multiplier;
+    uint64_t word;
+
+    /*
+    	Whole words
+    */
+    for (; length >= sizeof(word); string += sizeof(word), length -= sizeof(word))
+    {
+        memcpy(&word, string, sizeof(word));
+        state = (state ^ word) * multiplier;
+        state ^= state >> 29;
+    }
+
+    /*
+    	The tail (if any)
+    */
+    if (length != 0)
+    {
+        word = 0;
+        memcpy(&word, string, length);
+        state = (state ^ word) * multiplier;
+        state ^= state >> 29;
+    }
+
+    /*
+    	Final avalanche (from MurmurHash3's fmix64)
+    */
+    state ^= state >> 33;
+    state *= 0xFF51AFD7ED558CCDULL;
+    state ^= state >> 33;
+
+    return (uint32_t)(state >> 32);
+}
+
+/*
+	STRING_POOL::PUBLISH()
+	----------------------
+*/
+string_pool::id_type string_pool::publish(const uint8_t *at)
+{
+    /*
+    	The id is only taken once its segment exists, so that running out of memory does not leave a gap in the ids
+    */
+    id_type id = strings.load(std::memory_order_relaxed);
+    size_t position, bits;
+    const uint8_t **current;
+    do
+    {
+        position = (size_t)id + ((size_t)1 << first_segment_bits);
+        bits = (sizeof(unsigned long long) * 8 - 1) - __builtin_clzll(position);
+        auto &table = segment[bits - first_segment_bits];
+
+        /*
+        	Allocate the segment if this is the first id in it.  Several threads might try at once, the loser's memory stays in the pool
+        	(the pool allocator won't take the memory back) and is simply not used.
+        */
+        current = table.load(std::memory_order_acquire);
+        if (current == nullptr)
+        {
+            size_t entries = (size_t)1 << bits;
+            const uint8_t **another = (const uint8_t **)pool.malloc(entries * sizeof(*another), sizeof(*another));
+            if (another == nullptr)
+                return npos;
+            if (table.compare_exchange_strong(current, another, std::memory_order_acq_rel))
+                current = another;
+        }
+    }
+    while (!strings.compare_exchange_weak(id, id + 1, std::memory_order_relaxed));
+
+    current[position - ((size_t)1 << bits)] = at;
+    return id;
+}
+
+/*
+	STRING_POOL::FIND_SLOT()
+	------------------------
+*/
+string_pool::slot &string_pool::find_slot(stripe &within, const char *string, size_t length, uint32_t hash_value) const
+{
+    size_t mask = within.table.size() - 1;
+
+    for (size_t position = hash_value & mask; ; position = (position + 1) & mask)
+    {
+        slot &current = within.table[position];
+
+        if (current.id == npos)
+            return current;
+
+        if (current.hash == hash_value)
+        {
+            boost::string_ref candidate = view(current.id);
+            if (candidate.size() == length && memcmp(candidate.data(), string, length) == 0)
+                return current;
+        }
+    }
+}
+
+/*
+	STRING_POOL::GROW()
+	-------------------
+*/
+void string_pool::grow(stripe &within) const
+{
+    std::vector<slot> old(within.table.size() * 2, slot{0, npos});
+    old.swap(within.table);
+
+    size_t mask = within.table.size() - 1;
+    for (const auto &current : old)
+        if (current.id != npos)
+        {
+            size_t position = current.hash & mask;
+            while (within.table[position].id != npos)
+                position = (position + 1) & mask;
+            within.table[position] = current;
+        }
+}
+
+/*
+	STRING_POOL::INTERN()
+	---------------------
+*/
+string_pool::id_type string_pool::intern(const char *string, size_t length)
+{
+    uint32_t hash_value = hash(string, length);
+    stripe &within = stripes[hash_value >> stripe_shift];
+
+    std::lock_guard<std::mutex> critical_section(within.mutex);
+
+    slot *found = &find_slot(within, string, length, hash_value);
+    if (found->id != npos)
+        return found->id;
+
+    /*
+    	Not there so copy the string into the pool as a length-prefixed record
+    */
+    uint32_t record_length = (uint32_t)length;
+    uint8_t *entry = (uint8_t *)pool.malloc(sizeof(record_length) + length + (null_terminate ? 1 : 0), sizeof(record_length));
+    if (entry == nullptr)
+        return npos;
+    memcpy(entry, &record_length, sizeof(record_length));
+    memcpy(entry + sizeof(record_length), string, length);
+    if (null_terminate)
+        entry[sizeof(record_length) + length] = '\0';
+
+    id_type id = publish(entry);
+    if (id == npos)
+        return npos;
+    string_bytes += length;
+
+    /*
+    	Add it to the index, keeping the load factor at or below 1/2
+    */
+    if ((within.used + 1) * 2 > within.table.size())
+    {
+        grow(within);
+        found = &find_slot(within, string, length, hash_value);
+    }
+    found->hash = hash_value;
+    found->id = id;
+    within.used++;
+
+    return id;
+}
+
+/*
+	STRING_POOL::FIND()
+	-------------------
+*/
+string_pool::id_type string_pool::find(boost::string_ref string) const
+{
+    uint32_t hash_value = hash(string.data(), string.size());
+    stripe &within = stripes[hash_value >> stripe_shift];
+
+    std::lock_guard<std::mutex> critical_section(within.mutex);
+
+    return find_slot(within, string.data(), string.size(), hash_value).id;
+}
+
+}
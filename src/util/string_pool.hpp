@@ -0,0 +1,297 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+
+#include <boost/utility/string_ref.hpp>
+
+#include "allocator_pool.hpp"
+
+namespace deepfabric
+{
+/*
+	CLASS STRING_POOL
+	-----------------
+*/
+/*!
+	@brief Thread-safe string interning table that stores each distinct string exactly once in an allocator_pool.
+	@details Each distinct string is copied once into the pool as a 32-bit length followed by the bytes of the string (and, optionally,
+	a '\0' so that c_str() can be used).  The caller is handed back a dense 32-bit id (0, 1, 2, ...) that is stable for the lifetime of
+	the pool and can be turned back into the string in O(1) with view().
+
+	The hash index is lock-striped: the top bits of the hash select one of stripe_count independent open-addressing tables, each
+	protected by its own mutex, so threads interning different strings rarely contend.  The id to string table is a set of
+	geometrically growing segments allocated lazily from the pool, so it never moves and can be read without a lock.
+
+	Memory is never given back until the pool is rewound, at which point this object must not be used again.
+*/
+class string_pool
+{
+public:
+    typedef uint32_t id_type;
+    static constexpr id_type npos = (id_type)~0;				///< Returned by find() when the string is not in the pool, and by intern() when the pool is out of memory.
+
+protected:
+    static constexpr size_t stripe_count = 64;					///< Number of independently locked hash tables (must be a power of 2).
+    static constexpr size_t stripe_shift = 26;					///< Shift to get the stripe number from the top bits of a 32-bit hash.
+    static constexpr size_t first_segment_bits = 10;			///< The first segment of the id table holds 2^first_segment_bits ids.
+    static constexpr size_t segment_count = 32;					///< Enough segments to hold every possible 32-bit id.
+
+    /*
+    	CLASS STRING_POOL::SLOT
+    	-----------------------
+    */
+    /*!
+    	@brief An entry in the open-addressing hash table of a stripe.
+    */
+    class slot
+    {
+    public:
+        uint32_t hash;					///< The full hash of the string (used to avoid comparing strings that cannot match).
+        id_type id;						///< The id of the string (npos if this slot is empty).
+    };
+
+    /*
+    	CLASS STRING_POOL::STRIPE
+    	-------------------------
+    */
+    /*!
+    	@brief One lock-protected open-addressing hash table.  Aligned to a cache line so that the locks of neighbouring stripes do not share a line.
+    */
+    class alignas(64) stripe
+    {
+    public:
+        std::mutex mutex;				///< Held while reading or writing this stripe.
+        std::vector<slot> table;		///< Linear probing hash table, size is a power of 2.
+        size_t used;					///< Number of non-empty slots in table.
+
+    public:
+        stripe() :
+            table(16, slot{0, npos}),
+            used(0)
+        {
+            /*
+            	Nothing
+            */
+        }
+    };
+
+protected:
+    allocator_pool &pool;								///< The pool allocator the strings (and the id table) are stored in.
+    bool null_terminate;								///< Should each string be stored with a trailing '\0'?
+    std::atomic<id_type> strings;						///< The number of distinct strings in the pool (and the next id to hand out).
+    std::atomic<size_t> string_bytes;					///< The sum of the lengths of the distinct strings.
+    std::atomic<const uint8_t **> segment[segment_count];	///< The id table, segment[k] holds 2^(first_segment_bits + k) pointers.
+    mutable stripe stripes[stripe_count];				///< The lock-striped hash index.
+
+private:
+    /*
+    	STRING_POOL::STRING_POOL()
+    	--------------------------
+    */
+    /*!
+    	@brief Private copy constructor prevents object copying
+    */
+    string_pool(const string_pool &) = delete;
+
+    /*
+    	STRING_POOL::OPERATOR=()
+    	------------------------
+    */
+    /*!
+    	@brief Private assignment operator prevents assigning to this object
+    */
+    string_pool &operator=(const string_pool &) = delete;
+
+protected:
+    /*
+    	STRING_POOL::HASH()
+    	-------------------
+    */
+    /*!
+    	@brief Compute the 32-bit hash of a string.
+    	@param string [in] The string to hash.
+    	@param length [in] The length of string (in bytes).
+    	@return The hash value.
+    */
+    static uint32_t hash(const char *string, size_t length);
+
+    /*
+    	STRING_POOL::RECORD()
+    	---------------------
+    */
+    /*!
+    	@brief Return a pointer to the length-prefixed record of a string given its id.
+    	@param id [in] The id of the string.
+    	@return The record (a uint32_t length followed by the bytes).
+    */
+    const uint8_t *record(id_type id) const
+    {
+        size_t position = (size_t)id + ((size_t)1 << first_segment_bits);
+        size_t bits = (sizeof(unsigned long long) * 8 - 1) - __builtin_clzll(position);
+
+        return segment[bits - first_segment_bits].load(std::memory_order_acquire)[position - ((size_t)1 << bits)];
+    }
+
+    /*
+    	STRING_POOL::PUBLISH()
+    	----------------------
+    */
+    /*!
+    	@brief Give the record the next id and make it reachable through it (allocating a segment of the id table if necessary).
+    	@param at [in] The length-prefixed record in the pool.
+    	@return The id of the string, or npos if the pool could not provide the segment (in which case no id is used up).
+    */
+    id_type publish(const uint8_t *at);
+
+    /*
+    	STRING_POOL::FIND_SLOT()
+    	------------------------
+    */
+    /*!
+    	@brief Find the slot in the stripe that holds the string, or the empty slot where it should go.  The stripe must be locked.
+    	@param within [in] The (locked) stripe to search.
+    	@param string [in] The string to look for.
+    	@param length [in] The length of string (in bytes).
+    	@param hash_value [in] The hash of string.
+    	@return The slot.
+    */
+    slot &find_slot(stripe &within, const char *string, size_t length, uint32_t hash_value) const;
+
+    /*
+    	STRING_POOL::GROW()
+    	-------------------
+    */
+    /*!
+    	@brief Double the size of the hash table of a stripe.  The stripe must be locked.
+    	@param within [in] The stripe to grow.
+    */
+    void grow(stripe &within) const;
+
+public:
+    /*
+    	STRING_POOL::STRING_POOL()
+    	--------------------------
+    */
+    /*!
+    	@brief Constructor
+    	@param pool [in] The pool allocator used for all allocation done by this object.
+    	@param null_terminate [in] If true then each string is followed by a '\0' in the pool so that c_str() can be used.
+    */
+    explicit string_pool(allocator_pool &pool, bool null_terminate = true);
+
+    /*
+    	STRING_POOL::INTERN()
+    	---------------------
+    */
+    /*!
+    	@brief Return the id of the string, adding it to the pool if it is not already there.
+    	@param string [in] The string.
+    	@param length [in] The length of string (in bytes).
+    	@return The id of the string, or npos if it had to be added but the pool is out of memory (only if its exhaustion policy is
+    	allocator_pool::exhaustion_policy::return_nullptr).
+    */
+    id_type intern(const char *string, size_t length);
+
+    /*
+    	STRING_POOL::INTERN()
+    	---------------------
+    */
+    /*!
+    	@brief Return the id of the string, adding it to the pool if it is not already there.
+    	@param string [in] The string.
+    	@return The id of the string, or npos if it had to be added but the pool is out of memory.
+    */
+    id_type intern(boost::string_ref string)
+    {
+        return intern(string.data(), string.size());
+    }
+
+    /*
+    	STRING_POOL::FIND()
+    	-------------------
+    */
+    /*!
+    	@brief Return the id of the string if it is in the pool, but do not add it.
+    	@param string [in] The string.
+    	@return The id of the string or npos if it is not in the pool.
+    */
+    id_type find(boost::string_ref string) const;
+
+    /*
+    	STRING_POOL::VIEW()
+    	-------------------
+    */
+    /*!
+    	@brief Return the string with the given id.  The bytes live in the pool, so the view is valid until the pool is rewound.
+    	@param id [in] An id previously returned by intern().
+    	@return The string.
+    */
+    boost::string_ref view(id_type id) const
+    {
+        const uint8_t *at = record(id);
+        uint32_t length;
+
+        memcpy(&length, at, sizeof(length));
+        return boost::string_ref((const char *)at + sizeof(length), length);
+    }
+
+    /*
+    	STRING_POOL::C_STR()
+    	--------------------
+    */
+    /*!
+    	@brief Return the string with the given id as a '\0' terminated C string (only valid if the object was constructed with null_terminate).
+    	@param id [in] An id previously returned by intern().
+    	@return The string.
+    */
+    const char *c_str(id_type id) const
+    {
+        assert(null_terminate);
+        return (const char *)record(id) + sizeof(uint32_t);
+    }
+
+    /*
+    	STRING_POOL::SIZE()
+    	-------------------
+    */
+    /*!
+    	@brief Return the number of distinct strings in the pool.
+    	@return The number of strings.
+    */
+    size_t size(void) const
+    {
+        return strings;
+    }
+
+    /*
+    	STRING_POOL::BYTES()
+    	--------------------
+    */
+    /*!
+    	@brief Return the sum of the lengths of the distinct strings in the pool (excluding the length prefix and '\0').
+    	@return The number of bytes.
+    */
+    size_t bytes(void) const
+    {
+        return string_bytes;
+    }
+};
+}
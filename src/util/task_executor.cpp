@@ -0,0 +1,173 @@
+#include "log.hpp"
+#include "task_executor.hpp"
+
+namespace deepfabric
+{
+constexpr uint64_t task_executor::steal_margin;
+constexpr uint64_t task_executor::never;
+
+/*
+	The executor (and worker) the calling thread belongs to, so that tasks submitted from a task go to the local queue
+*/
+static thread_local const task_executor *current_executor = nullptr;
+static thread_local size_t current_worker = 0;
+
+/*
+	TASK_EXECUTOR::TASK_EXECUTOR()
+	------------------------------
+*/
+task_executor::task_executor(size_t threads) :
+    sequence(0),
+    next_worker(0),
+    pending(0),
+    sleepers(0),
+    stopping(false)
+{
+    slack[latency_sensitive] = 0;
+    slack[normal] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::milliseconds(10)).count();
+    slack[background] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::seconds(1)).count();
+
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency() == 0 ? 1 : std::thread::hardware_concurrency();
+
+    /*
+    	Create all the queues before starting any thread because each thread looks at all the queues
+    */
+    for (size_t id = 0; id < threads; id++)
+        workers.emplace_back(new worker);
+    for (size_t id = 0; id < threads; id++)
+        workers[id]->thread = std::thread(&task_executor::worker_main, this, id);
+}
+
+/*
+	TASK_EXECUTOR::~TASK_EXECUTOR()
+	-------------------------------
+*/
+task_executor::~task_executor()
+{
+    {
+        std::lock_guard<std::mutex> critical_section(sleep_mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+
+    for (auto &each : workers)
+        each->thread.join();
+}
+
+/*
+	TASK_EXECUTOR::ENQUEUE()
+	------------------------
+*/
+void task_executor::enqueue(task &&job, priority_class level, uint64_t due)
+{
+    worker &into = *workers[current_executor == this ? current_worker : next_worker++ % workers.size()];
+    key order = {due, ((uint64_t)level << 56) | (sequence++ & (((uint64_t)1 << 56) - 1))};
+
+    /*
+    	Count the task before it can be taken so that pending never goes below 0
+    */
+    pending++;
+    {
+        std::lock_guard<std::mutex> critical_section(into.mutex);
+        into.queue.push(order, std::move(job));
+        into.earliest.store(into.queue.top().first.due, std::memory_order_relaxed);
+    }
+
+    /*
+    	A worker increments sleepers before it checks pending (and we increment pending before we check sleepers) so either it sees
+    	the task or we see it and wake it.  Taking the lock to notify means the worker is either before its check or already waiting.
+    */
+    if (sleepers.load() != 0)
+    {
+        std::lock_guard<std::mutex> critical_section(sleep_mutex);
+        wakeup.notify_one();
+    }
+}
+
+/*
+	TASK_EXECUTOR::TAKE()
+	---------------------
+*/
+bool task_executor::take(size_t id, task &job)
+{
+    /*
+    	Find the queue with the most urgent task, preferring our own unless another is due sooner by more than steal_margin
+    */
+    size_t from = id;
+    uint64_t own = workers[id]->earliest.load(std::memory_order_relaxed);
+    uint64_t best = own;
+    for (size_t which = 0; which < workers.size(); which++)
+    {
+        uint64_t due = workers[which]->earliest.load(std::memory_order_relaxed);
+        if (due < best)
+        {
+            best = due;
+            from = which;
+        }
+    }
+    if (from != id && own != never && own - best <= steal_margin)
+        from = id;
+
+    if (best == never)
+        return false;
+
+    worker &victim = *workers[from];
+    {
+        std::lock_guard<std::mutex> critical_section(victim.mutex);
+        if (victim.queue.empty())
+            return false;			// someone else got there first, the caller will look again
+        job = std::move(victim.queue.top().second);
+        victim.queue.pop();
+        victim.earliest.store(victim.queue.empty() ? never : victim.queue.top().first.due, std::memory_order_relaxed);
+    }
+    pending--;
+
+    return true;
+}
+
+/*
+	TASK_EXECUTOR::WORKER_MAIN()
+	----------------------------
+*/
+void task_executor::worker_main(size_t id)
+{
+    task job;
+
+    current_executor = this;
+    current_worker = id;
+
+    while (true)
+    {
+        if (take(id, job))
+        {
+            try
+            {
+                job();
+            }
+            catch (...)
+            {
+                EXCEPTION();
+            }
+            job = nullptr;			// release whatever the task captured now rather than when the next one is taken
+            continue;
+        }
+
+        /*
+        	There's a task in flight between queues (or a lost race in take()), look again
+        */
+        if (pending.load() != 0)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> critical_section(sleep_mutex);
+        sleepers++;
+        wakeup.wait(critical_section, [this]() { return pending.load() != 0 || stopping; });
+        sleepers--;
+        if (stopping && pending.load() == 0)
+            return;
+    }
+}
+}
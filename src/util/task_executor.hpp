@@ -0,0 +1,291 @@
+// Copyright 2017 DeepFabric, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "bheap.hpp"
+
+namespace deepfabric
+{
+/*
+	CLASS TASK_EXECUTOR
+	-------------------
+*/
+/*!
+	@brief Thread pool that runs tasks in order of priority class and deadline rather than first-in first-out.
+	@details Each task is given a virtual deadline when it is submitted: the time it was submitted plus the slack of its priority
+	class, or its own deadline if that is sooner.  Workers always run the task with the earliest virtual deadline they can find, so a
+	latency_sensitive task (slack 0) goes ahead of every background task submitted less than the background slack ago.  This is also
+	the aging: a background task that has waited for its slack is due now and so competes on equal terms with new arrivals, so a
+	flood of urgent work delays it by at most about its slack rather than forever.  Ties go to the higher priority class and then to
+	the task submitted first.
+
+	Each worker has its own run queue (a B-heap prio_queue under its own mutex), so submitting does not contend on one lock.  Tasks
+	submitted from a worker go to that worker's queue and the rest are dealt round-robin.  Each queue publishes the virtual deadline
+	of its most urgent task, and before running anything a worker scans these and steals the most urgent task of another queue if it
+	is due sooner than its own (by more than steal_margin).  This rebalances the queues and means a task is not stuck behind a long
+	running task on the worker whose queue it is in.
+
+	Exceptions thrown by tasks are logged and otherwise ignored.  The destructor runs every task already submitted before returning.
+*/
+class task_executor
+{
+public:
+    typedef std::function<void(void)> task;					///< The unit of work.
+    typedef std::chrono::steady_clock clock;				///< The clock deadlines are measured by.
+
+    /*!
+    	@enum priority_class
+    	@brief The priority classes, most urgent first.
+    */
+    enum priority_class : uint32_t
+    {
+        latency_sensitive = 0,			///< Someone is waiting for the result (default slack 0).
+        normal = 1,						///< Ordinary work (default slack 10ms).
+        background = 2,					///< Merges, aging, snapshots and so on (default slack 1s).
+        priority_classes = 3			///< The number of priority classes.
+    };
+
+    static constexpr uint64_t steal_margin = 20000;		///< Steal from another queue only if its top is due this many nanoseconds before our own.
+
+protected:
+    /*
+    	CLASS TASK_EXECUTOR::KEY
+    	------------------------
+    */
+    /*!
+    	@brief The run queue order of a task.
+    */
+    class key
+    {
+    public:
+        uint64_t due;					///< The virtual deadline (in nanoseconds since the clock's epoch).
+        uint64_t order;					///< The priority class (top 8 bits) and submission sequence number (the rest), to break ties.
+
+    public:
+        bool operator<(const key &other) const
+        {
+            return due < other.due || (due == other.due && order < other.order);
+        }
+    };
+
+    typedef prio_queue<32, key, task> run_queue;		///< A min-heap of tasks ordered by key.
+
+    /*
+    	CLASS TASK_EXECUTOR::WORKER
+    	---------------------------
+    */
+    /*!
+    	@brief A worker thread and its run queue.  Padded so that the locks of neighbouring workers do not share a cache line (the workers
+    	are allocated separately, and alignas(64) would need C++17's aligned new).
+    */
+    class worker
+    {
+    public:
+        std::mutex mutex;						///< Held while reading or writing queue.
+        run_queue queue;						///< The tasks waiting to run.
+        std::atomic<uint64_t> earliest;			///< The due time of the top of queue (never if it is empty), read without the lock.
+        std::thread thread;						///< The worker thread.
+        uint8_t padding[64];					///< Keeps whatever is allocated next off the cache line of earliest.
+
+    public:
+        worker() :
+            earliest(never)
+        {
+            /*
+            	Nothing
+            */
+        }
+    };
+
+protected:
+    static constexpr uint64_t never = ~(uint64_t)0;		///< The earliest of an empty queue.
+
+    std::vector<std::unique_ptr<worker>> workers;		///< The workers.
+    std::atomic<uint64_t> slack[priority_classes];		///< The slack of each priority class (in nanoseconds).
+    std::atomic<uint64_t> sequence;						///< The next submission sequence number.
+    std::atomic<size_t> next_worker;					///< Round-robin counter for submissions from outside the pool.
+    std::atomic<size_t> pending;						///< The number of tasks in the run queues (not counting those running).
+    std::atomic<size_t> sleepers;						///< The number of workers waiting (or about to wait) on wakeup.
+    std::mutex sleep_mutex;								///< Protects the sleep / wakeup handshake.
+    std::condition_variable wakeup;						///< Idle workers wait on this for work.
+    bool stopping;										///< Set (under sleep_mutex) by the destructor.
+
+private:
+    /*
+    	TASK_EXECUTOR::TASK_EXECUTOR()
+    	------------------------------
+    */
+    /*!
+    	@brief Private copy constructor prevents object copying
+    */
+    task_executor(const task_executor &) = delete;
+
+    /*
+    	TASK_EXECUTOR::OPERATOR=()
+    	--------------------------
+    */
+    /*!
+    	@brief Private assignment operator prevents assigning to this object
+    */
+    task_executor &operator=(const task_executor &) = delete;
+
+protected:
+    /*
+    	TASK_EXECUTOR::NOW()
+    	--------------------
+    */
+    /*!
+    	@brief Return the current time in nanoseconds since the clock's epoch.
+    */
+    static uint64_t now(void)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count();
+    }
+
+    /*
+    	TASK_EXECUTOR::ENQUEUE()
+    	------------------------
+    */
+    /*!
+    	@brief Add a task to a run queue and wake a worker if any are asleep.
+    	@param job [in] The task.
+    	@param level [in] Its priority class.
+    	@param due [in] Its virtual deadline.
+    */
+    void enqueue(task &&job, priority_class level, uint64_t due);
+
+    /*
+    	TASK_EXECUTOR::TAKE()
+    	---------------------
+    */
+    /*!
+    	@brief Remove the most urgent task from this worker's queue, or from another's if that is due sooner.
+    	@param id [in] The worker asking.
+    	@param job [out] The task.
+    	@return true if a task was taken, false if every queue looked empty.
+    */
+    bool take(size_t id, task &job);
+
+    /*
+    	TASK_EXECUTOR::WORKER_MAIN()
+    	----------------------------
+    */
+    /*!
+    	@brief The body of each worker thread.
+    	@param id [in] The worker.
+    */
+    void worker_main(size_t id);
+
+public:
+    /*
+    	TASK_EXECUTOR::TASK_EXECUTOR()
+    	------------------------------
+    */
+    /*!
+    	@brief Constructor.  Starts the worker threads.
+    	@param threads [in] The number of worker threads (0 means one per hardware thread).
+    */
+    explicit task_executor(size_t threads = 0);
+
+    /*
+    	TASK_EXECUTOR::~TASK_EXECUTOR()
+    	-------------------------------
+    */
+    /*!
+    	@brief Destructor.  Runs every task already submitted (and any they submit) then stops the worker threads.
+    */
+    ~task_executor();
+
+    /*
+    	TASK_EXECUTOR::SUBMIT()
+    	-----------------------
+    */
+    /*!
+    	@brief Submit a task to run as soon as its priority class allows.
+    	@param job [in] The task.
+    	@param level [in] Its priority class.
+    */
+    void submit(task job, priority_class level = normal)
+    {
+        enqueue(std::move(job), level, now() + slack[level].load(std::memory_order_relaxed));
+    }
+
+    /*
+    	TASK_EXECUTOR::SUBMIT()
+    	-----------------------
+    */
+    /*!
+    	@brief Submit a task that should run by a deadline (or as soon as its priority class allows, if that is sooner).
+    	@param job [in] The task.
+    	@param level [in] Its priority class.
+    	@param deadline [in] When it should run by.
+    */
+    void submit(task job, priority_class level, clock::time_point deadline)
+    {
+        uint64_t by_class = now() + slack[level].load(std::memory_order_relaxed);
+        uint64_t by_deadline = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+
+        enqueue(std::move(job), level, by_deadline < by_class ? by_deadline : by_class);
+    }
+
+    /*
+    	TASK_EXECUTOR::SET_SLACK()
+    	--------------------------
+    */
+    /*!
+    	@brief Set how long a task of a priority class may wait before it is as urgent as a new task with no slack.
+    	@param level [in] The priority class.
+    	@param wait [in] The slack (affects tasks submitted from now on).
+    */
+    void set_slack(priority_class level, std::chrono::nanoseconds wait)
+    {
+        slack[level] = wait.count();
+    }
+
+    /*
+    	TASK_EXECUTOR::SIZE()
+    	---------------------
+    */
+    /*!
+    	@brief Return the number of worker threads.
+    */
+    size_t size(void) const
+    {
+        return workers.size();
+    }
+
+    /*
+    	TASK_EXECUTOR::QUEUED()
+    	-----------------------
+    */
+    /*!
+    	@brief Return the number of tasks waiting to run.
+    */
+    size_t queued(void) const
+    {
+        return pending.load(std::memory_order_relaxed);
+    }
+};
+}
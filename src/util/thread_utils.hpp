@@ -13,6 +13,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <thread>
@@ -26,6 +27,14 @@ inline void sleep_ms(size_t ms) {
   std::this_thread::sleep_for(duration);
 }
 
+// Returns a small number unique to the calling thread (0 for the first thread to ask, 1 for the
+// next, and so on), for indexing per-thread slots without hashing std::thread::id.
+inline size_t thread_ordinal() {
+  static std::atomic<size_t> next(0);
+  static thread_local size_t ordinal = next++;
+  return ordinal;
+}
+
 template< typename Mutex >
 inline std::unique_lock< Mutex > make_lock(Mutex& mtx) {
   return std::unique_lock< Mutex >(mtx);
@@ -14,10 +14,15 @@
 #pragma once
 
 #include <stdint.h>
+#include <string.h>
 #include <array>
 #include <atomic>
 #include <thread>
 
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+
 #include "allocator_pool.hpp"
 
 namespace deepfabric
@@ -28,6 +33,9 @@ namespace deepfabric
 */
 class compressed_dynamic_array
 {
+public:
+    typedef uint32_t value_type;		///< So that std::back_inserter() can be used with a compressed_dynamic_array.
+
 protected:
 
 #pragma pack(push,1)
@@ -55,6 +63,116 @@ protected:
     };
 #pragma pack(pop)
 
+    static const size_t node_alignment = 64;	///< Nodes are packed, so start them on a cache line to keep used (an atomic) from straddling two (split locks are very slow).
+    static const size_t batch_size = 256;		///< push_back_n() works on batches of this many values.
+    static const size_t batch_slack = 16;		///< push_back_n() may write up to this many bytes past the end of a batch's encoding.
+
+    /*!
+    	@brief Return the number of bytes in the variable byte encoding of value.
+    */
+    static size_t encoded_length(uint32_t value)
+    {
+        return value == 0 ? 1 : (38 - __builtin_clz(value)) / 7;		// (bits + 6) / 7 where bits = 32 - clz
+    }
+
+    /*!
+    	@brief Return the variable byte encoding of value as the low length bytes of a 64-bit integer (little endian).
+    */
+    static uint64_t spread(uint32_t value, size_t length)
+    {
+        uint64_t x = value;
+        uint64_t bytes = (x & 0x7F) | ((x << 1) & 0x7F00) | ((x << 2) & 0x7F0000) | ((x << 3) & 0x7F000000) | ((x << 4) & 0xF00000000ULL);
+        return bytes | (0x0000008080808080ULL & ((1ULL << (8 * (length - 1))) - 1));		// continuation bit on all but the last byte
+    }
+
+    /*!
+    	@brief Compute the encoded length of each value.
+    	@param values [in] The values.
+    	@param count [in] The number of values.
+    	@param length [out] The length (in bytes) of the encoding of each value.
+    	@return The total length (in bytes) of the encodings.
+    */
+    static size_t encoded_lengths(const uint32_t *values, size_t count, uint8_t *length)
+    {
+        size_t total = 0;
+        size_t which = 0;
+#ifdef __SSE4_1__
+        /*
+        	Four at a time: length = 1 + (value >= 2^7) + (value >= 2^14) + (value >= 2^21) + (value >= 2^28), using signed compares on biased values
+        */
+        const __m128i bias = _mm_set1_epi32(0x80000000);
+        const __m128i at_least_2 = _mm_set1_epi32((1 << 7) - 1 - 0x80000000);
+        const __m128i at_least_3 = _mm_set1_epi32((1 << 14) - 1 - 0x80000000);
+        const __m128i at_least_4 = _mm_set1_epi32((1 << 21) - 1 - 0x80000000);
+        const __m128i at_least_5 = _mm_set1_epi32((1 << 28) - 1 - 0x80000000);
+        __m128i sum = _mm_setzero_si128();
+        for (; which + 4 <= count; which += 4)
+        {
+            __m128i biased = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(values + which)), bias);
+            __m128i lengths = _mm_sub_epi32(_mm_set1_epi32(1), _mm_add_epi32(_mm_add_epi32(_mm_cmpgt_epi32(biased, at_least_2), _mm_cmpgt_epi32(biased, at_least_3)), _mm_add_epi32(_mm_cmpgt_epi32(biased, at_least_4), _mm_cmpgt_epi32(biased, at_least_5))));
+            sum = _mm_add_epi32(sum, lengths);
+            __m128i packed = _mm_packus_epi16(_mm_packus_epi32(lengths, lengths), lengths);
+            uint32_t four = _mm_cvtsi128_si32(packed);
+            memcpy(length + which, &four, sizeof(four));
+        }
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        total = _mm_cvtsi128_si32(sum);
+#endif
+        for (; which < count; which++)
+            total += length[which] = (uint8_t)encoded_length(values[which]);
+
+        return total;
+    }
+
+    /*!
+    	@brief Variable byte encode the values (the same bytes as push_back()).  Up to batch_slack bytes past the end of the encoding may be written.
+    	@param values [in] The values.
+    	@param count [in] The number of values.
+    	@param length [in] The length of the encoding of each value (from encoded_lengths()).
+    	@param into [out] The encoding.
+    */
+    static void encode(const uint32_t *values, size_t count, const uint8_t *length, uint8_t *into)
+    {
+        size_t which = 0;
+#ifdef __SSE4_1__
+        /*
+        	Two at a time: spread each value into a 64-bit lane then use a shuffle to squeeze out the unused bytes of the first lane
+        */
+        static const struct compaction_table
+        {
+            __m128i shuffle[5][5];
+            compaction_table()
+            {
+                for (size_t first = 1; first <= 5; first++)
+                    for (size_t second = 1; second <= 5; second++)
+                    {
+                        uint8_t mask[16];
+                        memset(mask, 0x80, sizeof(mask));		// 0x80 means zero this byte
+                        for (size_t byte = 0; byte < first; byte++)
+                            mask[byte] = byte;
+                        for (size_t byte = 0; byte < second; byte++)
+                            mask[first + byte] = 8 + byte;
+                        shuffle[first - 1][second - 1] = _mm_loadu_si128((const __m128i *)mask);
+                    }
+            }
+        } table;
+
+        for (; which + 2 <= count; which += 2)
+        {
+            __m128i both = _mm_set_epi64x(spread(values[which + 1], length[which + 1]), spread(values[which], length[which]));
+            _mm_storeu_si128((__m128i *)into, _mm_shuffle_epi8(both, table.shuffle[length[which] - 1][length[which + 1] - 1]));
+            into += length[which] + length[which + 1];
+        }
+#endif
+        for (; which < count; which++)
+        {
+            uint64_t bytes = spread(values[which], length[which]);
+            memcpy(into, &bytes, sizeof(bytes));
+            into += length[which];
+        }
+    }
+
 public:
 
     class iterator
@@ -62,26 +180,45 @@ public:
     private:
         const node *current_node;		///< The node that this iterator is currently looking at.
         uint32_t element;               ///< Currently decoded element
-        uint8_t *data;					///< Pointer to the byte within current_node that this object is looking at.
+        const uint8_t *data;			///< Pointer to the encoding of element within current_node (nullptr at the end).
+        const uint8_t *next;			///< Pointer to the byte after the encoding of element.
 
-        const uint32_t read_word()
+        void read_word()
         {
-            uint8_t b = *(data++);
+            const uint8_t *from = data;
+            uint8_t b = *(from++);
             uint32_t i = b & 0x7F;
             for (uint32_t shift = 7; (b & 0x80) != 0; shift += 7)
             {
-                b = *(data++);
+                b = *(from++);
                 i |= (b & 0x7FL) << shift;
             }
-            return i;
+            element = i;
+            next = from;
+        }
+
+        /*!
+        	@brief If data is past the end of current_node then move on to the first non-empty node after it, then decode the element there.
+        */
+        void settle()
+        {
+            while (current_node != nullptr && data >= current_node->data + current_node->used)
+            {
+                current_node = current_node->next;
+                data = current_node == nullptr ? nullptr : current_node->data;
+            }
+            if (data != nullptr)
+                read_word();
         }
 
     public:
         iterator(node *node):
             current_node(node),
             element(0),
-            data(nullptr)
+            data(node == nullptr ? nullptr : node->data),
+            next(nullptr)
         {
+            settle();
         }
 
         bool operator!=(const iterator &other) const
@@ -99,21 +236,31 @@ public:
 
         const iterator &operator++()
         {
-            element = read_word();
-
-            if (data >= current_node->data + current_node->used)
-            {
-                current_node = current_node->next;
-
-                if (current_node == nullptr)
-                    data = nullptr;
-                else
-                    data = current_node->data;
-            }
+            data = next;
+            settle();
             return *this;
         }
     };
 
+protected:
+    /*!
+    	@brief Make a new node the tail of the list, unless another thread already has.
+    	@param last [in] The tail the caller saw.
+    	@param minimum [in] The new node is growth_factor times larger than last, but at least this size (in bytes).
+    */
+    void add_node(node *last, size_t minimum)
+    {
+        size_t size = (size_t)(last->allocated * growth_factor);
+        node *another = new (pool.malloc(sizeof(node), node_alignment)) node(pool, size > minimum ? size : minimum);
+
+        /*
+        	Atomicly make it the tail and if we succeed than make the previous node in the list point to this one.
+        	If we fail then the pool allocator won't take the memory back so ignore and re-try
+        */
+        if (tail.compare_exchange_strong(last, another))
+            last->next = another;
+    }
+
 public:
     allocator_pool &pool;				///< The pool allocator used for all allocation by this object.
     node *head;							///< Pointer to the head of the linked list of blocks of data.
@@ -131,18 +278,15 @@ public:
         pool(pool),
         growth_factor(growth_factor)
     {
-        head = tail = new (pool.malloc(sizeof(node))) node(pool, initial_size);
+        head = tail = new (pool.malloc(sizeof(node), node_alignment)) node(pool, initial_size);
     }
 
     iterator begin(void) const
     {
         /*
-        	If there's nothing in the array then we're at the end, else we're at the head.
+        	The iterator skips empty nodes (the head is empty if the first element did not fit), so at the end if the array is empty.
         */
-        if (head->used == 0)
-            return end();
-        else
-            return iterator(head);
+        return iterator(head);
     }
 
     iterator end(void) const
@@ -169,17 +313,42 @@ public:
                 break;
             }
             else
+                add_node(last, 8);
+        }
+        while(true);
+    }
+
+    /*!
+    	@brief Add count elements to the end of the array, producing the same bytes as calling push_back() on each.
+    	@details The lengths of the encodings of a batch are computed with SIMD, the space for the whole batch is reserved
+    	at once, then the batch is encoded two values at a time with a shuffle.
+    	@param elements [in] The elements to add.
+    	@param count [in] The number of elements.
+    */
+    void push_back_n(const uint32_t *elements, size_t count)
+    {
+        uint8_t length[batch_size];
+
+        for (size_t start = 0; start < count; start += batch_size)
+        {
+            size_t batch = count - start < batch_size ? count - start : batch_size;
+            size_t total = encoded_lengths(elements + start, batch, length);
+
+            do
             {
-                node *another = new (pool.malloc(sizeof(node))) node(pool, (size_t)(last->allocated * growth_factor));
-                /*
-                	Atomicly make it the tail and if we succeed than make the previous node in the list point to this one.
-                	If we fail then the pool allocator won't take the memory back so ignore and re-try
-                */
-                if (tail.compare_exchange_strong(last, another))
-                    last->next = another;
+                node *last = tail;
+
+                if (total + batch_slack <= last->allocated - last->used)
+                {
+                    encode(elements + start, batch, length, last->data + last->used);
+                    last->used += total;
+                    break;
+                }
+                else
+                    add_node(last, total + batch_slack);
             }
+            while(true);
         }
-        while(true);
     }
 
 };